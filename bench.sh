@@ -0,0 +1,56 @@
+#!/bin/bash
+# bench.sh - time every filefix mode over synthetic data files (make bench)
+#
+# Prints one JSON line per run (see filebench.c). Settings come from the
+# environment:
+#	FILEFIX, FILEBENCH	binaries (default ./filefix, ./filebench)
+#	BENCH_DIR			scratch directory for the data files
+#	RECORD_SIZE			record size including the terminator (default 256)
+#	RECORDS				records per data file (default 400000)
+#	TERMINATOR			fa (default) or 0a
+#	ENGINES				I/O engines for the full-detection modes (default mmap)
+#	LABEL				label of the results (default git describe)
+
+FILEFIX=${FILEFIX:-./filefix}
+FILEBENCH=${FILEBENCH:-./filebench}
+BENCH_DIR=${BENCH_DIR:-/tmp/filefix-bench}
+RECORD_SIZE=${RECORD_SIZE:-256}
+RECORDS=${RECORDS:-400000}
+TERMINATOR=${TERMINATOR:-fa}
+ENGINES=${ENGINES:-mmap}
+LABEL=${LABEL:-$(git describe --always --dirty 2>/dev/null || echo unknown)}
+
+mkdir -p "$BENCH_DIR" || exit 1
+DATA="$BENCH_DIR/BEN0001.TXT"
+WRONG="$BENCH_DIR/BEN0002.TXT"
+WORK="$BENCH_DIR/work.TXT"
+
+# Fixed length file for -p/-i/-x/-y, a second one with wrong length records for -w
+$FILEBENCH gen -o "$DATA" -l $RECORD_SIZE -n $RECORDS -t $TERMINATOR -c 0.001 -z 0.0002 -s 1 >&2 || exit 1
+$FILEBENCH gen -o "$WRONG" -l $RECORD_SIZE -n $RECORDS -t $TERMINATOR -c 0.001 -z 0.0002 -w 0.0005 -s 2 >&2 || exit 1
+POSITION=$(head -1 "$DATA.pos")
+POSITIONS=$(wc -l < "$DATA.pos")
+
+# run_mode SOURCE MODE READ ARGS... - time filefix on a fresh copy of SOURCE;
+# READ is the number of records it reads, 0 for the whole file
+run_mode() {
+	SOURCE=$1
+	MODE=$2
+	READ=$3
+	shift 3
+	cp "$SOURCE" "$WORK" || exit 1
+	$FILEBENCH run -d "$WORK" -l $RECORD_SIZE -m "$MODE" -L "$LABEL" -r $READ -- $FILEFIX -d "$WORK" -l $RECORD_SIZE "$@"
+}
+
+for UPDATE in "" "-u"; do
+	run_mode "$DATA" "-p${UPDATE:+ $UPDATE}" 1 -p $POSITION $UPDATE
+	run_mode "$DATA" "-i${UPDATE:+ $UPDATE}" $POSITIONS -i "$DATA.pos" $UPDATE
+	run_mode "$WRONG" "-w${UPDATE:+ $UPDATE}" 0 -w $UPDATE
+	for ENGINE in $ENGINES; do
+		run_mode "$DATA" "-y -e $ENGINE${UPDATE:+ $UPDATE}" 0 -y -e $ENGINE $UPDATE
+		run_mode "$DATA" "-x -e $ENGINE${UPDATE:+ $UPDATE}" 0 -x -e $ENGINE $UPDATE
+		run_mode "$DATA" "-x -y -e $ENGINE${UPDATE:+ $UPDATE}" 0 -x -y -e $ENGINE $UPDATE
+	done
+done
+
+rm -f "$WORK"
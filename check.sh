@@ -0,0 +1,188 @@
+#!/bin/bash
+# check.sh - regression checks of filefix on small hand-made data files (make check)
+#
+# Prints one line per check and exits non-zero when one fails. Settings come
+# from the environment:
+#	FILEFIX				binary (default ./filefix)
+#	CHECK_DIR			scratch directory for the data files
+
+FILEFIX=${FILEFIX:-./filefix}
+CHECK_DIR=${CHECK_DIR:-/tmp/filefix-check}
+FAILED=0
+
+mkdir -p "$CHECK_DIR" || exit 1
+
+# records COUNT CHAR - COUNT 16-byte records of CHAR ending in the 0xFA divider
+records() {
+	for ((r=0;r<$1;r++)); do
+		printf "%015d\372" 0 | tr 0 "$2"
+	done
+}
+
+# deleted - one 16-byte record cleared to 0xFF throughout
+deleted() {
+	printf "%016d" 0 | tr 0 "\377"
+}
+
+# patch FILE OFFSET OCTAL - overwrite one byte of FILE
+patch() {
+	printf "\\$3" | dd of="$1" bs=1 seek=$2 conv=notrunc 2>/dev/null
+}
+
+# result NAME EXPECTED ACTUAL - print the outcome of a check
+result() {
+	if [ "$2" == "$3" ]; then
+		echo "ok   $1"
+	else
+		echo "FAIL $1: expected \"$2\", got \"$3\""
+		FAILED=1
+	fi
+}
+
+# A stray 0x0A inside a record is an invalid byte of that record; the records
+# after it, and its own 0xFA divider, stay as they are
+records 6 A > "$CHECK_DIR/stray.TXT"
+patch "$CHECK_DIR/stray.TXT" 37 012
+cp "$CHECK_DIR/stray.TXT" "$CHECK_DIR/stray.orig"
+$FILEFIX -d "$CHECK_DIR/stray.TXT" -l 16 -w -u > /dev/null
+result "-w -u stray divider" "38 12 40" "$(cmp -l "$CHECK_DIR/stray.orig" "$CHECK_DIR/stray.TXT" | awk '{print $1,$2,$3}')"
+
+# A short record is reported but not rewritten, the records after it are found
+# from its divider
+{ records 2 A; printf "BBBBBBBBBBBB\372"; records 3 C; } > "$CHECK_DIR/short.TXT"
+cp "$CHECK_DIR/short.TXT" "$CHECK_DIR/short.orig"
+$FILEFIX -d "$CHECK_DIR/short.TXT" -l 16 -w -u > "$CHECK_DIR/short.out"
+result "-w -u short record unchanged" "" "$(cmp "$CHECK_DIR/short.orig" "$CHECK_DIR/short.TXT" 2>&1)"
+result "-w short record position" "Record position: 32" "$(grep -a '^Record position' "$CHECK_DIR/short.out")"
+
+# -D definition: alpha and numeric fields get their fill, an invalid character
+# of a date field is reported and left alone (no digit makes it a valid date)
+printf "* fixture\nNAME DIM 5\nAMOUNT FORM 3.2\nDUE DATE 8\n" > "$CHECK_DIR/def.DEF"
+for ((r=0;r<3;r++)); do printf "ABCDE012.5020240115\372"; done > "$CHECK_DIR/def.TXT"
+patch "$CHECK_DIR/def.TXT" 21 001
+patch "$CHECK_DIR/def.TXT" 27 001
+patch "$CHECK_DIR/def.TXT" 33 001
+cp "$CHECK_DIR/def.TXT" "$CHECK_DIR/def.orig"
+$FILEFIX -d "$CHECK_DIR/def.TXT" -D "$CHECK_DIR/def.DEF" -y -u > "$CHECK_DIR/def.out"
+result "-D alpha and numeric fill" "22 1 40|28 1 60" "$(cmp -l "$CHECK_DIR/def.orig" "$CHECK_DIR/def.TXT" | awk '{print $1,$2,$3}' | paste -sd'|')"
+result "-D date field reported" "hex: 1; dec: 1) in a date field. Offset: 13" "$(grep -a '^Leaving' "$CHECK_DIR/def.out" | cut -d'(' -f2-)"
+
+# -T map file: a "preset" first line, then "from to" lines; a target that is
+# not a valid character is refused with its line number and nothing is written
+records 2 A > "$CHECK_DIR/translate.TXT"
+patch "$CHECK_DIR/translate.TXT" 2 351
+patch "$CHECK_DIR/translate.TXT" 18 311
+cp "$CHECK_DIR/translate.TXT" "$CHECK_DIR/translate.orig"
+printf "preset latin1\n0xE9 e\n" > "$CHECK_DIR/translate.map"
+$FILEFIX -d "$CHECK_DIR/translate.TXT" -l 16 -y -u -T "$CHECK_DIR/translate.map" > /dev/null
+result "-T map and preset" "3 351 145|19 311 105" "$(cmp -l "$CHECK_DIR/translate.orig" "$CHECK_DIR/translate.TXT" | awk '{print $1,$2,$3}' | paste -sd'|')"
+cp "$CHECK_DIR/translate.orig" "$CHECK_DIR/translate.TXT"
+printf "# divider\n0xE9 0xFA\n" > "$CHECK_DIR/translate.map"
+result "-T invalid target" "Translation map line 2: target 0xfa is not a valid character." \
+	"$($FILEFIX -d "$CHECK_DIR/translate.TXT" -l 16 -y -u -T "$CHECK_DIR/translate.map" | grep -a '^Translation map')"
+result "-T invalid target unchanged" "" "$(cmp "$CHECK_DIR/translate.orig" "$CHECK_DIR/translate.TXT" 2>&1)"
+
+# -m rescans only the 1MB manifest blocks that changed, or held invalid characters
+yes AAAAAAAAAAAAAAA | head -c $((3*1024*1024)) | tr '\n' '\372' > "$CHECK_DIR/manifest.TXT"
+rm -f "$CHECK_DIR/manifest.TXT.ffm"
+{
+	$FILEFIX -d "$CHECK_DIR/manifest.TXT" -l 16 -y -m
+	$FILEFIX -d "$CHECK_DIR/manifest.TXT" -l 16 -y -m
+	patch "$CHECK_DIR/manifest.TXT" $((1024*1024 + 20)) 001
+	$FILEFIX -d "$CHECK_DIR/manifest.TXT" -l 16 -y -m -j 3
+	$FILEFIX -d "$CHECK_DIR/manifest.TXT" -l 16 -y -m
+} > "$CHECK_DIR/manifest.out" 2>&1
+result "-m changed blocks" "3 of 3|0 of 3|1 of 3|1 of 3" \
+	"$(sed -n 's/^Incremental scan: \(.*\) blocks changed$/\1/p' "$CHECK_DIR/manifest.out" | paste -sd'|')"
+result "-m invalid characters" "Record: 65537; Position: 1048592|Record: 65537; Position: 1048592" \
+	"$(grep -a '^Record:' "$CHECK_DIR/manifest.out" | paste -sd'|')"
+
+# --compact removes deleted (0xFF) records through a copy renamed over the data
+# file, with the old to new position of each run of live records in the remap
+{ records 2 A; deleted; records 2 B; deleted; records 1 C; } > "$CHECK_DIR/compact.TXT"
+{ records 2 A; records 2 B; records 1 C; } > "$CHECK_DIR/compact.expected"
+$FILEFIX -d "$CHECK_DIR/compact.TXT" -l 16 -x -u --compact "$CHECK_DIR/compact.remap" > /dev/null 2>&1
+result "--compact data file" "" "$(cmp "$CHECK_DIR/compact.expected" "$CHECK_DIR/compact.TXT" 2>&1)"
+result "--compact remap" "0 0 2|48 32 2|96 64 1" "$(paste -sd'|' "$CHECK_DIR/compact.remap")"
+result "--compact temporary files removed" "" "$(ls "$CHECK_DIR/compact.TXT.compact" "$CHECK_DIR/compact.remap.tmp" 2> /dev/null)"
+
+# --patch-out writes the repairs of a report-mode scan to a patch that
+# --apply-patch turns into the same data file as a -u run; a data file whose
+# size changed since the scan is refused
+{ records 3 A; records 3 B; } > "$CHECK_DIR/patch.TXT"
+patch "$CHECK_DIR/patch.TXT" 5 001
+patch "$CHECK_DIR/patch.TXT" 6 002
+patch "$CHECK_DIR/patch.TXT" 70 377
+cp "$CHECK_DIR/patch.TXT" "$CHECK_DIR/patch.orig"
+cp "$CHECK_DIR/patch.TXT" "$CHECK_DIR/patch.u"
+$FILEFIX -d "$CHECK_DIR/patch.TXT" -l 16 -y --patch-out "$CHECK_DIR/patch.ffp" > /dev/null
+result "--patch-out data file unchanged" "" "$(cmp "$CHECK_DIR/patch.orig" "$CHECK_DIR/patch.TXT" 2>&1)"
+$FILEFIX -d "$CHECK_DIR/patch.TXT" --apply-patch "$CHECK_DIR/patch.ffp" > /dev/null
+$FILEFIX -d "$CHECK_DIR/patch.u" -l 16 -y -u > /dev/null
+result "--apply-patch same as -u" "" "$(cmp "$CHECK_DIR/patch.u" "$CHECK_DIR/patch.TXT" 2>&1)"
+cp "$CHECK_DIR/patch.orig" "$CHECK_DIR/patch.TXT"
+records 1 C >> "$CHECK_DIR/patch.TXT"
+cp "$CHECK_DIR/patch.TXT" "$CHECK_DIR/patch.orig"
+$FILEFIX -d "$CHECK_DIR/patch.TXT" --apply-patch "$CHECK_DIR/patch.ffp" > /dev/null 2>&1
+result "--apply-patch size changed" "" "$(cmp "$CHECK_DIR/patch.orig" "$CHECK_DIR/patch.TXT" 2>&1)"
+
+# --online skips records locked by someone else and does not count them as updated
+# (the fcntl lock is held from python3)
+records 8 A > "$CHECK_DIR/online.TXT"
+patch "$CHECK_DIR/online.TXT" 20 001
+cp "$CHECK_DIR/online.TXT" "$CHECK_DIR/online.orig"
+if command -v python3 > /dev/null; then
+	python3 -c "import fcntl,sys,time; f=open(sys.argv[1],'r+b'); fcntl.lockf(f,fcntl.LOCK_EX); open(sys.argv[1]+'.held','w'); time.sleep(3)" "$CHECK_DIR/online.TXT" &
+	LOCK_PID=$!
+	while [ ! -e "$CHECK_DIR/online.TXT.held" ]; do sleep 0.1; done
+	$FILEFIX -d "$CHECK_DIR/online.TXT" -l 16 -y -u --online -r record -F json -o "$CHECK_DIR/online.json" > /dev/null 2>&1
+	kill $LOCK_PID 2> /dev/null
+	wait $LOCK_PID 2> /dev/null
+	result "--online locked record unchanged" "" "$(cmp "$CHECK_DIR/online.orig" "$CHECK_DIR/online.TXT" 2>&1)"
+	result "--online locked record reported" '{"event":"skipped","position":16,"reason":"locked"}' \
+		"$(grep -a -v '"record"' "$CHECK_DIR/online.json")"
+	$FILEFIX -d "$CHECK_DIR/online.TXT" -l 16 -y -u --online -r summary > "$CHECK_DIR/online.out" 2>&1
+	result "--online unlocked record updated" "Records updated: 1|Records skipped (--online): 0" \
+		"$(grep -a '^Records \(updated\|skipped\)' "$CHECK_DIR/online.out" | paste -sd'|')"
+else
+	echo "skip --online checks (no python3)"
+fi
+
+# An interrupted --checkpoint run is continued by --resume, which adds to the report
+# of the first run (checkpoints are 64MB apart, the run is killed after the first)
+yes AAAAAAAAAAAAAAA | head -c $((96*1024*1024)) | tr '\n' '\372' > "$CHECK_DIR/resume.TXT"
+patch "$CHECK_DIR/resume.TXT" 100 001
+patch "$CHECK_DIR/resume.TXT" $((90*1024*1024 + 4)) 001
+rm -f "$CHECK_DIR/resume.ckp" "$CHECK_DIR/resume.rep"
+$FILEFIX -d "$CHECK_DIR/resume.TXT" -l 16 -y -r record -o "$CHECK_DIR/resume.rep" --checkpoint "$CHECK_DIR/resume.ckp" --max-rate 40 > /dev/null 2>&1 &
+SCAN_PID=$!
+while [ ! -e "$CHECK_DIR/resume.ckp" ] && kill -0 $SCAN_PID 2> /dev/null; do sleep 0.02; done
+{ kill -KILL $SCAN_PID; wait $SCAN_PID; } 2> /dev/null
+$FILEFIX -d "$CHECK_DIR/resume.TXT" -l 16 -y -r record -o "$CHECK_DIR/resume.rep" --checkpoint "$CHECK_DIR/resume.ckp" --resume > "$CHECK_DIR/resume.out" 2>&1
+result "--resume total" "Number of invalid characters processed: 2" "$(grep -a '^Number of invalid' "$CHECK_DIR/resume.out")"
+result "--resume report appended" "Record: 6; Position: 96|Record: 5898240; Position: 94371840" \
+	"$(grep -a '^Record:' "$CHECK_DIR/resume.rep" | paste -sd'|')"
+
+# The watch daemon scans only the records appended since its last scan, and the
+# whole file when it changed at the same size (without -u record 4 is found again)
+rm -rf "$CHECK_DIR/watch"
+mkdir "$CHECK_DIR/watch"
+records 4 A > "$CHECK_DIR/watch/W1.TXT"
+$FILEFIX -y -l 16 --watch "$CHECK_DIR/watch" > "$CHECK_DIR/watch.out" 2>&1 &
+WATCH_PID=$!
+sleep 1
+{ printf "AAAA\001"; records 1 A | tail -c +6; } >> "$CHECK_DIR/watch/W1.TXT"
+sleep 1
+records 1 A >> "$CHECK_DIR/watch/W1.TXT"
+sleep 1
+patch "$CHECK_DIR/watch/W1.TXT" 3 001
+sleep 1
+kill -TERM $WATCH_PID
+wait $WATCH_PID
+result "--watch appended and changed records" "0 4 whole file|4 5 appended|5 6 appended|0 6 changed in place" \
+	"$(sed -n 's/^Watch: W1.TXT records \([0-9]*\) to \([0-9]*\) (\(.*\))$/\1 \2 \3/p' "$CHECK_DIR/watch.out" | paste -sd'|')"
+result "--watch invalid characters" "Record: 4; Position: 64|Record: 0; Position: 0|Record: 4; Position: 64" \
+	"$(grep -a '^Record:' "$CHECK_DIR/watch.out" | paste -sd'|')"
+
+rm -rf "$CHECK_DIR"/stray.* "$CHECK_DIR"/short.* "$CHECK_DIR"/def.* "$CHECK_DIR"/translate.* "$CHECK_DIR"/manifest.* "$CHECK_DIR"/compact.* "$CHECK_DIR"/patch.* "$CHECK_DIR"/online.* "$CHECK_DIR"/resume.* "$CHECK_DIR"/watch*
+exit $FAILED
@@ -0,0 +1,294 @@
+/*
+* filebench.c
+*	Benchmark helper for filefix: synthetic DB/C data file generator and a
+*	timing wrapper (see bench.sh / make bench)
+*
+* Flow:
+*    gen: write a data file of fixed length records
+*		+record terminator 0xFA (default) or 0x0A (-t)
+*		+a share of the records (-c) gets invalid characters
+*		+a share of the records (-z) gets a 0x00 burst of threshold-1, threshold or
+*			threshold+1 characters (-N, DELETE_NULL_THRESHOLD in filefix)
+*		+a share of the records (-w) is written a few characters short or long
+*		+positions of the damaged records are written to <data file>.pos (-i input)
+*    run: run a command and print one JSON line with wall time, MB/s,
+*		records/s, peak RSS and exit status of the command
+*		+throughput is over the whole data file, or over the records the command
+*			reads when given (-r, position modes -p/-i)
+*
+*	Usage:
+*		filebench gen -o file -l length -n records [-t fa|0a] [-c rate] [-z rate]
+*			[-N threshold] [-w rate] [-s seed]
+*		filebench run -d file -l length -m mode [-L label] [-r records] -- command [args]
+*
+*	Output of run (one line, keys always in this order):
+*		{"label":"...","mode":"...","bytes":N,"records":N,"seconds":S,
+*		"mb_per_s":X,"records_per_s":X,"peak_rss_kb":N,"exit":N}
+*/
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#define	ARRAY_SIZE 1024
+#define	MAX_CORRUPT 3		// invalid characters put in a damaged record
+#define	MAX_WRONG 5			// characters missing/extra in a wrong length record
+
+char OUTFILE[ARRAY_SIZE] = "" ;
+size_t RECORD_SIZE = 0 ;
+size_t RECORD_COUNT = 0 ;
+unsigned char TERMINATOR = 0xFA ;
+double CORRUPT_RATE = 0.001 ;
+double NULL_RATE = 0.0002 ;
+unsigned int NULL_THRESHOLD = 10 ;
+double WRONG_RATE = 0.0 ;
+uint64_t SEED = 1 ;
+size_t READ_RECORDS = 0 ;	// records read by the command, 0 = whole data file (-r)
+
+/* Printable characters used for record contents */
+const char RECORD_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ abcdefghijklmnopqrstuvwxyz 0123456789 .,-/" ;
+
+int generate(void) ;
+int run_command(const char *data_file, const char *mode, const char *label, char **argv) ;
+uint64_t next_random(void) ;
+double next_unit(void) ;
+unsigned char invalid_char(void) ;
+
+/*
+* next_random - xorshift64* generator, reproducible for a given seed (-s)
+*/
+uint64_t next_random( void ){
+	SEED ^= SEED >> 12 ;
+	SEED ^= SEED << 25 ;
+	SEED ^= SEED >> 27 ;
+	return SEED*2685821657736338717ULL ;
+} ;
+
+/*
+* next_unit - random value in [0, 1)
+*/
+double next_unit( void ){
+	return (next_random() >> 11)*(1.0/9007199254740992.0) ;
+} ;
+
+/*
+* invalid_char - random character filefix reports in full-detection mode
+* + control characters, 0x7F and the upper half except the 0xFA record divider
+*/
+unsigned char invalid_char( void ){
+	unsigned char c ;
+
+	do{
+		c = (unsigned char) (next_random() % 256) ;
+	}while (c == 0 || c == 0xFA || (c >= 0x20 && c < 0x7F)) ;
+	return c ;
+} ;
+
+/*
+* generate - write the synthetic data file and its position list
+* @return Error encountered while writing
+*/
+int generate( void ){
+	char pos_name[ARRAY_SIZE + 8], *record ;
+	FILE *data_file, *pos_file ;
+	size_t r, i, length, file_pos = 0, corrupt = 0, nulls = 0, wrong = 0, burst, start ;
+	int damaged, ret_val = 0 ;
+
+	snprintf(pos_name,sizeof(pos_name),"%s.pos",OUTFILE) ;
+	if ((record = malloc(RECORD_SIZE + MAX_WRONG))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if ((data_file = fopen(OUTFILE,"wb"))==NULL || (pos_file = fopen(pos_name,"w"))==NULL){
+		perror("ERROR") ;
+		if (data_file != NULL)
+			fclose(data_file) ;
+		free(record) ;
+		return 1 ;
+	}
+	setvbuf(data_file,NULL,_IOFBF,1024*1024) ;
+
+	for (r=0;r<RECORD_COUNT;r++){
+		length = RECORD_SIZE ;
+		damaged = 0 ;
+		for (i=0;i<RECORD_SIZE - 1;i++)
+			record[i] = RECORD_CHARS[next_random() % (sizeof(RECORD_CHARS) - 1)] ;
+
+		if (next_unit() < CORRUPT_RATE){
+			for (i=1 + next_random() % MAX_CORRUPT;i>0;i--)
+				record[next_random() % (RECORD_SIZE - 1)] = (char) invalid_char() ;
+			corrupt++ ;
+			damaged = 1 ;
+		}
+		/* Bursts straddle the threshold so both kept and deleted records occur */
+		if (next_unit() < NULL_RATE && RECORD_SIZE > NULL_THRESHOLD + 2){
+			burst = NULL_THRESHOLD - 1 + next_random() % 3 ;
+			start = next_random() % (RECORD_SIZE - burst) ;
+			memset(record + start,0,burst) ;
+			nulls++ ;
+			damaged = 1 ;
+		}
+		if (next_unit() < WRONG_RATE){
+			if (next_random() % 2 && RECORD_SIZE > MAX_WRONG + 1)
+				length -= 1 + next_random() % MAX_WRONG ;
+			else{
+				length += 1 + next_random() % MAX_WRONG ;
+				for (i=RECORD_SIZE - 1;i<length - 1;i++)
+					record[i] = RECORD_CHARS[next_random() % (sizeof(RECORD_CHARS) - 1)] ;
+			}
+			wrong++ ;
+		}
+		record[length - 1] = (char) TERMINATOR ;
+
+		if (damaged)
+			fprintf(pos_file,"%zu\n",file_pos) ;
+		if (fwrite(record,sizeof(char),length,data_file)!=length){
+			perror("ERROR") ;
+			ret_val = 1 ;
+			break ;
+		}
+		file_pos += length ;
+	}
+
+	if (fclose(data_file)!=0 || fclose(pos_file)!=0){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	free(record) ;
+	printf("%s: %zu records, %zu bytes, %zu with invalid characters, %zu with 0x00 bursts, %zu wrong length\n",
+		OUTFILE,RECORD_COUNT,file_pos,corrupt,nulls,wrong) ;
+	return ret_val ;
+} ;
+
+/*
+* run_command - run a command with its output discarded and print its timing
+* + peak RSS comes from wait4(), so only the command itself is measured
+* @data_file data file the command processes (throughput base unless -r)
+* @mode mode reported in the result line
+* @label label reported in the result line (e.g. version)
+* @argv command and arguments
+* @return Error starting the command
+*/
+int run_command(const char *data_file, const char *mode, const char *label, char **argv){
+	struct stat file_stat ;
+	struct timespec start, end ;
+	struct rusage usage ;
+	double seconds ;
+	size_t records ;
+	long long bytes ;
+	pid_t pid ;
+	int status = 0, null_fd ;
+
+	if (stat(data_file,&file_stat)!=0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	records = RECORD_SIZE > 0 ? (size_t) file_stat.st_size/RECORD_SIZE : 0 ;
+	bytes = (long long) file_stat.st_size ;
+	if (READ_RECORDS > 0){
+		records = READ_RECORDS ;
+		bytes = (long long) (READ_RECORDS*RECORD_SIZE) ;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&start) ;
+	if ((pid = fork()) < 0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if (pid == 0){
+		if ((null_fd = open("/dev/null",O_WRONLY)) >= 0){
+			dup2(null_fd,STDOUT_FILENO) ;
+			dup2(null_fd,STDERR_FILENO) ;
+		}
+		execvp(argv[0],argv) ;
+		_exit(127) ;
+	}
+	if (wait4(pid,&status,0,&usage) < 0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	clock_gettime(CLOCK_MONOTONIC,&end) ;
+	seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9 ;
+
+	printf("{\"label\":\"%s\",\"mode\":\"%s\",\"bytes\":%lld,\"records\":%zu,\"seconds\":%.6f,"
+		"\"mb_per_s\":%.2f,\"records_per_s\":%.0f,\"peak_rss_kb\":%ld,\"exit\":%d}\n",
+		label,mode,bytes,records,seconds,
+		seconds > 0 ? bytes/seconds/(1024.0*1024.0) : 0.0,seconds > 0 ? records/seconds : 0.0,
+		usage.ru_maxrss,WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status)) ;
+	return 0 ;
+} ;
+
+int main(int argc, char **argv){
+	const char *data_file = "", *mode = "", *label = "" ;
+	int i, gen ;
+
+	if (argc < 2 || (strcmp(argv[1],"gen")!=0 && strcmp(argv[1],"run")!=0)){
+		printf("Usage: filebench gen -o file -l length -n records [-t fa|0a] [-c rate] [-z rate] [-N threshold] [-w rate] [-s seed]\n") ;
+		printf("       filebench run -d file -l length -m mode [-L label] [-r records] -- command [args]\n") ;
+		return 1 ;
+	}
+	gen = strcmp(argv[1],"gen")==0 ;
+
+	for (i=2;i<argc;i++){
+		if (strcmp(argv[i],"--")==0){
+			i++ ;
+			break ;
+		}
+		if (i + 1 >= argc){
+			printf("No parameters provided for command %s.\n",argv[i]) ;
+			return 1 ;
+		}
+		if (strcmp(argv[i],"-o")==0 && strlen(argv[i + 1]) < ARRAY_SIZE)
+			strcpy(OUTFILE,argv[i + 1]) ;
+		else if (strcmp(argv[i],"-l")==0)
+			RECORD_SIZE = (size_t) strtoull(argv[i + 1],NULL,10) ;
+		else if (strcmp(argv[i],"-n")==0)
+			RECORD_COUNT = (size_t) strtoull(argv[i + 1],NULL,10) ;
+		else if (strcmp(argv[i],"-t")==0)
+			TERMINATOR = strcmp(argv[i + 1],"0a")==0 ? 0x0A : 0xFA ;
+		else if (strcmp(argv[i],"-c")==0)
+			CORRUPT_RATE = strtod(argv[i + 1],NULL) ;
+		else if (strcmp(argv[i],"-z")==0)
+			NULL_RATE = strtod(argv[i + 1],NULL) ;
+		else if (strcmp(argv[i],"-N")==0)
+			NULL_THRESHOLD = (unsigned int) strtoul(argv[i + 1],NULL,10) ;
+		else if (strcmp(argv[i],"-w")==0)
+			WRONG_RATE = strtod(argv[i + 1],NULL) ;
+		else if (strcmp(argv[i],"-s")==0)
+			SEED = strtoull(argv[i + 1],NULL,10) | 1 ;
+		else if (strcmp(argv[i],"-d")==0)
+			data_file = argv[i + 1] ;
+		else if (strcmp(argv[i],"-m")==0)
+			mode = argv[i + 1] ;
+		else if (strcmp(argv[i],"-L")==0)
+			label = argv[i + 1] ;
+		else if (strcmp(argv[i],"-r")==0)
+			READ_RECORDS = (size_t) strtoull(argv[i + 1],NULL,10) ;
+		else{
+			printf("\"%s\" is not a valid command.\n",argv[i]) ;
+			return 1 ;
+		}
+		i++ ;
+	}
+
+	if (gen){
+		if (strlen(OUTFILE)==0 || RECORD_SIZE < 2 || RECORD_COUNT == 0){
+			printf("Not all parameters provided. Exiting program.\n") ;
+			return 1 ;
+		}
+		return generate() ;
+	}
+	if (strlen(data_file)==0 || i >= argc){
+		printf("Not all parameters provided. Exiting program.\n") ;
+		return 1 ;
+	}
+	return run_command(data_file,mode,label,argv + i) ;
+} ;
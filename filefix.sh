@@ -2,8 +2,9 @@
 
 FILEPATH='/ppro/data/'
 FILENAME=""
+BATCH="" # Data directory or manifest for batch mode
 RECORD_LENGTH=0 # Length of file, as reported by XXXDEF.TXT (data file definition) files
-FULL_MODE='N' # Full file traversal (without filechk call)
+FULL_MODE='N' # Full file traversal (instead of wrong length record detection)
 HELP_MODE='N'
 HEX_MODE='N'
 UPDATE_MODE='N'
@@ -18,6 +19,11 @@ case $i in
     shift # past argument=value
     ;;
 
+    -b=*|--batch=*)
+    BATCH="${i#*=}"
+    shift # past argument=value
+    ;;
+
     -d=*|--file_directory=*)
     FILEPATH="${i#*=}"
     shift # past argument=value
@@ -65,10 +71,16 @@ elif [[ "$HELP_MODE" = "Y" ]]; then
 	echo "DESCRIPTION"
 	echo "		Perform data file invalid character detection. Mandatory"
 	echo "		options are indicated with an asterisk (*). Default behavior"
-	echo "		is to utilize DB/C utility, filechk, to calculate wrong record"
-	echo "		length positions based on indicated record length without"
+	echo "		is to locate wrong record length positions based on indicated"
+	echo "		record length (filefix -w, no filechk run required) without"
 	echo "		performing any updates."
 	echo ""
+	echo "		-b, --batch"
+	echo "			Process a whole data directory (all files use --length)"
+	echo "			or a manifest of \"file record_size\" lines, record_size"
+	echo "			including the terminating 0xFA. Files are processed in"
+	echo "			parallel on all processors. Replaces --filename."
+	echo ""
 	echo "		-f, --filename *"
 	echo "			Full, case-sensitive filename excluding path."
 	echo ""
@@ -80,32 +92,67 @@ elif [[ "$HELP_MODE" = "Y" ]]; then
 	echo "		-h, --help"
 	echo "			Display help information."
 	echo ""
-	echo "		-l, --length *"
+	echo "		-l, --length"
 	echo "			Set record length of data file, as reported in the data"
-	echo "			file definition (XXXDEF.TXT)."
+	echo "			file definition (XXXDEF.TXT). Without it the definition"
+	echo "			in the file directory is read and fields are checked by"
+	echo "			type (numeric, date, alpha)."
 	echo ""
 	echo "		-u, --update"
 	echo "			Set update mode to perform data file updates."
 	echo ""
 	echo "		-x, --hex_mode"
-	echo "			Run in 0x00 detection mode."
+	echo "			Run in 0x00 detection mode. Without -y it runs after"
+	echo "			the wrong length record detection."
 	echo ""
 	echo "		-y, --full_mode"
 	echo "			Set record length of data file."
 	echo ""
     echo " Sample syntax:"
     echo "		./filefix.sh -f=SOH0007.TXT -l=1851 -d=/ppro/pprotest/data/ -u"
+    echo "		./filefix.sh -b=/ppro/data/nightly.lst -y"
     echo ""
     echo " Note:"
     echo "		Data file record sizes are actually one character longer due to"
     echo "		the use of a record-terminating 0xFA character."
 	exit 0
-elif [[ "$RECORD_LENGTH" = "0" ]]; then
-	echo "Error: No record length specified."
+elif [[ -n "$BATCH" ]]; then
+	FILEFIX_ARGS="-b $BATCH -j 0"
+	if [[ "$RECORD_LENGTH" != "0" ]]; then
+		FILEFIX_ARGS="$FILEFIX_ARGS -l $((RECORD_LENGTH + 1))"
+	fi
+	if [[ "$UPDATE_MODE" = "Y" ]]; then
+		FILEFIX_ARGS="$FILEFIX_ARGS -u"
+	fi
+	echo "Batch: $BATCH"
+	if [[ "$FULL_MODE" = "Y" ]]; then
+		if [[ "$HEX_MODE" = "Y" ]]; then
+			/ppro/mtl/bin/compile/filefix $FILEFIX_ARGS -x -y
+		else
+			/ppro/mtl/bin/compile/filefix $FILEFIX_ARGS -y
+		fi
+		exit $?
+	fi
+	# -x takes over from -w in filefix, so the 0x00 check is a run of its own
+	/ppro/mtl/bin/compile/filefix $FILEFIX_ARGS -w
+	STATUS=$?
+	if [[ "$HEX_MODE" = "Y" ]]; then
+		/ppro/mtl/bin/compile/filefix $FILEFIX_ARGS -x || STATUS=$?
+	fi
+	exit $STATUS
+elif [[ "$RECORD_LENGTH" = "0" ]] && ! [[ -f "$FILEPATH${FILENAME:0:3}DEF.TXT" ]]; then
+	echo "Error: No record length specified and no ${FILENAME:0:3}DEF.TXT found."
 	echo "Aborting program."
 	exit 1
 fi
 
+# Record length from --length, otherwise from the data file definition
+if [[ "$RECORD_LENGTH" = "0" ]]; then
+	LENGTH_ARGS="-D $FILEPATH${FILENAME:0:3}DEF.TXT"
+else
+	LENGTH_ARGS="-l $((RECORD_LENGTH + 1))"
+fi
+
 echo "File path: $FILEPATH$FILENAME"
 echo "Record length: $RECORD_LENGTH"
 echo "Update mode: $UPDATE_MODE"
@@ -116,30 +163,29 @@ echo ""
 if [[ "$FULL_MODE" = "Y" ]]; then
 	if [[ "$UPDATE_MODE" = "Y" ]]; then
 		if [[ "$HEX_MODE" = "Y" ]]; then
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -x -y -u
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -x -y -u
 		else
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -y -u
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -y -u
 		fi
 	else
 		if [[ "$HEX_MODE" = "Y" ]]; then
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -x -y
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -x -y
 		else
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -y
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -y
 		fi
 	fi
 else
-	filechk $FILEPATH$FILENAME -L=$RECORD_LENGTH | awk '/Wrong length record/ {getline; print $4}' | awk -F '[^0-9]*' '$0=$2' > filefix.in
+	# -x takes over from -w in filefix, so the 0x00 check is a run of its own
 	if [[ "$UPDATE_MODE" = "Y" ]]; then
-		if [[ "$HEX_MODE" = "Y" ]]; then
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -x -i filefix.in -u
-		else
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -i filefix.in -u
-		fi
+		/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -w -u
 	else
-		if [[ "$HEX_MODE" = "Y" ]]; then
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -x -i filefix.in
+		/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -w
+	fi
+	if [[ "$HEX_MODE" = "Y" ]]; then
+		if [[ "$UPDATE_MODE" = "Y" ]]; then
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -x -u
 		else
-			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME -l $((RECORD_LENGTH + 1)) -i filefix.in
+			/ppro/mtl/bin/compile/filefix -d $FILEPATH$FILENAME $LENGTH_ARGS -x
 		fi
 	fi
 fi
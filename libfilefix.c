@@ -0,0 +1,6974 @@
+/*
+* libfilefix.c
+*	filefix engine: detection and repair of invalid characters in fixed length
+*	record data files (see filefix.c for the command line and libfilefix.h for
+*	the library interface)
+*
+*	Settings and state of a run live in a context (filefix_ctx_t). The engine
+*	reaches the context of the calling thread through CTX; the upper case names
+*	of the settings (RECORD_SIZE, DATAFILE, ...) are macros over its fields
+*/
+#define _GNU_SOURCE	// fopencookie
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/inotify.h>
+#include <sys/syscall.h>
+#if defined(__linux__) && defined(__NR_io_uring_setup) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define	HAVE_IO_URING 1
+#endif
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "filelib.h"
+#include "libfilefix.h"
+
+/* Globals */
+#define	ARRAY_SIZE 1024
+#define	CLASSIFY_BLOCK 1024	// records classified per call in the full/zero-detection traversal
+#define	COALESCE_RECORDS 256	// maximum records read together from a position list
+#define	COALESCE_GAP 65536	// maximum bytes between positions read together
+#define	DETECT_SAMPLES 16	// blocks sampled across the data file (-l auto)
+#define	DETECT_BLOCK (256*1024)	// bytes per sampled block, also the largest record size detected
+#define	DETECT_CONFIDENCE 0.9	// share of sampled records that must end in a divider
+#define	DETECT_MIN_RECORDS 16	// fewer sampled records leave the record size ambiguous
+#define	SAMPLE_BLOCK (64*1024)	// bytes per sampled block, rounded down to whole records (--sample)
+#define	SAMPLE_Z 1.96		// normal quantile of the 95% confidence intervals (--sample)
+
+unsigned int VALID_START = 32 ;
+unsigned int VALID_END = 126 ;
+unsigned char END_OF_RECORD = 250 ;
+unsigned char END_OF_RECORD_CR = 10 ;
+unsigned char NULL_VALUE = 0 ;
+
+unsigned int DELETE_NULL_THRESHOLD = 10 ;
+
+char* DBC_IKEYS = NULL ;
+char* DBC_ICHRS = NULL ;
+pthread_once_t ENV_ONCE = PTHREAD_ONCE_INIT ;	// get_env() runs once per process
+
+const char ITEST1_PATH[25] = "/ppro/src/cffp/ITEST.PRG\0" ; // ITEST assumed to exist at all customers
+/* Temp changing these on Hera */
+//const char ITEST2_PATH[28] = "/ppro/mtl/src/cf/ITEST2.PRG\0" ;
+//const char ITEST3_PATH[28]  = "/ppro/mtl/src/cf/ITEST3.PRG\0" ;
+
+const char ITEST2_PATH[24] = "/ppro/src/cf/ITEST2.PRG\0" ;
+const char ITEST3_PATH[24]  = "/ppro/src/cf/ITEST3.PRG\0" ;
+
+const char FILEPATH_SEPARATOR[2] = "/\0" ;
+
+/* Report levels (-r) and formats (-F) */
+#define	REPORT_SUMMARY 0
+#define	REPORT_RECORD 1
+#define	REPORT_BYTE 2
+#define	FORMAT_TEXT 0
+#define	FORMAT_JSON 1
+#define	FORMAT_BINARY 2
+#define	REPORT_BUFFER (1024*1024)	// stdio buffer of the report file
+#define	REPORT_RING (16*1024*1024)	// ring drained by the report writer thread
+
+/* Binary report event types and events (libfilefix.h) */
+#define	EVENT_RECORD FILEFIX_EVENT_RECORD
+#define	EVENT_CHANGE FILEFIX_EVENT_CHANGE
+#define	EVENT_NULLS FILEFIX_EVENT_NULLS
+#define	EVENT_UPDATED FILEFIX_EVENT_UPDATED
+#define	EVENT_POSITION FILEFIX_EVENT_POSITION
+#define	EVENT_INVALID FILEFIX_EVENT_INVALID
+#define	EVENT_RECORD_DONE FILEFIX_EVENT_RECORD_DONE
+#define	EVENT_BYTE_COUNT FILEFIX_EVENT_BYTE_COUNT
+#define	EVENT_RECORD_COUNT FILEFIX_EVENT_RECORD_COUNT
+#define	EVENT_TOTALS FILEFIX_EVENT_TOTALS
+#define	EVENT_SKIPPED FILEFIX_EVENT_SKIPPED
+
+typedef filefix_event_t report_event_t ;
+
+/* Counts kept for every report level, printed by -r summary */
+typedef struct {
+	size_t dirty_records ;
+	size_t deleted_records ;
+	size_t updated_records ;
+	size_t skipped_records ;	// records --online left as they were (locked or changed)
+	size_t byte_counts[256] ;	// invalid characters by value
+	size_t *record_counts ;		// records by number of invalid characters (RECORD_SIZE+1)
+	size_t *cell_counts ;		// invalid characters by offset and value (RECORD_SIZE*256, --heatmap)
+	size_t *burst_counts ;		// 0x00 runs by length (RECORD_SIZE+1, --heatmap)
+} report_counts_t ;
+
+/* Destination of a scan's report events */
+typedef struct {
+	FILE *out ;
+	report_counts_t *counts ;
+} report_t ;
+
+/* Report file written by a separate thread (-o) */
+typedef struct {
+	int fd ;
+	char *ring ;
+	size_t head, tail ;		// bytes queued and written, ring offsets modulo REPORT_RING
+	int done, failed ;
+	pthread_mutex_t lock ;
+	pthread_cond_t not_empty, not_full ;
+	pthread_t thread ;
+} report_writer_t ;
+
+/* Update mode write-back */
+#define	BATCH_BYTES (4*1024*1024)	// repaired records written back per batch
+#define	JOURNAL_MAGIC "FFJRNL01"
+#define	PATCH_MAGIC "FFPATCH1"
+#define	ONLINE_RUN 64		// adjacent records written under one lock (--online)
+#define	ONLINE_RETRIES 8	// lock attempts after the first before a run is skipped
+#define	ONLINE_BACKOFF 50000	// nanoseconds before the first retry, doubled every retry
+#define	ONLINE_SKIP_LOCKED 1	// record locked by someone else (skipped event value)
+#define	ONLINE_SKIP_CHANGED 2	// record changed since the scan (skipped event value)
+
+/* Repaired records waiting to be written back, in ascending position order */
+typedef struct {
+	int fd ;
+	size_t count, capacity ;
+	size_t *positions ;
+	char *old_records ;
+	char *new_records ;
+	size_t failed ;		// records that could not be written back
+	report_t *rep ;		// receives the updated/skipped events of --online write-back
+} write_batch_t ;
+
+/* I/O engines (-e) for the full/zero-detection traversal */
+#define	ENGINE_MMAP 0		// memory mapping (default)
+#define	ENGINE_STDIO 1		// fread of one record at a time
+#define	ENGINE_PREAD 2		// pread of large aligned blocks
+#define	ENGINE_DIRECT 3		// pread with O_DIRECT, bypassing the page cache
+#define	ENGINE_URING 4		// io_uring reads (O_DIRECT when supported) with QUEUE_DEPTH blocks in flight
+#define	IO_BLOCK (1024*1024)	// bytes per read of the block engines
+#define	IO_ALIGN 4096		// buffer and offset alignment for O_DIRECT
+
+/* Block reader behind the pread, direct and uring engines. Blocks are handed
+out in file order and stay valid until the next call to next() */
+typedef struct io_reader_s {
+	int fd ;		// descriptor the reads are issued on
+	int data_fd ;	// buffered descriptor of the data file (short read completion)
+	int direct ;	// fd was opened with O_DIRECT
+	size_t file_size ;
+	size_t next_offset ;	// offset of the next block to request
+	size_t sequence ;		// blocks handed out so far
+	size_t depth ;			// buffers
+	size_t in_flight ;		// uring: reads submitted but not handed out
+	char **buffers ;
+	size_t *offsets ;		// uring: offset read into each buffer
+	int *results ;			// uring: completion result of each buffer
+	unsigned char *done ;	// uring: completion received
+#ifdef HAVE_IO_URING
+	int ring_fd ;
+	int registered ;		// buffers registered with the ring (READ_FIXED)
+	unsigned *sq_tail, *sq_mask, *sq_array, *cq_head, *cq_tail, *cq_mask ;
+	struct io_uring_sqe *sqes ;
+	struct io_uring_cqe *cqes ;
+	void *sq_ring, *cq_ring ;
+	size_t sq_ring_size, cq_ring_size, sqes_size ;
+#endif
+	int (*next)(struct io_reader_s *reader, char **block, size_t *size) ;
+	void (*close)(struct io_reader_s *reader) ;
+} io_reader_t ;
+
+/* Stage pipeline (--pipeline): reader, classifier and writer threads linked by
+single-producer/single-consumer rings of block and batch indexes */
+#define	PIPELINE_BLOCKS 8		// IO_BLOCK buffers circulating between reader and classifier
+#define	PIPELINE_BATCHES 3		// write-back batches circulating between classifier and writer
+#define	PIPELINE_RING 16		// slots per ring, more than either pool
+#define	PIPELINE_END ((size_t) -1)	// last index pushed to the writer
+#define	PIPELINE_SPINS 1000		// polls of an empty ring before sleeping
+#define	PIPELINE_SLEEP 20000	// nanoseconds slept per poll after that
+
+typedef struct {
+	size_t slots[PIPELINE_RING] ;
+	size_t head __attribute__((aligned(64))) ;	// written by the producer only
+	size_t tail __attribute__((aligned(64))) ;	// written by the consumer only
+} spsc_ring_t ;
+
+typedef struct {
+	char *data ;
+	size_t offset, size ;	// size 0 ends the traversal
+	int failed ;
+} pipeline_block_t ;
+
+typedef struct {
+	filefix_ctx_t *ctx ;
+	io_reader_t reader ;
+	pipeline_block_t blocks[PIPELINE_BLOCKS] ;
+	write_batch_t batches[PIPELINE_BATCHES] ;
+	spsc_ring_t free_blocks, full_blocks, free_batches, full_batches ;
+	int write_failed ;
+} pipeline_t ;
+
+/* Instrumentation (--stats, --progress). Counters are only touched when enabled */
+#define	PHASE_OPEN 0		// opening the data file and journal
+#define	PHASE_READ 1		// explicit reads (block engines, positions, stdin)
+#define	PHASE_CLASSIFY 2	// classifier/terminator search (mmap page faults land here)
+#define	PHASE_FIX 3			// fix_record()/check_record() including their report events
+#define	PHASE_WRITE 4		// write-back batches and journal, fdatasync included
+#define	PHASE_REPORT 5		// report summary
+#define	PHASE_ITEST 6		// ITEST run
+#define	PHASE_COMPACT 7		// compaction of deleted records, sync and truncation included
+#define	PHASES 8
+
+const char *PHASE_NAMES[PHASES] = { "open", "read", "classify", "fix_report", "write_back", "report", "itest", "compact" } ;
+
+typedef struct {
+	uint64_t bytes ;		// bytes scanned
+	uint64_t records ;		// records checked
+	uint64_t dirty ;		// records with invalid characters
+	uint64_t deleted ;		// records cleared past the 0x00 threshold
+	uint64_t updated ;		// records written back
+	uint64_t read_calls ;	// read system calls (pread, preadv, read, io_uring_enter)
+	uint64_t write_calls ;	// write system calls (pwritev, writev, write)
+	uint64_t sync_calls ;	// fdatasync
+	uint64_t phase_ns[PHASES] ;	// summed over threads
+	uint64_t total_bytes ;	// bytes to scan, for the progress ETA (0 if unknown)
+} stats_t ;
+
+#define	STATS_ADD(counter,n) do{ if (STATS_ENABLED) __atomic_fetch_add(&STATS.counter,(uint64_t) (n),__ATOMIC_RELAXED) ; }while (0)
+
+/* Bandwidth limit (--max-rate) shared by all scanning threads */
+#define	RATE_FLOOR 0.1		// adaptive rate never drops below this share of --max-rate
+#define	RATE_STEP 0.05		// share of --max-rate regained per fast sample
+#define	RATE_BACKOFF 0.75	// rate multiplier when latency exceeds RATE_SLOW x baseline
+#define	RATE_SLOW 2.0
+
+typedef struct {
+	pthread_mutex_t lock ;
+	double rate ;		// current bytes per second
+	double tokens ;		// may go negative: callers sleep off the debt
+	uint64_t last ;		// last refill (ns)
+	double latency ;	// moving average, ns per MB
+	double baseline ;	// lowest moving average seen
+} rate_limit_t ;
+
+/* Checkpoints of the serial full/zero-detection traversal (--checkpoint, --resume) */
+#define	CHECKPOINT_BYTES (64*1024*1024)	// bytes scanned between checkpoints, rounded down to whole records
+#define	CHECKPOINT_MAGIC "FFCKPT01"
+
+/* Compaction of deleted records (--compact) */
+#define	COMPACT_BUFFER (8*1024*1024)	// bytes read per pass, rounded down to whole records
+
+/* Checkpoint file, followed by the report's byte_counts[256] and
+record_counts[RECORD_SIZE+1] as uint64_t */
+typedef struct {
+	char magic[8] ;
+	uint64_t file_size ;
+	uint64_t record_size ;
+	uint64_t config_hash ;		// manifest_config() of the run
+	uint64_t update ;
+	uint64_t offset ;			// records before offset are done, repairs flushed
+	uint64_t invalid_count ;
+	uint64_t dirty_records ;
+	uint64_t deleted_records ;
+	uint64_t updated_records ;
+} checkpoint_t ;
+
+/* Filter mode (-d -) */
+#define	STREAM_NAME "-"
+#define	STREAM_BUFFER (8*1024*1024)	// bytes read from stdin per pass, rounded down to whole records
+#define	STREAM_PIPE (1024*1024)		// requested capacity of stdin/stdout pipes
+
+int STREAM_STDOUT = -1 ;	// original stdout, kept by the first open_stream(); per process, not per context
+
+/* Incremental rescans (-m) */
+#define	MANIFEST_BLOCK (1024*1024)	// target bytes per manifest block, rounded down to whole records
+#define	MANIFEST_MAGIC "FFMAN01"
+#define	MANIFEST_SUFFIX ".ffm"
+
+/* Sidecar manifest header, followed by block_count manifest_block_t */
+typedef struct {
+	char magic[8] ;
+	uint64_t file_size ;
+	int64_t mtime_sec ;
+	int64_t mtime_nsec ;
+	uint64_t record_size ;
+	uint64_t block_bytes ;
+	uint64_t config_hash ;	// validation settings the clean flags hold for
+	uint64_t block_count ;
+} manifest_header_t ;
+
+typedef struct {
+	uint64_t hash ;		// xxh64 of the block
+	uint32_t clean ;	// no invalid characters in the block
+	uint32_t reserved ;
+} manifest_block_t ;
+
+/* Batch mode (-b) */
+#define	EVENT_FILE FILEFIX_EVENT_FILE
+
+/* Data file of a batch run. Lives in a shared mapping so workers can return
+their result to the scheduler */
+typedef struct {
+	char path[ARRAY_SIZE] ;
+	char definition[ARRAY_SIZE] ;	// per-file definition (-D), empty if none
+	size_t record_size ;	// 0 takes the size from the definition
+	size_t file_size ;
+	size_t order ;		// position in the directory listing or manifest
+	pid_t pid ;
+	FILE *log ;		// worker messages
+	FILE *report ;		// worker report when the report goes to a file (-o)
+	struct timespec started ;
+	double seconds ;
+	size_t invalid_count ;	// set by the worker
+	int ret_val ;		// set by the worker
+	int failed ;
+} batch_job_t ;
+
+/* Watch daemon (--watch) */
+#define	WATCH_STATE ".filefix.watch"	// validated offsets, kept in the watched directory
+#define	WATCH_SETTLE 200	// milliseconds without events before pending files are scanned
+#define	WATCH_LATENCY 2000	// longest wait for a quiet moment while writers keep appending (ms)
+#define	WATCH_EVENTS (64*1024)	// inotify read buffer
+
+volatile sig_atomic_t WATCH_STOP = 0 ;	// set by SIGINT/SIGTERM, ends process_watch(); per process, not per context
+
+/* Data file followed by the watch daemon */
+typedef struct {
+	char name[256] ;
+	size_t validated ;	// bytes of whole records scanned
+	uint64_t inode ;	// a new inode (file replaced) starts over
+	int64_t mtime_sec ;	// modification time after the last scan, a change
+	int64_t mtime_nsec ;	// at the same size is a modification in place
+	unsigned char pending ;
+} watch_file_t ;
+
+/* Undo journal entry, followed by length bytes of original data */
+typedef struct {
+	uint64_t position ;
+	uint32_t length ;
+	uint32_t checksum ;	// checksum32() of the original data
+} journal_entry_t ;
+
+/* Patch of an offline scan (--patch-out, --apply-patch): PATCH_MAGIC and a
+patch_header_t, then a patch_entry_t per repaired record followed by its changes */
+typedef struct {
+	uint64_t record_size ;
+	uint64_t file_size ;	// data file as scanned
+} patch_header_t ;
+
+typedef struct {
+	uint64_t position ;
+	uint32_t changes ;	// patch_change_t entries that follow
+	uint32_t checksum ;	// checksum32() of the record as scanned
+} patch_entry_t ;
+
+typedef struct {
+	uint32_t offset ;	// byte within the record
+	uint8_t old_char ;
+	uint8_t new_char ;
+	uint16_t reserved ;
+} patch_change_t ;
+
+/* Patch entry sorted for --apply-patch */
+typedef struct {
+	uint64_t position ;
+	size_t offset ;		// entry offset in the patch file
+} patch_ref_t ;
+
+/* Record-aligned range of a parallel full/zero-detection scan */
+typedef struct {
+	pthread_t thread ;
+	int fd ;
+	char *map ;
+	size_t start, end ;
+	size_t invalid_count ;
+	report_t report ;
+	report_counts_t counts ;
+	write_batch_t batch ;
+	int started, failed ;
+	filefix_ctx_t *ctx ;	// context of the scan
+} scan_range_t ;
+
+/* Record position from -p/-i, with its input order for reporting */
+typedef struct {
+	size_t pos ;
+	size_t order ;
+	char *report ;
+	size_t report_size ;
+} position_t ;
+
+/* Data file definition (-D). Columns not covered by a field are alpha */
+#define	FIELD_ALPHA 0		// DIM: any printable character
+#define	FIELD_NUMERIC 1		// FORM: digits, sign, decimal point and space
+#define	FIELD_DATE 2		// digits and space (blank date), reported but not repaired
+#define	FIELD_CLASSES 3
+
+typedef struct {
+	size_t offset ;
+	size_t length ;
+	unsigned char class ;
+} field_t ;
+
+/* Byte translation (-T): a preset or a map file of "from to" lines */
+typedef struct {
+	unsigned char from ;
+	unsigned char to ;
+} translation_t ;
+
+/* Latin-1 letters and symbols folded to ASCII. 0xFA (record divider) and 0xFF
+(zero-detection fill) keep their meaning */
+const translation_t LATIN1_FOLD[] = {
+	{0xA0,' '},{0xAB,'"'},{0xAD,'-'},{0xB4,'\''},{0xBB,'"'},
+	{0xC0,'A'},{0xC1,'A'},{0xC2,'A'},{0xC3,'A'},{0xC4,'A'},{0xC5,'A'},{0xC6,'A'},{0xC7,'C'},
+	{0xC8,'E'},{0xC9,'E'},{0xCA,'E'},{0xCB,'E'},{0xCC,'I'},{0xCD,'I'},{0xCE,'I'},{0xCF,'I'},
+	{0xD0,'D'},{0xD1,'N'},{0xD2,'O'},{0xD3,'O'},{0xD4,'O'},{0xD5,'O'},{0xD6,'O'},{0xD7,'x'},
+	{0xD8,'O'},{0xD9,'U'},{0xDA,'U'},{0xDB,'U'},{0xDC,'U'},{0xDD,'Y'},{0xDE,'T'},{0xDF,'s'},
+	{0xE0,'a'},{0xE1,'a'},{0xE2,'a'},{0xE3,'a'},{0xE4,'a'},{0xE5,'a'},{0xE6,'a'},{0xE7,'c'},
+	{0xE8,'e'},{0xE9,'e'},{0xEA,'e'},{0xEB,'e'},{0xEC,'i'},{0xED,'i'},{0xEE,'i'},{0xEF,'i'},
+	{0xF0,'d'},{0xF1,'n'},{0xF2,'o'},{0xF3,'o'},{0xF4,'o'},{0xF5,'o'},{0xF6,'o'},{0xF7,'/'},
+	{0xF8,'o'},{0xF9,'u'},{0xFB,'u'},{0xFC,'u'},{0xFD,'y'},{0xFE,'t'},
+	{0x09,' '}
+} ;
+
+/* CP1252 punctuation and letters in 0x80-0x9F folded to ASCII */
+const translation_t CP1252_FOLD[] = {
+	{0x82,','},{0x84,'"'},{0x85,'.'},{0x8A,'S'},{0x8B,'<'},{0x8C,'O'},{0x8E,'Z'},
+	{0x91,'\''},{0x92,'\''},{0x93,'"'},{0x94,'"'},{0x95,'*'},{0x96,'-'},{0x97,'-'},
+	{0x98,'~'},{0x9A,'s'},{0x9B,'>'},{0x9C,'o'},{0x9E,'z'},{0x9F,'Y'}
+} ;
+
+/* Byte classification kernels, selected by init_classifier() */
+typedef size_t (*classify_block_t)(const char *base, size_t nrec, unsigned char *dirty) ;
+typedef void (*invalid_bitmap_t)(const char *rec, uint64_t *bits) ;
+typedef size_t (*find_terminator_t)(const char *p, size_t n) ;
+
+/* Settings and state of one run (filefix_ctx_t, see libfilefix.h) */
+struct filefix_ctx_s {
+	size_t record_size ;
+	unsigned char auto_size ;	// record size detected from the data file (-l auto)
+	char datafile[ARRAY_SIZE] ;
+	char inputfile[ARRAY_SIZE] ;
+	unsigned char fill_value ;
+	unsigned char null_fill_value ;
+	size_t record_position ;
+	size_t position_set ;
+	unsigned char verbose_flag ;
+	unsigned char update_flag ;
+	unsigned char full_detection_flag ;
+	unsigned char zero_detection_flag ;
+	unsigned char itest_flag ;
+	unsigned char wrong_length_flag ;
+	unsigned char sorted_report_flag ;
+	unsigned char itest_version ;
+	size_t thread_count ;
+
+	/* Messages and report */
+	FILE *log ;		// messages, NULL discards them
+	unsigned char report_level ;
+	unsigned char report_format ;
+	char reportfile[ARRAY_SIZE] ;
+	report_counts_t report_counts ;
+	report_t report ;
+	filefix_callback_t callback ;	// report events go to the callback instead of a stream
+	void *callback_user ;
+	filefix_event_t event ;		// event split over two writes of the report stream
+	size_t event_size ;
+
+	/* Update mode write-back */
+	char journalfile[ARRAY_SIZE] ;
+	char rollbackfile[ARRAY_SIZE] ;
+	int journal_fd ;
+	pthread_mutex_t journal_lock ;
+	char patchfile[ARRAY_SIZE] ;	// patch written instead of updating (--patch-out)
+	char applyfile[ARRAY_SIZE] ;	// patch to apply (--apply-patch)
+	FILE *patch_out ;
+	pthread_mutex_t patch_lock ;
+	size_t patch_records ;
+	char heatmapfile[ARRAY_SIZE] ;	// invalid characters by offset and value as CSV (--heatmap)
+	char watchdir[ARRAY_SIZE] ;	// directory followed by the watch daemon (--watch)
+	unsigned char online_flag ;	// data file in use, write-back under record locks (--online)
+	uint64_t online_written, online_locked, online_changed ;	// records written, skipped on a lock, changed since the scan
+	uint64_t online_locks, online_held, online_longest ;	// locks taken, nanoseconds held in total and longest
+
+	/* I/O engine, filter mode */
+	int io_engine ;
+	size_t queue_depth ;
+	int stream_fd ;		// original stdout receiving the repaired stream
+
+	/* Instrumentation */
+	unsigned char stats_flag ;
+	unsigned int progress_interval ;	// seconds between progress lines
+	unsigned char stats_enabled ;		// either of the above
+	stats_t stats ;
+	uint64_t stats_start ;
+	pthread_t progress_thread ;
+	pthread_mutex_t progress_lock ;
+	pthread_cond_t progress_stop ;
+	int progress_running ;
+
+	/* Bandwidth limit and checkpoints */
+	double max_rate ;	// bytes per second, 0 = unlimited
+	unsigned char adaptive_rate ;
+	rate_limit_t rate_limit ;
+	char checkpointfile[ARRAY_SIZE] ;
+	char compactfile[ARRAY_SIZE] ;	// remap file of the compaction
+	unsigned char resume_flag ;
+	unsigned char pipeline_flag ;	// reader/classifier/writer threads (--pipeline)
+	size_t sample_blocks ;		// blocks read by the quick check (--sample)
+	double sample_fraction ;	// share of the file read by the quick check (--sample-fraction)
+	uint64_t sample_seed ;		// block selection seed, 0 = from the clock (--sample-seed)
+
+	/* Incremental rescans */
+	unsigned char incremental_flag ;
+	unsigned char *manifest_dirty ;	// per block: invalid characters found by the scan
+	size_t manifest_block_bytes ;
+
+	/* Batch mode */
+	char batchpath[ARRAY_SIZE] ;
+	size_t invalid_count ;	// invalid characters processed by the last process_file()
+
+	/* Data file definition */
+	char deffile[ARRAY_SIZE] ;
+	field_t *fields ;
+	size_t field_count ;
+	size_t definition_size ;	// record size of the definition, record divider included
+
+	/* Validation and fill tables built from the definition by init_fields() */
+	unsigned char class_valid[FIELD_CLASSES][256] ;		// byte is valid in class
+	unsigned char class_nibbles[FIELD_CLASSES][32] ;	// bit h&7 of [l] ([16+l] for h >= 8) set if byte 0xhl is valid
+	unsigned char class_fill[FIELD_CLASSES] ;
+	unsigned char *column_class ;	// class of each column (RECORD_SIZE)
+	unsigned char *column_mask ;	// FIELD_CLASSES rows of RECORD_SIZE: 0xFF where the column is of the class
+	unsigned char *column_fill ;	// fill value of each column (RECORD_SIZE)
+	unsigned char classes_used ;	// bit per class present in the layout
+
+	/* Byte translation */
+	char translation[ARRAY_SIZE] ;
+	unsigned char translate_valid[256] ;	// byte is kept as is
+	unsigned char translate[256] ;		// replacement of an invalid byte
+	unsigned char translate_custom ;	// table differs from the VALID_START..VALID_END range
+
+	classify_block_t classify_block ;
+	invalid_bitmap_t invalid_bitmap ;
+	find_terminator_t find_terminator ;
+} ;
+
+/* Context of the calling thread. Set by the library entry points and passed on
+to the threads a run starts */
+__thread filefix_ctx_t *CTX = NULL ;
+
+#define	RECORD_SIZE (CTX->record_size)
+#define	AUTO_SIZE (CTX->auto_size)
+#define	DATAFILE (CTX->datafile)
+#define	INPUTFILE (CTX->inputfile)
+#define	FILL_VALUE (CTX->fill_value)
+#define	NULL_FILL_VALUE (CTX->null_fill_value)
+#define	RECORD_POSITION (CTX->record_position)
+#define	POSITION_SET (CTX->position_set)
+#define	VERBOSE_FLAG (CTX->verbose_flag)
+#define	UPDATE_FLAG (CTX->update_flag)
+#define	FULL_DETECTION_FLAG (CTX->full_detection_flag)
+#define	ZERO_DETECTION_FLAG (CTX->zero_detection_flag)
+#define	ITEST_FLAG (CTX->itest_flag)
+#define	WRONG_LENGTH_FLAG (CTX->wrong_length_flag)
+#define	SORTED_REPORT_FLAG (CTX->sorted_report_flag)
+#define	ITEST_VERSION (CTX->itest_version)
+#define	THREAD_COUNT (CTX->thread_count)
+#define	LOG (CTX->log)
+#define	REPORT_LEVEL (CTX->report_level)
+#define	REPORT_FORMAT (CTX->report_format)
+#define	REPORTFILE (CTX->reportfile)
+#define	REPORT_COUNTS (CTX->report_counts)
+#define	REPORT (CTX->report)
+#define	JOURNALFILE (CTX->journalfile)
+#define	ROLLBACKFILE (CTX->rollbackfile)
+#define	JOURNAL_FD (CTX->journal_fd)
+#define	JOURNAL_LOCK (CTX->journal_lock)
+#define	PATCHFILE (CTX->patchfile)
+#define	APPLYFILE (CTX->applyfile)
+#define	PATCH_OUT (CTX->patch_out)
+#define	PATCH_LOCK (CTX->patch_lock)
+#define	PATCH_RECORDS (CTX->patch_records)
+#define	HEATMAPFILE (CTX->heatmapfile)
+#define	WATCHDIR (CTX->watchdir)
+#define	ONLINE_FLAG (CTX->online_flag)
+#define	ONLINE_WRITTEN (CTX->online_written)
+#define	ONLINE_LOCKED (CTX->online_locked)
+#define	ONLINE_CHANGED (CTX->online_changed)
+#define	ONLINE_LOCKS (CTX->online_locks)
+#define	ONLINE_HELD (CTX->online_held)
+#define	ONLINE_LONGEST (CTX->online_longest)
+#define	WRITE_BACK (UPDATE_FLAG || PATCH_OUT != NULL)	// repairs collected in write batches
+#define	IO_ENGINE (CTX->io_engine)
+#define	QUEUE_DEPTH (CTX->queue_depth)
+#define	STREAM_FD (CTX->stream_fd)
+#define	STATS_FLAG (CTX->stats_flag)
+#define	PROGRESS_INTERVAL (CTX->progress_interval)
+#define	STATS_ENABLED (CTX->stats_enabled)
+#define	STATS (CTX->stats)
+#define	STATS_START (CTX->stats_start)
+#define	PROGRESS_THREAD (CTX->progress_thread)
+#define	PROGRESS_LOCK (CTX->progress_lock)
+#define	PROGRESS_STOP (CTX->progress_stop)
+#define	PROGRESS_RUNNING (CTX->progress_running)
+#define	MAX_RATE (CTX->max_rate)
+#define	ADAPTIVE_RATE (CTX->adaptive_rate)
+#define	RATE_LIMIT (CTX->rate_limit)
+#define	CHECKPOINTFILE (CTX->checkpointfile)
+#define	RESUME_FLAG (CTX->resume_flag)
+#define	COMPACTFILE (CTX->compactfile)
+#define	PIPELINE_FLAG (CTX->pipeline_flag)
+#define	SAMPLE_BLOCKS (CTX->sample_blocks)
+#define	SAMPLE_FRACTION (CTX->sample_fraction)
+#define	SAMPLE_SEED (CTX->sample_seed)
+#define	INCREMENTAL_FLAG (CTX->incremental_flag)
+#define	MANIFEST_DIRTY (CTX->manifest_dirty)
+#define	MANIFEST_BLOCK_BYTES (CTX->manifest_block_bytes)
+#define	BATCHPATH (CTX->batchpath)
+#define	INVALID_COUNT (CTX->invalid_count)
+#define	DEFFILE (CTX->deffile)
+#define	FIELDS (CTX->fields)
+#define	FIELD_COUNT (CTX->field_count)
+#define	DEFINITION_SIZE (CTX->definition_size)
+#define	CLASS_VALID (CTX->class_valid)
+#define	CLASS_NIBBLES (CTX->class_nibbles)
+#define	CLASS_FILL (CTX->class_fill)
+#define	COLUMN_CLASS (CTX->column_class)
+#define	COLUMN_MASK (CTX->column_mask)
+#define	COLUMN_FILL (CTX->column_fill)
+#define	CLASSES_USED (CTX->classes_used)
+#define	TRANSLATION (CTX->translation)
+#define	TRANSLATE_VALID (CTX->translate_valid)
+#define	TRANSLATE (CTX->translate)
+#define	TRANSLATE_CUSTOM (CTX->translate_custom)
+
+/* Prototypes */
+void message(const char *format, ...) ;
+int init_report(void) ;
+void close_report(void) ;
+int init_counts(report_counts_t *counts) ;
+void free_counts(report_counts_t *counts) ;
+void merge_counts(report_counts_t *dst, const report_counts_t *src) ;
+void report_binary(report_t *rep, uint8_t type, size_t position, uint32_t value, uint8_t old_char, uint8_t new_char) ;
+void report_record(report_t *rep, size_t file_pos) ;
+void report_change(report_t *rep, size_t file_pos, int offset, char old_char, char new_char) ;
+void report_record_done(report_t *rep, size_t file_pos, size_t invalid_count, int deleted) ;
+void report_nulls(report_t *rep, size_t file_pos, int null_count) ;
+void report_position(report_t *rep, size_t current_pos) ;
+void report_invalid(report_t *rep, size_t current_pos, int offset, unsigned char get_char) ;
+void report_position_done(report_t *rep, size_t current_pos, size_t invalid_count) ;
+void report_updated(report_t *rep, size_t file_pos) ;
+void report_written(report_t *rep, size_t file_pos) ;
+void report_skipped(report_t *rep, size_t file_pos, int reason) ;
+void report_summary(report_t *rep, size_t invalid_count) ;
+int write_heatmap(const report_counts_t *counts) ;
+void *report_writer(void *arg) ;
+ssize_t report_cookie_write(void *cookie, const char *buf, size_t size) ;
+int report_cookie_close(void *cookie) ;
+int set_report_level(const char *param) ;
+int set_report_format(const char *param) ;
+int set_report_file(const char *param) ;
+int process_file(void) ;
+int process_file_mmap(int fd, size_t *invalid_count) ;
+size_t scan_records(const char *records, size_t base, size_t size, report_t *rep, write_batch_t *batch) ;
+int set_engine(const char *param) ;
+int set_queue_depth(const char *param) ;
+int read_block(io_reader_t *reader, char *buffer, size_t offset, size_t length, size_t got) ;
+int pread_next(io_reader_t *reader, char **block, size_t *size) ;
+void close_reader(io_reader_t *reader) ;
+int open_reader(io_reader_t *reader, int fd) ;
+int process_file_blocks(int fd, size_t *invalid_count) ;
+int set_sample(const char *param) ;
+int set_sample_fraction(const char *param) ;
+int set_sample_seed(const char *param) ;
+uint64_t sample_random(uint64_t *state) ;
+int sample_file(void) ;
+size_t scan_block(const char *block, size_t offset, size_t size, char *carry, size_t *carry_size, write_batch_t *batch) ;
+size_t ring_pop(spsc_ring_t *ring) ;
+void ring_push(spsc_ring_t *ring, size_t value) ;
+void *pipeline_reader(void *arg) ;
+void *pipeline_writer(void *arg) ;
+int process_file_pipeline(int fd, size_t *invalid_count) ;
+int open_stream( void ) ;
+uint64_t monotonic_ns( void ) ;
+int set_max_rate(const char *param) ;
+void set_adaptive_rate( void ) ;
+int set_checkpoint_file(const char *param) ;
+int set_compact_file(const char *param) ;
+void set_pipeline(void) ;
+int sync_directory(const char *path) ;
+int compact_file(void) ;
+void set_resume( void ) ;
+void throttle(size_t bytes) ;
+void rate_sample(size_t bytes, uint64_t elapsed) ;
+int save_checkpoint(size_t offset, size_t invalid_count) ;
+int load_checkpoint(size_t file_size, size_t *offset, size_t *invalid_count) ;
+int scan_checkpointed(int fd, char *map, size_t map_size, size_t *invalid_count) ;
+void set_stats( void ) ;
+int set_progress(const char *param) ;
+uint64_t stats_clock( void ) ;
+void stats_phase(int phase, uint64_t start) ;
+void *progress_worker(void *arg) ;
+void start_progress(uint64_t total_bytes) ;
+void stop_progress( void ) ;
+void print_stats(size_t invalid_count) ;
+int write_stream(const char *buffer, size_t size) ;
+int process_stream( void ) ;
+uint64_t xxh64(const void *data, size_t size, uint64_t seed) ;
+uint64_t manifest_config(void) ;
+int scan_incremental(int fd, char *map, size_t map_size, size_t *invalid_count) ;
+void set_incremental(void) ;
+int scan_parallel(int fd, char *map, size_t map_size, size_t *invalid_count) ;
+size_t scan_mapping(char *map, size_t start, size_t end, report_t *rep, write_batch_t *batch) ;
+void *scan_worker(void *arg) ;
+int set_threads(const char *param) ;
+size_t fix_record(const char *buffer, char *writebuf, size_t file_pos, report_t *rep) ;
+int byte_invalid(unsigned char get_char, size_t i) ;
+unsigned char fill_value(unsigned char get_char, size_t i) ;
+int set_translation(const char *param) ;
+void translate_fold(const translation_t *fold, size_t count) ;
+int parse_translation_byte(const char *token, unsigned char *value) ;
+int init_translation(void) ;
+int set_definition(const char *param) ;
+int load_definition(const char *path) ;
+int init_fields(void) ;
+size_t classify_block_scalar(const char *base, size_t nrec, unsigned char *dirty) ;
+void invalid_bitmap_scalar(const char *rec, uint64_t *bits) ;
+size_t find_terminator_scalar(const char *p, size_t n) ;
+void init_classifier(void) ;
+double stride_score(const char *samples, const size_t *offsets, const size_t *sizes, size_t count, size_t stride, size_t *records) ;
+int detect_record_size(const char *path) ;
+size_t check_record(const char *buffer, char *writebuf, size_t current_pos, report_t *rep) ;
+size_t find_wrong_length(const char *map, size_t map_size, size_t **positions) ;
+int process_wrong_length(int fd, size_t *invalid_count) ;
+void set_wrong_length(void) ;
+void set_sorted_report(void) ;
+int compare_positions(const void *a, const void *b) ;
+int compare_order(const void *a, const void *b) ;
+int load_positions(FILE *input_file, position_t **positions, size_t *count) ;
+int process_positions(int fd, position_t *positions, size_t count, size_t *invalid_count) ;
+uint32_t checksum32(const char *data, size_t size) ;
+int init_batch(write_batch_t *batch, int fd) ;
+void free_batch(write_batch_t *batch) ;
+int batch_add(write_batch_t *batch, size_t position, const char *old_record, const char *new_record) ;
+int batch_flush(write_batch_t *batch) ;
+int lock_range(int fd, struct flock *lock) ;
+int batch_flush_online(write_batch_t *batch) ;
+int batch_covers(write_batch_t *batch, size_t position) ;
+void batch_overlay(write_batch_t *batch, char *record, size_t position) ;
+int journal_append(write_batch_t *batch) ;
+int open_journal(void) ;
+int rollback_journal(void) ;
+int set_journal_file(const char *param) ;
+int set_rollback_file(const char *param) ;
+int set_patch_file(const char *param) ;
+int set_heatmap_file(const char *param) ;
+int set_apply_file(const char *param) ;
+void set_online(void) ;
+int open_patch(int fd) ;
+int patch_append(write_batch_t *batch) ;
+int close_patch(int scan_failed) ;
+int compare_patch_ref(const void *a, const void *b) ;
+int apply_patch(void) ;
+int set_batch(const char *param) ;
+int load_batch(batch_job_t **jobs, size_t *count, size_t *mapped) ;
+int compare_job_size(const void *a, const void *b) ;
+int compare_job_name(const void *a, const void *b) ;
+void run_batch_job(batch_job_t *job) ;
+void report_batch_file(report_t *rep, batch_job_t *job) ;
+void report_batch_summary(report_t *rep, batch_job_t *jobs, size_t count, double seconds) ;
+int process_batch(void) ;
+int set_watch(const char *param) ;
+void watch_signal(int sig) ;
+int watch_name(const char *name) ;
+watch_file_t *watch_find(watch_file_t **files, size_t *count, size_t *capacity, const char *name) ;
+int watch_list(watch_file_t **files, size_t *count, size_t *capacity) ;
+int load_watch_state(watch_file_t **files, size_t *count, size_t *capacity) ;
+int save_watch_state(const watch_file_t *files, size_t count) ;
+int watch_scan(watch_file_t *file, size_t *invalid_count) ;
+int process_watch(void) ;
+int set_position(const char *param) ;
+int set_data_file(const char *param) ;
+int set_size(const char *param) ;
+int set_fill_val(const char *param) ;
+int parse_cmd(const char *cmd, const char *param) ;
+int set_input_file(const char *param) ;
+int parse_input_file(void) ;
+void get_env(void) ;
+void set_update(void) ;
+void set_full_detection(void) ;
+void set_zero_detection(void) ;
+void set_itest(void) ;
+void verbose(void) ;
+void run_itest(void) ;
+
+off_t ftello(FILE*);
+
+/*
+* message - print a message to the context's message stream (filefix_set_log())
+* + discarded when the context has no message stream
+* @format printf format
+*/
+void message(const char *format, ...){
+	va_list args ;
+
+	if (LOG == NULL)
+		return ;
+	va_start(args,format) ;
+	vfprintf(LOG,format,args) ;
+	va_end(args) ;
+	return ;
+} ;
+
+/*
+* valid_cmd - returns whether a command is valid
+* @cmd - input command
+* @return Input command is a valid command
+*/
+int valid_cmd(char *cmd){
+    return (strcmp(cmd,"b")==0 || strcmp(cmd,"d")==0 || strcmp(cmd,"D")==0 || strcmp(cmd,"e")==0 || strcmp(cmd,"f")==0 || strcmp(cmd,"F")==0 || strcmp(cmd,"i")==0 || 
+    	strcmp(cmd,"j")==0 || strcmp(cmd,"J")==0 || strcmp(cmd,"l")==0 || strcmp(cmd,"m")==0 || strcmp(cmd,"o")==0 || strcmp(cmd,"p")==0 || strcmp(cmd,"r")==0 || strcmp(cmd,"s")==0 || strcmp(cmd,"t")==0 || strcmp(cmd,"T")==0 || strcmp(cmd,"u")==0 || 
+    	strcmp(cmd,"v")==0 || strcmp(cmd,"w")==0 || strcmp(cmd,"x")==0 || strcmp(cmd,"y")==0 || 
+    	strcmp(cmd,"-progress")==0 || strcmp(cmd,"-queue-depth")==0 || strcmp(cmd,"-rollback")==0 || strcmp(cmd,"-stats")==0 || 
+    	strcmp(cmd,"-max-rate")==0 || strcmp(cmd,"-adaptive")==0 || strcmp(cmd,"-checkpoint")==0 || strcmp(cmd,"-resume")==0 || 
+    	strcmp(cmd,"-compact")==0 || strcmp(cmd,"-pipeline")==0 || 
+    	strcmp(cmd,"-patch-out")==0 || strcmp(cmd,"-apply-patch")==0 || strcmp(cmd,"-online")==0 || strcmp(cmd,"-heatmap")==0 || 
+    	strcmp(cmd,"-sample")==0 || strcmp(cmd,"-sample-fraction")==0 || strcmp(cmd,"-sample-seed")==0 || strcmp(cmd,"-watch")==0) ;
+} ;
+
+
+/*
+* parse_cmd - control for branching to valid commands
+*
+* valid commands:
+*   -b: batch mode over a data directory or manifest
+*   -d: specify data file
+*   -D: data file definition (XXXDEF.TXT)
+*   -e: I/O engine (mmap, stdio, pread, direct, uring)
+*   -f: fill value (ASCII) - default: 32
+*   -F: report format (text, json, binary)
+*   -l: specify record length (or auto)
+*   -m: incremental rescan against a sidecar manifest
+*   -o: report file
+*   -p: specify record position
+*   -r: report level (byte, record, summary)
+*   -s: report positions in file order
+*   -T: byte translation table (preset or map file)
+*   -j: number of threads for full/zero-detection mode
+*   -J: undo journal for update mode
+*	-u: update mode
+*   -v: verbose
+*	-w: wrong length record detection mode
+*	-x: hex 00 detection mode
+*   --adaptive: lower --max-rate while device latency is high
+*   --apply-patch: apply the patch of an offline scan to the data file
+*   --checkpoint: checkpoint file of the full/zero-detection traversal
+*   --compact: remove deleted records, old to new positions in a remap file
+*   --heatmap: invalid characters by offset and value, 0x00 run lengths (CSV)
+*   --max-rate: read/write bandwidth limit (MB/s)
+*   --online: update while the data file is in use (record locks)
+*   --patch-out: write repairs to a patch file, the data file is not changed
+*   --pipeline: reader, classifier and writer stages on separate threads
+*   --progress: seconds between progress lines (stderr)
+*   --resume: continue from the --checkpoint file
+*   --queue-depth: reads in flight for the uring engine
+*   --rollback: restore the data file from an undo journal
+*   --sample: quick check of N random blocks with estimated corruption rates
+*   --sample-fraction: quick check of a share of the file (0..1)
+*   --sample-seed: seed of the block selection, to repeat a quick check
+*   --stats: counters and phase timings as JSON on stderr at exit
+*   --watch: daemon scanning appended and modified records of a directory
+*
+* @cmd command
+* @param parameter associated with command
+* @return Command executed successfully
+*/
+int parse_cmd(const char *cmd, const char *param){
+	int ret_val = 0 ;
+
+//	message("command: %s; parameter: %s\n", cmd, param) ;
+
+	if (strcmp(cmd,"b")==0)
+		ret_val = set_batch(param) ;
+	else if (strcmp(cmd,"d")==0)
+		ret_val = set_data_file(param) ;
+	else if (strcmp(cmd,"D")==0)
+		ret_val = set_definition(param) ;
+	else if (strcmp(cmd,"e")==0)
+		ret_val = set_engine(param) ;
+    else if (strcmp(cmd,"f")==0)
+        ret_val = set_fill_val(param) ;
+    else if (strcmp(cmd,"F")==0)
+        ret_val = set_report_format(param) ;
+    else if (strcmp(cmd,"i")==0)
+        set_input_file(param) ;
+    else if (strcmp(cmd,"j")==0)
+        ret_val = set_threads(param) ;
+    else if (strcmp(cmd,"J")==0)
+        ret_val = set_journal_file(param) ;
+	else if (strcmp(cmd,"l")==0)
+		ret_val = set_size(param);
+	else if (strcmp(cmd,"m")==0)
+		set_incremental() ;
+	else if (strcmp(cmd,"o")==0)
+		ret_val = set_report_file(param) ;
+	else if (strcmp(cmd,"p")==0)
+		ret_val = set_position(param) ;
+	else if (strcmp(cmd,"r")==0)
+		ret_val = set_report_level(param) ;
+	else if (strcmp(cmd,"s")==0)
+		set_sorted_report() ;
+	else if (strcmp(cmd,"t")==0)
+		set_itest() ;
+	else if (strcmp(cmd,"T")==0)
+		ret_val = set_translation(param) ;
+	else if (strcmp(cmd,"u")==0)
+		set_update() ;
+    else if (strcmp(cmd,"v")==0)
+        verbose() ;
+	else if (strcmp(cmd,"w")==0)
+		set_wrong_length() ;
+	else if (strcmp(cmd,"x")==0)
+		set_zero_detection() ;
+	else if (strcmp(cmd,"y")==0)
+		set_full_detection() ;
+	else if (strcmp(cmd,"-adaptive")==0)
+		set_adaptive_rate() ;
+	else if (strcmp(cmd,"-apply-patch")==0)
+		ret_val = set_apply_file(param) ;
+	else if (strcmp(cmd,"-checkpoint")==0)
+		ret_val = set_checkpoint_file(param) ;
+	else if (strcmp(cmd,"-compact")==0)
+		ret_val = set_compact_file(param) ;
+	else if (strcmp(cmd,"-heatmap")==0)
+		ret_val = set_heatmap_file(param) ;
+	else if (strcmp(cmd,"-max-rate")==0)
+		ret_val = set_max_rate(param) ;
+	else if (strcmp(cmd,"-online")==0)
+		set_online() ;
+	else if (strcmp(cmd,"-patch-out")==0)
+		ret_val = set_patch_file(param) ;
+	else if (strcmp(cmd,"-pipeline")==0)
+		set_pipeline() ;
+	else if (strcmp(cmd,"-resume")==0)
+		set_resume() ;
+	else if (strcmp(cmd,"-progress")==0)
+		ret_val = set_progress(param) ;
+	else if (strcmp(cmd,"-stats")==0)
+		set_stats() ;
+	else if (strcmp(cmd,"-queue-depth")==0)
+		ret_val = set_queue_depth(param) ;
+	else if (strcmp(cmd,"-rollback")==0)
+		ret_val = set_rollback_file(param) ;
+	else if (strcmp(cmd,"-sample")==0)
+		ret_val = set_sample(param) ;
+	else if (strcmp(cmd,"-sample-fraction")==0)
+		ret_val = set_sample_fraction(param) ;
+	else if (strcmp(cmd,"-sample-seed")==0)
+		ret_val = set_sample_seed(param) ;
+	else if (strcmp(cmd,"-watch")==0)
+		ret_val = set_watch(param) ;
+	return ret_val ;
+} ;
+
+/*
+* set_size - sets size of record to parse ("auto": detected from the data file)
+* @return Record size successfully set
+*/
+int set_size(const char *param){
+	int ret_val = 0 ;
+	if (strcmp(param,"auto")==0){
+		AUTO_SIZE = 1 ;
+		RECORD_SIZE = 0 ;
+		message("Record size: detected from the data file\n") ;
+	}else if (is_number((char**)&param)){
+		AUTO_SIZE = 0 ;
+		RECORD_SIZE = (size_t) strtoll(param,(char**)NULL,10) ;
+		message("Setting record size to: %zu\n",RECORD_SIZE) ;
+	}else 
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_data_file - set the data file
+* @return Data file successfully set
+*/
+int set_data_file(const char *param){
+	int ret_val = 0 ;
+	int param_size = strlen(param) ;
+	strncpy((char*)&DATAFILE,param,param_size*sizeof(char)) ;
+	DATAFILE[param_size] = '\0' ;
+	if ( strcmp(param,(char*)&DATAFILE)!= 0 )
+		ret_val = 1 ;
+	message("DATAFILE: %s\n",DATAFILE) ;
+	return ret_val ;
+} ;
+
+/*
+* set_input_file - set the input record position file
+* @return Input file successfully set
+*/
+int set_input_file(const char *param){
+	int ret_val = 0 ;
+	int param_size = strlen(param) ;
+	strncpy((char*)&INPUTFILE,param,param_size*sizeof(char)) ;
+	INPUTFILE[param_size] = '\0' ;
+	if ( strcmp(param,(char*)&INPUTFILE)!= 0 )
+		ret_val = 1 ;
+	message("Input file: %s\n",INPUTFILE) ;
+	return ret_val ;
+} ;
+
+/*
+* set_position - set the (single) record position for which to check for invalid characters
+* @return Record position successfully set
+*/
+int set_position(const char *param){
+	unsigned long long value = 0 ;
+	int ret_val = 0 ;
+
+	errno = 0 ;
+	if (is_number((char**)&param))
+		value = strtoull(param,(char**)NULL,10) ;
+	else
+		errno = EINVAL ;
+	if (errno == 0 && value <= SIZE_MAX){
+		RECORD_POSITION = (size_t) value ;
+		POSITION_SET = 1 ;
+		message("Setting record position to: %zu\n",RECORD_POSITION) ;
+	}else
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_threads - set the number of threads used by full/zero-detection mode
+* + 0 uses one thread per online processor
+* @return Thread count successfully set
+*/
+int set_threads(const char *param){
+	int ret_val = 0 ;
+	long cpu_count ;
+	if (is_number((char**)&param)){
+		THREAD_COUNT = (size_t) strtoll(param,(char**)NULL,10) ;
+		if (THREAD_COUNT == 0)
+			THREAD_COUNT = (cpu_count = sysconf(_SC_NPROCESSORS_ONLN)) > 0 ? (size_t) cpu_count : 1 ;
+		message("Setting thread count to: %zu\n",THREAD_COUNT) ;
+	}else
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_engine - set the I/O engine of the full/zero-detection traversal
+* + mmap (default), stdio, pread (large aligned blocks), direct (O_DIRECT) or
+* uring (io_uring with --queue-depth reads in flight)
+* @return I/O engine successfully set
+*/
+int set_engine(const char *param){
+	int ret_val = 0 ;
+	if (strcmp(param,"mmap")==0)
+		IO_ENGINE = ENGINE_MMAP ;
+	else if (strcmp(param,"stdio")==0)
+		IO_ENGINE = ENGINE_STDIO ;
+	else if (strcmp(param,"pread")==0)
+		IO_ENGINE = ENGINE_PREAD ;
+	else if (strcmp(param,"direct")==0)
+		IO_ENGINE = ENGINE_DIRECT ;
+	else if (strcmp(param,"uring")==0)
+		IO_ENGINE = ENGINE_URING ;
+	else{
+		message("Invalid I/O engine specified.\n") ;
+		ret_val = 1 ;
+	}
+	if (ret_val==0)
+		message("I/O engine: %s\n",param) ;
+	return ret_val ;
+} ;
+
+/*
+* set_queue_depth - set the number of reads kept in flight by the uring engine
+* @return Queue depth successfully set
+*/
+int set_queue_depth(const char *param){
+	int ret_val = 0 ;
+	if (is_number((char**)&param) && strtoll(param,(char**)NULL,10) > 0){
+		QUEUE_DEPTH = (size_t) strtoll(param,(char**)NULL,10) ;
+		message("Setting queue depth to: %zu\n",QUEUE_DEPTH) ;
+	}else
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_max_rate - limit read and write bandwidth to param MB/s (--max-rate)
+* @return Rate successfully set
+*/
+int set_max_rate(const char *param){
+	char *end ;
+	double rate = strtod(param,&end) ;
+
+	if (end == param || *end != '\0' || rate <= 0)
+		return 1 ;
+	MAX_RATE = rate*1024*1024 ;
+	RATE_LIMIT.rate = MAX_RATE ;
+	message("Bandwidth limit: %.1f MB/s\n",rate) ;
+	return 0 ;
+} ;
+
+/*
+* set_adaptive_rate - back off from --max-rate while I/O latency is high
+*/
+void set_adaptive_rate( void ){
+	ADAPTIVE_RATE = 1 ;
+	message("Adaptive bandwidth limit set.\n") ;
+	return ;
+} ;
+
+/*
+* set_pipeline - run the full/zero-detection traversal as a reader, classifier
+* and writer pipeline (--pipeline)
+*/
+void set_pipeline( void ){
+	PIPELINE_FLAG = 1 ;
+	message("Pipelined traversal set.\n") ;
+	return ;
+} ;
+
+/*
+* set_compact_file - set the remap file of the compaction (--compact)
+* @return Remap file successfully set
+*/
+int set_compact_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&COMPACTFILE,param,param_size*sizeof(char)) ;
+	COMPACTFILE[param_size] = '\0' ;
+	message("Compaction remap file: %s\n",COMPACTFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_checkpoint_file - set the checkpoint file of the full/zero-detection traversal
+* @return Checkpoint file successfully set
+*/
+int set_checkpoint_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&CHECKPOINTFILE,param,param_size*sizeof(char)) ;
+	CHECKPOINTFILE[param_size] = '\0' ;
+	message("Checkpoint file: %s\n",CHECKPOINTFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_resume - continue from the checkpoint file (--resume)
+*/
+void set_resume( void ){
+	RESUME_FLAG = 1 ;
+	message("Resume mode set.\n") ;
+	return ;
+} ;
+
+/*
+* set_stats - report counters and phase timings at exit (--stats)
+*/
+void set_stats( void ){
+	STATS_FLAG = 1 ;
+	STATS_ENABLED = 1 ;
+	message("Statistics enabled.\n") ;
+	return ;
+} ;
+
+/*
+* set_progress - print a progress line every param seconds (--progress)
+* @return Interval successfully set
+*/
+int set_progress(const char *param){
+	int ret_val = 0 ;
+	if (is_number((char**)&param) && strtoll(param,(char**)NULL,10) > 0){
+		PROGRESS_INTERVAL = (unsigned int) strtoll(param,(char**)NULL,10) ;
+		STATS_ENABLED = 1 ;
+		message("Progress every %u seconds.\n",PROGRESS_INTERVAL) ;
+	}else
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_report_level - set the amount of detail reported
+* + byte: every invalid character (default), record: one line per record,
+* summary: counts only
+* @return Report level successfully set
+*/
+int set_report_level(const char *param){
+	int ret_val = 0 ;
+	if (strcmp(param,"byte")==0)
+		REPORT_LEVEL = REPORT_BYTE ;
+	else if (strcmp(param,"record")==0)
+		REPORT_LEVEL = REPORT_RECORD ;
+	else if (strcmp(param,"summary")==0)
+		REPORT_LEVEL = REPORT_SUMMARY ;
+	else{
+		message("Invalid report level specified.\n") ;
+		ret_val = 1 ;
+	}
+	return ret_val ;
+} ;
+
+/*
+* set_report_format - set the report format
+* + text (default), json (one JSON object per line) or binary (report_event_t)
+* @return Report format successfully set
+*/
+int set_report_format(const char *param){
+	int ret_val = 0 ;
+	if (strcmp(param,"text")==0)
+		REPORT_FORMAT = FORMAT_TEXT ;
+	else if (strcmp(param,"json")==0)
+		REPORT_FORMAT = FORMAT_JSON ;
+	else if (strcmp(param,"binary")==0)
+		REPORT_FORMAT = FORMAT_BINARY ;
+	else{
+		message("Invalid report format specified.\n") ;
+		ret_val = 1 ;
+	}
+	return ret_val ;
+} ;
+
+/*
+* set_report_file - set the file receiving the report
+* @return Report file successfully set
+*/
+int set_report_file(const char *param){
+	int ret_val = 0 ;
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&REPORTFILE,param,param_size*sizeof(char)) ;
+	REPORTFILE[param_size] = '\0' ;
+	message("Report file: %s\n",REPORTFILE) ;
+	return ret_val ;
+} ;
+
+/*
+* set_batch - set the data directory or manifest processed in batch mode
+* @return Batch path successfully set
+*/
+int set_batch(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&BATCHPATH,param,param_size*sizeof(char)) ;
+	BATCHPATH[param_size] = '\0' ;
+	message("Batch: %s\n",BATCHPATH) ;
+	return 0 ;
+} ;
+
+/*
+* set_journal_file - set the undo journal written in update mode
+* @return Journal file successfully set
+*/
+int set_journal_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&JOURNALFILE,param,param_size*sizeof(char)) ;
+	JOURNALFILE[param_size] = '\0' ;
+	message("Journal file: %s\n",JOURNALFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_rollback_file - set the undo journal to restore the data file from
+* @return Journal file successfully set
+*/
+int set_rollback_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&ROLLBACKFILE,param,param_size*sizeof(char)) ;
+	ROLLBACKFILE[param_size] = '\0' ;
+	message("Rolling back from journal: %s\n",ROLLBACKFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_patch_file - write the repairs to a patch file instead of the data file
+* (--patch-out)
+* @return Patch file successfully set
+*/
+int set_patch_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&PATCHFILE,param,param_size*sizeof(char)) ;
+	PATCHFILE[param_size] = '\0' ;
+	message("Patch file: %s\n",PATCHFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_heatmap_file - set the CSV file of the corruption heatmap (--heatmap)
+* @return Heatmap file successfully set
+*/
+int set_heatmap_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&HEATMAPFILE,param,param_size*sizeof(char)) ;
+	HEATMAPFILE[param_size] = '\0' ;
+	message("Heatmap file: %s\n",HEATMAPFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_apply_file - set the patch to apply to the data file (--apply-patch)
+* @return Patch file successfully set
+*/
+int set_apply_file(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&APPLYFILE,param,param_size*sizeof(char)) ;
+	APPLYFILE[param_size] = '\0' ;
+	message("Applying patch: %s\n",APPLYFILE) ;
+	return 0 ;
+} ;
+
+/*
+* set_online - update the data file while it is in use (--online)
+*/
+void set_online( void ){
+	ONLINE_FLAG = 1 ;
+	message("Online mode set.\n") ;
+	return ;
+} ;
+
+/*
+* set_fill_val - set the fill value (decimal) to replace invalid characters
+* @return Fill value successfully set
+*/
+int set_fill_val(const char *param){
+	int ret_val = 0, param_val ;
+	if ( is_number((char**)&param)){
+		param_val = (size_t) strtoll(param,(char**)NULL,10) ;
+		if (param_val>=VALID_START&&param_val<=VALID_END){
+			FILL_VALUE = param_val ;
+			message("Setting fill value to: %u (%c)\n",FILL_VALUE,(char) FILL_VALUE) ;
+		}
+		else{
+			message("Invalid fill value specified.\n") ;
+			ret_val = 1 ;
+		}
+	}else{
+		message("Input is not a number.\n") ;
+		ret_val = 1 ;
+	}
+	return ret_val ;
+} ;
+
+/*
+ * set_full_detection - set full detection mode flag
+ * + set flag to process entire data file instead of specific positions
+ */
+void set_full_detection( void ){
+	FULL_DETECTION_FLAG = 1 ;
+	message("Full-detection mode set.\n");
+	return ;
+} ;
+
+/*
+ * set_full_detection - set full detection mode flag
+ * + set flag to process entire data file instead of specific positions
+ */
+void set_zero_detection( void ){
+	ZERO_DETECTION_FLAG = 1 ;
+	message("Zero-detection mode set.\n");
+	return ;
+} ;
+
+/*
+ * set_wrong_length - set wrong length detection mode flag
+ * + set flag to locate wrong length records without filechk
+ */
+void set_wrong_length( void ){
+	WRONG_LENGTH_FLAG = 1 ;
+	message("Wrong length detection mode set.\n");
+	return ;
+} ;
+
+/*
+ * set_incremental - set incremental rescan flag
+ * + full/zero-detection only rescans blocks changed since the last run
+ */
+void set_incremental( void ){
+	INCREMENTAL_FLAG = 1 ;
+	message("Incremental mode set.\n");
+	return ;
+} ;
+
+/*
+ * set_sorted_report - set sorted report flag
+ * + positions from -p/-i are reported in file order instead of input order
+ */
+void set_sorted_report( void ){
+	SORTED_REPORT_FLAG = 1 ;
+	return ;
+} ;
+
+/*
+* verbose - set verbose mode
+*/
+void verbose( void ){
+	VERBOSE_FLAG = 1 ;
+	return ;
+} ;
+
+/*
+* set_update - set update mode
+*/
+void set_update( void ){
+	message("Update mode set.\n") ;
+	UPDATE_FLAG = 1 ;
+	return ;
+} ;
+
+/*
+* get_env - get environment variables that are set for EXTDREP
+*/
+void get_env( void ){
+	DBC_IKEYS = getenv("DBC_IKEYS") ;
+	DBC_ICHRS = getenv("DBC_ICHRS") ;
+
+//	message("DBC_IKEYS = %s\n",DBC_IKEYS) ;
+//	message("DBC_ICHRS = %s\n",DBC_ICHRS) ;
+	return ;
+} ;
+
+/*
+* set_itest - set itest flag
+*/
+void set_itest( void ){
+	ITEST_FLAG = 1 ;
+	return ;
+} ;
+
+/*
+* run_itest - attempts to run the latest version of ITEST. Can
+* be forced to run a specific version (if exists)
+*/
+void run_itest ( void ){
+	struct stat_struct* stat_buf = malloc(sizeof(struct stat)) ;
+	char *datafile_name = parse_filename(DATAFILE, (const char*) FILEPATH_SEPARATOR) ;
+	char rollout_cmd[ARRAY_SIZE] ;
+	memset(rollout_cmd,0,ARRAY_SIZE*sizeof(char)) ;
+
+//	message("ITEST3_PATH: %s\n",ITEST3_PATH) ;
+//	message("ITEST2_PATH: %s\n",ITEST2_PATH) ;
+
+	if (stat(ITEST3_PATH, (struct stat*) stat_buf) == 0){
+		ITEST_VERSION = 3 ;
+	}else if (stat(ITEST2_PATH, (struct stat*) stat_buf) == 0){
+		ITEST_VERSION = 2 ;
+	}
+
+	switch (ITEST_VERSION){
+		case 3:
+			strcpy(rollout_cmd, "DBC ITEST3 ") ;
+			strcat(rollout_cmd, datafile_name) ;
+			strcat(rollout_cmd, " ALL DUP") ;
+			break ;
+		case 2:
+			strcpy(rollout_cmd, "DBC ITEST2 ") ;
+			strcat(rollout_cmd, datafile_name) ;
+			strcat(rollout_cmd, " ALL DUP") ;
+			break ;
+		case 1:
+		default:
+			strcpy(rollout_cmd, "DBC ITEST") ;
+			break ;
+	}
+	message("Rolling out the current ITEST command: %s\n", rollout_cmd) ;
+	system(rollout_cmd) ;
+	return;
+} ;
+
+/*
+* init_counts - reset report counts
+* @counts counts to reset
+* @return Allocation failed
+*/
+int init_counts(report_counts_t *counts){
+	memset(counts,0,sizeof(report_counts_t)) ;
+	counts->record_counts = calloc(RECORD_SIZE + 1,sizeof(size_t)) ;
+	if (strlen(HEATMAPFILE)>0 && RECORD_SIZE > 0){
+		counts->cell_counts = calloc(RECORD_SIZE*256,sizeof(size_t)) ;
+		counts->burst_counts = calloc(RECORD_SIZE + 1,sizeof(size_t)) ;
+		if (counts->cell_counts == NULL || counts->burst_counts == NULL)
+			return 1 ;
+	}
+	return counts->record_counts == NULL ;
+} ;
+
+/*
+* free_counts - release the tables of report counts
+*/
+void free_counts(report_counts_t *counts){
+	free(counts->record_counts) ;
+	free(counts->cell_counts) ;
+	free(counts->burst_counts) ;
+	counts->record_counts = NULL ;
+	counts->cell_counts = NULL ;
+	counts->burst_counts = NULL ;
+	return ;
+} ;
+
+/*
+* merge_counts - add the counts of a worker to a report's counts
+* @dst counts to add to
+* @src counts to add
+*/
+void merge_counts(report_counts_t *dst, const report_counts_t *src){
+	size_t i ;
+
+	dst->dirty_records += src->dirty_records ;
+	dst->deleted_records += src->deleted_records ;
+	dst->updated_records += src->updated_records ;
+	dst->skipped_records += src->skipped_records ;
+	for (i=0;i<256;i++)
+		dst->byte_counts[i] += src->byte_counts[i] ;
+	for (i=0;i<=RECORD_SIZE && src->record_counts!=NULL;i++)
+		dst->record_counts[i] += src->record_counts[i] ;
+	for (i=0;i<RECORD_SIZE*256 && src->cell_counts!=NULL && dst->cell_counts!=NULL;i++)
+		dst->cell_counts[i] += src->cell_counts[i] ;
+	for (i=0;i<=RECORD_SIZE && src->burst_counts!=NULL && dst->burst_counts!=NULL;i++)
+		dst->burst_counts[i] += src->burst_counts[i] ;
+	return ;
+} ;
+
+/*
+* report_cookie_write - stdio write hook of the report file
+* + copies the stdio buffer into the ring drained by report_writer(), only
+* waiting when the ring is full
+*/
+ssize_t report_cookie_write(void *cookie, const char *buf, size_t size){
+	report_writer_t *writer = (report_writer_t*) cookie ;
+	size_t copied = 0, chunk, offset ;
+
+	pthread_mutex_lock(&writer->lock) ;
+	while (copied < size && !writer->failed){
+		while (writer->head - writer->tail == REPORT_RING && !writer->failed)
+			pthread_cond_wait(&writer->not_full,&writer->lock) ;
+		offset = writer->head % REPORT_RING ;
+		chunk = REPORT_RING - (writer->head - writer->tail) ;
+		if (chunk > REPORT_RING - offset)
+			chunk = REPORT_RING - offset ;
+		if (chunk > size - copied)
+			chunk = size - copied ;
+		memcpy(writer->ring + offset,buf + copied,chunk) ;
+		writer->head += chunk ;
+		copied += chunk ;
+		pthread_cond_signal(&writer->not_empty) ;
+	}
+	pthread_mutex_unlock(&writer->lock) ;
+	return writer->failed ? -1 : (ssize_t) size ;
+} ;
+
+/*
+* report_cookie_close - stdio close hook of the report file
+* + lets the writer thread drain the ring before closing the file
+*/
+int report_cookie_close(void *cookie){
+	report_writer_t *writer = (report_writer_t*) cookie ;
+	int ret_val ;
+
+	pthread_mutex_lock(&writer->lock) ;
+	writer->done = 1 ;
+	pthread_cond_signal(&writer->not_empty) ;
+	pthread_mutex_unlock(&writer->lock) ;
+	pthread_join(writer->thread,NULL) ;
+
+	ret_val = writer->failed || close(writer->fd)!=0 ? -1 : 0 ;
+	pthread_mutex_destroy(&writer->lock) ;
+	pthread_cond_destroy(&writer->not_empty) ;
+	pthread_cond_destroy(&writer->not_full) ;
+	free(writer->ring) ;
+	free(writer) ;
+	return ret_val ;
+} ;
+
+/*
+* report_writer - report file writer thread
+* + writes the ring out as it fills so report output never stalls the scan
+* @arg report_writer_t of the report file
+*/
+void *report_writer(void *arg){
+	report_writer_t *writer = (report_writer_t*) arg ;
+	size_t offset, chunk ;
+	ssize_t written ;
+
+	pthread_mutex_lock(&writer->lock) ;
+	for (;;){
+		while (writer->head == writer->tail && !writer->done)
+			pthread_cond_wait(&writer->not_empty,&writer->lock) ;
+		if (writer->head == writer->tail)
+			break ;
+		offset = writer->tail % REPORT_RING ;
+		chunk = writer->head - writer->tail ;
+		if (chunk > REPORT_RING - offset)
+			chunk = REPORT_RING - offset ;
+		pthread_mutex_unlock(&writer->lock) ;
+		written = write(writer->fd,writer->ring + offset,chunk) ;
+		pthread_mutex_lock(&writer->lock) ;
+		if (written < 0){
+			if (errno == EINTR)
+				continue ;
+			perror("ERROR") ;
+			writer->failed = 1 ;
+			pthread_cond_broadcast(&writer->not_full) ;
+			break ;
+		}
+		writer->tail += written ;
+		pthread_cond_signal(&writer->not_full) ;
+	}
+	pthread_mutex_unlock(&writer->lock) ;
+	return NULL ;
+} ;
+
+/*
+* report_event_write - report stream of a context with a callback
+* + the stream carries binary events: each complete event goes to the callback,
+* an event split over two writes is completed by the next one
+*/
+ssize_t report_event_write(void *cookie, const char *buf, size_t size){
+	filefix_ctx_t *ctx = (filefix_ctx_t*) cookie ;
+	size_t used = 0, chunk ;
+
+	while (used < size){
+		chunk = sizeof(filefix_event_t) - ctx->event_size ;
+		if (chunk > size - used)
+			chunk = size - used ;
+		memcpy((char*)&ctx->event + ctx->event_size,buf + used,chunk) ;
+		ctx->event_size += chunk ;
+		used += chunk ;
+		if (ctx->event_size == sizeof(filefix_event_t)){
+			ctx->callback(ctx->callback_user,&ctx->event) ;
+			ctx->event_size = 0 ;
+		}
+	}
+	return size ;
+} ;
+
+/*
+* init_report - set up the report destination
+* + reports go to the message stream unless a report file is set (-o), in which
+* case they are buffered and written out by a separate thread
+* + with a callback (filefix_set_callback()) the report is written in the binary
+* format to a stream that hands each event to the callback
+* @return Report could not be set up
+*/
+int init_report( void ){
+	cookie_io_functions_t report_io = { NULL, report_cookie_write, NULL, report_cookie_close } ;
+	cookie_io_functions_t event_io = { NULL, report_event_write, NULL, NULL } ;
+	report_writer_t *writer ;
+
+	REPORT.out = LOG ;
+	REPORT.counts = &REPORT_COUNTS ;
+	if (init_counts(&REPORT_COUNTS)!=0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if (CTX->callback != NULL){
+		REPORT_FORMAT = FORMAT_BINARY ;
+		CTX->event_size = 0 ;
+		if ((REPORT.out = fopencookie(CTX,"w",event_io))==NULL){
+			perror("ERROR") ;
+			return 1 ;
+		}
+		setvbuf(REPORT.out,NULL,_IOFBF,REPORT_BUFFER) ;
+		return 0 ;
+	}
+	if (strlen(REPORTFILE)==0){
+		/* No message stream: the report is discarded as well */
+		if (REPORT.out == NULL && (REPORT.out = fopen("/dev/null","w"))==NULL){
+			perror("ERROR") ;
+			return 1 ;
+		}
+		return 0 ;
+	}
+
+	if ((writer = calloc(1,sizeof(report_writer_t)))==NULL || (writer->ring = malloc(REPORT_RING))==NULL){
+		perror("ERROR") ;
+		free(writer) ;
+		return 1 ;
+	}
+	/* A resumed run adds to the report of the interrupted one */
+	if ((writer->fd = open(REPORTFILE,O_WRONLY|O_CREAT|(RESUME_FLAG ? O_APPEND : O_TRUNC),0644)) < 0){
+		perror("ERROR") ;
+		free(writer->ring) ;
+		free(writer) ;
+		return 1 ;
+	}
+	pthread_mutex_init(&writer->lock,NULL) ;
+	pthread_cond_init(&writer->not_empty,NULL) ;
+	pthread_cond_init(&writer->not_full,NULL) ;
+	if (pthread_create(&writer->thread,NULL,report_writer,writer)!=0){
+		fprintf(stderr, "ERROR: Unable to start report writer.\n") ;
+		pthread_mutex_destroy(&writer->lock) ;
+		pthread_cond_destroy(&writer->not_empty) ;
+		pthread_cond_destroy(&writer->not_full) ;
+		close(writer->fd) ;
+		free(writer->ring) ;
+		free(writer) ;
+		return 1 ;
+	}
+	if ((REPORT.out = fopencookie(writer,"w",report_io))==NULL){
+		fprintf(stderr, "ERROR: Unable to start report writer.\n") ;
+		/* Stops the writer thread, closes the file and frees the writer */
+		report_cookie_close(writer) ;
+		REPORT.out = LOG ;
+		return 1 ;
+	}
+	setvbuf(REPORT.out,NULL,_IOFBF,REPORT_BUFFER) ;
+	return 0 ;
+} ;
+
+/*
+* close_report - flush and close the report destination
+*/
+void close_report( void ){
+	if (REPORT.out != NULL && REPORT.out != LOG && fclose(REPORT.out)!=0)
+		fprintf(stderr, "ERROR: Report file %s is incomplete.\n",REPORTFILE) ;
+	REPORT.out = LOG ;
+	free_counts(&REPORT_COUNTS) ;
+	return ;
+} ;
+
+/*
+* report_binary - write a binary report event
+*/
+void report_binary(report_t *rep, uint8_t type, size_t position, uint32_t value, uint8_t old_char, uint8_t new_char){
+	report_event_t event ;
+
+	memset(&event,0,sizeof(event)) ;
+	event.position = position ;
+	event.value = value ;
+	event.type = type ;
+	event.old_char = old_char ;
+	event.new_char = new_char ;
+	fwrite(&event,sizeof(event),1,rep->out) ;
+	return ;
+} ;
+
+/*
+* report_record - first invalid character found in a full/zero-detection record (byte level)
+*/
+void report_record(report_t *rep, size_t file_pos){
+	if (REPORT_LEVEL < REPORT_BYTE)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"record\",\"record\":%zu,\"position\":%zu}\n",file_pos/RECORD_SIZE,file_pos) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_RECORD,file_pos,0,0,0) ;
+	else if (file_pos == 0)
+		fprintf(rep->out,"Record: 0; Position: %zu\n",file_pos) ;
+	else
+		fprintf(rep->out,"Record: %zu; Position: %zu\n",(file_pos/RECORD_SIZE),file_pos) ;
+	return ;
+} ;
+
+/*
+* report_change - invalid character replaced in a full/zero-detection record (byte level)
+*/
+void report_change(report_t *rep, size_t file_pos, int offset, char old_char, char new_char){
+	rep->counts->byte_counts[(unsigned char) old_char]++ ;
+	if (rep->counts->cell_counts != NULL && (size_t) offset < RECORD_SIZE)
+		rep->counts->cell_counts[(size_t) offset*256 + (unsigned char) old_char]++ ;
+	if (REPORT_LEVEL < REPORT_BYTE)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"change\",\"position\":%zu,\"offset\":%d,\"old\":%d,\"new\":%d}\n",file_pos,offset,old_char&0xff,new_char&0xff) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_CHANGE,file_pos,offset,old_char,new_char) ;
+	else if (old_char == new_char)
+		fprintf(rep->out,"Leaving '%c' (hex: %x; dec: %d) in a date field. Offset: %d\n",old_char,old_char&0xff,old_char&0xff,offset) ;
+	else
+		fprintf(rep->out,"Changing '%c' (hex: %x; dec: %d) to '%c' (hex: %x; dec: %d). Offset: %d\n",old_char,old_char,old_char&0xff,new_char,new_char&0xff,new_char,offset) ;
+	return ;
+} ;
+
+/*
+* report_record_done - end of a full/zero-detection record with invalid characters
+* + the record level reports one line per record instead of one per character
+*/
+void report_record_done(report_t *rep, size_t file_pos, size_t invalid_count, int deleted){
+	rep->counts->dirty_records++ ;
+	rep->counts->deleted_records += deleted ;
+	rep->counts->record_counts[invalid_count]++ ;
+	if (REPORT_LEVEL != REPORT_RECORD)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"record\",\"record\":%zu,\"position\":%zu,\"invalid\":%zu,\"deleted\":%d}\n",file_pos/RECORD_SIZE,file_pos,invalid_count,deleted) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_RECORD_DONE,file_pos,invalid_count,deleted,0) ;
+	else{
+		fprintf(rep->out,"Record: %zu; Position: %zu\n",(file_pos/RECORD_SIZE),file_pos) ;
+		fprintf(rep->out,"%zu invalid characters found.\n",invalid_count) ;
+	}
+	return ;
+} ;
+
+/*
+* report_nulls - 0x00 characters found in a record (record level)
+*/
+void report_nulls(report_t *rep, size_t file_pos, int null_count){
+	if (REPORT_LEVEL < REPORT_RECORD)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"nulls\",\"position\":%zu,\"count\":%d}\n",file_pos,null_count) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_NULLS,file_pos,null_count,0,0) ;
+	else
+		fprintf(rep->out,"%d occurrences of 0x00 characters found.\n", null_count) ;
+	return ;
+} ;
+
+/*
+* report_position - record position (-p/-i/-w) being checked (record level)
+*/
+void report_position(report_t *rep, size_t current_pos){
+	if (REPORT_LEVEL < REPORT_RECORD)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"position\",\"position\":%zu}\n",current_pos) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_POSITION,current_pos,0,0,0) ;
+	else
+		fprintf(rep->out,"Record position: %zu\n", current_pos);
+	return ;
+} ;
+
+/*
+* report_invalid - invalid character found at a record position (byte level)
+*/
+void report_invalid(report_t *rep, size_t current_pos, int offset, unsigned char get_char){
+	rep->counts->byte_counts[get_char]++ ;
+	if (rep->counts->cell_counts != NULL && (size_t) offset < RECORD_SIZE)
+		rep->counts->cell_counts[(size_t) offset*256 + get_char]++ ;
+	if (REPORT_LEVEL < REPORT_BYTE)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"invalid\",\"position\":%zu,\"offset\":%d,\"old\":%u,\"new\":%u}\n",current_pos,offset,get_char,fill_value(get_char,offset)) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_INVALID,current_pos,offset,get_char,fill_value(get_char,offset)) ;
+	else
+		fprintf(rep->out,"Invalid byte %d: %c (hex: %x; dec: %u)\n",offset,get_char,get_char&0xff,get_char) ;
+	return ;
+} ;
+
+/*
+* report_position_done - end of a record position check
+* + the record level reports the number of invalid characters instead of each one
+*/
+void report_position_done(report_t *rep, size_t current_pos, size_t invalid_count){
+	if (invalid_count > 0)
+		rep->counts->dirty_records++ ;
+	rep->counts->record_counts[invalid_count]++ ;
+	if (REPORT_LEVEL != REPORT_RECORD || invalid_count == 0)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"checked\",\"position\":%zu,\"invalid\":%zu}\n",current_pos,invalid_count) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_RECORD_DONE,current_pos,invalid_count,0,0) ;
+	else
+		fprintf(rep->out,"%zu invalid characters found.\n",invalid_count) ;
+	return ;
+} ;
+
+/*
+* report_updated - record queued for write-back to the data file (record level)
+* + with --online the record may still be skipped: batch_flush_online() reports
+* what it wrote instead
+*/
+void report_updated(report_t *rep, size_t file_pos){
+	/* Offline scans (--patch-out) leave the data file as it is */
+	if (!UPDATE_FLAG || ONLINE_FLAG)
+		return ;
+	report_written(rep,file_pos) ;
+	return ;
+} ;
+
+/*
+* report_written - record written back to the data file (record level)
+*/
+void report_written(report_t *rep, size_t file_pos){
+	rep->counts->updated_records++ ;
+	if (REPORT_LEVEL < REPORT_RECORD)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"updated\",\"position\":%zu}\n",file_pos) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_UPDATED,file_pos,0,0,0) ;
+	else
+		fprintf(rep->out,"File updated.\n") ;
+	return ;
+} ;
+
+/*
+* report_skipped - record --online did not write back (record level)
+* @reason ONLINE_SKIP_LOCKED or ONLINE_SKIP_CHANGED
+*/
+void report_skipped(report_t *rep, size_t file_pos, int reason){
+	rep->counts->skipped_records++ ;
+	if (REPORT_LEVEL < REPORT_RECORD)
+		return ;
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"skipped\",\"position\":%zu,\"reason\":\"%s\"}\n",file_pos,
+			reason == ONLINE_SKIP_LOCKED ? "locked" : "changed") ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_SKIPPED,file_pos,reason,0,0) ;
+	else if (reason == ONLINE_SKIP_LOCKED)
+		fprintf(rep->out,"Record at %zu is locked, not updated.\n",file_pos) ;
+	else
+		fprintf(rep->out,"Record at %zu changed since the scan, not updated.\n",file_pos) ;
+	return ;
+} ;
+
+/*
+* report_summary - counts of the whole run (summary level)
+* + records are counted by number of invalid characters, characters by value
+*/
+void report_summary(report_t *rep, size_t invalid_count){
+	report_counts_t *counts = rep->counts ;
+	size_t i ;
+	int first ;
+
+	if (REPORT_LEVEL != REPORT_SUMMARY)
+		return ;
+
+	if (REPORT_FORMAT == FORMAT_BINARY){
+		report_binary(rep,EVENT_TOTALS,counts->dirty_records,0,0,0) ;
+		report_binary(rep,EVENT_TOTALS,counts->deleted_records,1,0,0) ;
+		report_binary(rep,EVENT_TOTALS,counts->updated_records,2,0,0) ;
+		report_binary(rep,EVENT_TOTALS,invalid_count,3,0,0) ;
+		if (ONLINE_FLAG)
+			report_binary(rep,EVENT_TOTALS,counts->skipped_records,4,0,0) ;
+		for (i=0;i<256;i++)
+			if (counts->byte_counts[i] > 0)
+				report_binary(rep,EVENT_BYTE_COUNT,counts->byte_counts[i],0,i,0) ;
+		for (i=1;i<=RECORD_SIZE;i++)
+			if (counts->record_counts[i] > 0)
+				report_binary(rep,EVENT_RECORD_COUNT,counts->record_counts[i],i,0,0) ;
+	}else if (REPORT_FORMAT == FORMAT_JSON){
+		fprintf(rep->out,"{\"event\":\"summary\",\"invalid\":%zu,\"dirty_records\":%zu,\"deleted_records\":%zu,\"updated_records\":%zu,",
+			invalid_count,counts->dirty_records,counts->deleted_records,counts->updated_records) ;
+		if (ONLINE_FLAG)
+			fprintf(rep->out,"\"skipped_records\":%zu,",counts->skipped_records) ;
+		fprintf(rep->out,"\"bytes\":{") ;
+		for (i=0,first=1;i<256;i++)
+			if (counts->byte_counts[i] > 0){
+				fprintf(rep->out,"%s\"%zu\":%zu",first ? "" : ",",i,counts->byte_counts[i]) ;
+				first = 0 ;
+			}
+		fprintf(rep->out,"},\"records\":{") ;
+		for (i=1,first=1;i<=RECORD_SIZE;i++)
+			if (counts->record_counts[i] > 0){
+				fprintf(rep->out,"%s\"%zu\":%zu",first ? "" : ",",i,counts->record_counts[i]) ;
+				first = 0 ;
+			}
+		fprintf(rep->out,"}}\n") ;
+	}else{
+		fprintf(rep->out,"Records with invalid characters: %zu\n",counts->dirty_records) ;
+		fprintf(rep->out,"Records deleted (0x00 threshold): %zu\n",counts->deleted_records) ;
+		fprintf(rep->out,"Records updated: %zu\n",counts->updated_records) ;
+		if (ONLINE_FLAG)
+			fprintf(rep->out,"Records skipped (--online): %zu\n",counts->skipped_records) ;
+		fprintf(rep->out,"Invalid characters by value:\n") ;
+		for (i=0;i<256;i++)
+			if (counts->byte_counts[i] > 0)
+				fprintf(rep->out,"\thex: %zx; dec: %zu; count: %zu\n",i,i,counts->byte_counts[i]) ;
+		fprintf(rep->out,"Records by number of invalid characters:\n") ;
+		for (i=1;i<=RECORD_SIZE;i++)
+			if (counts->record_counts[i] > 0)
+				fprintf(rep->out,"\t%zu invalid: %zu records\n",i,counts->record_counts[i]) ;
+	}
+	return ;
+} ;
+
+/*
+* write_heatmap - write where the invalid characters of the scan are (--heatmap)
+* + CSV with one "kind,offset,byte,length,count" row per non-zero count: column
+* (by offset), byte (by value), cell (by offset and value) and burst (0x00 runs
+* by length)
+* + the file is written under a temporary name and renamed when complete
+* @counts counts of the scan, merged from all threads
+* @return Heatmap could not be written
+*/
+int write_heatmap(const report_counts_t *counts){
+	char heatmap_tmp[ARRAY_SIZE + 8] ;
+	size_t offset, value, column, columns = 0, top_offset = 0, top_count = 0 ;
+	FILE *heatmap ;
+
+	if (strlen(HEATMAPFILE)==0 || counts->cell_counts == NULL)
+		return 0 ;
+	snprintf(heatmap_tmp,sizeof(heatmap_tmp),"%s.tmp",HEATMAPFILE) ;
+	if ((heatmap = fopen(heatmap_tmp,"w"))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+
+	fprintf(heatmap,"kind,offset,byte,length,count\n") ;
+	for (offset=0;offset<RECORD_SIZE;offset++){
+		for (value=0,column=0;value<256;value++)
+			column += counts->cell_counts[offset*256 + value] ;
+		if (column == 0)
+			continue ;
+		fprintf(heatmap,"column,%zu,,,%zu\n",offset,column) ;
+		columns++ ;
+		if (column > top_count){
+			top_count = column ;
+			top_offset = offset ;
+		}
+	}
+	for (value=0;value<256;value++)
+		if (counts->byte_counts[value] > 0)
+			fprintf(heatmap,"byte,,%zu,,%zu\n",value,counts->byte_counts[value]) ;
+	for (offset=0;offset<RECORD_SIZE;offset++)
+		for (value=0;value<256;value++)
+			if (counts->cell_counts[offset*256 + value] > 0)
+				fprintf(heatmap,"cell,%zu,%zu,,%zu\n",offset,value,counts->cell_counts[offset*256 + value]) ;
+	for (offset=1;offset<=RECORD_SIZE;offset++)
+		if (counts->burst_counts[offset] > 0)
+			fprintf(heatmap,"burst,,,%zu,%zu\n",offset,counts->burst_counts[offset]) ;
+
+	if (fclose(heatmap)!=0 || rename(heatmap_tmp,HEATMAPFILE)!=0){
+		perror("ERROR") ;
+		unlink(heatmap_tmp) ;
+		return 1 ;
+	}
+	if (columns > 0)
+		message("Heatmap: invalid characters in %zu columns, most at offset %zu (%zu). Written to %s\n",columns,top_offset,top_count,HEATMAPFILE) ;
+	else
+		message("Heatmap: no invalid characters. Written to %s\n",HEATMAPFILE) ;
+	return 0 ;
+} ;
+
+/*
+* byte_invalid - scalar invalid character check
+* + the record divider (0xFA or 0x0A) is only valid as the last byte of a record
+* @get_char byte to check
+* @i offset of the byte within its record
+* @return Byte is an invalid character
+*/
+int byte_invalid(unsigned char get_char, size_t i){
+	/* Field-aware check when a definition is loaded (record divider excluded) */
+	if (COLUMN_CLASS != NULL && i != RECORD_SIZE - 1)
+		return !CLASS_VALID[COLUMN_CLASS[i]][get_char] ;
+/* Removing this line of code since we will run ITEST after hex-zero detection, which would delete 0xFF filled records..
+	if ((get_char<VALID_START || get_char>VALID_END)&&(get_char != END_OF_RECORD && get_char != NULL_FILL_VALUE)){
+*/
+	return !TRANSLATE_VALID[get_char] && ((get_char != END_OF_RECORD && get_char != END_OF_RECORD_CR)||((get_char == END_OF_RECORD || get_char == END_OF_RECORD_CR) && i != (RECORD_SIZE - 1))) ;
+} ;
+
+/*
+* fill_value - replacement for an invalid character at offset i
+* + numeric fields (-D) take their class fill, everything else goes through the
+* translation table
+* + a date field keeps the character: no single digit turns it into a valid
+* date, so it is only reported
+*/
+unsigned char fill_value(unsigned char get_char, size_t i){
+	if (COLUMN_CLASS != NULL && COLUMN_CLASS[i] == FIELD_DATE)
+		return get_char ;
+	if (COLUMN_CLASS != NULL && COLUMN_CLASS[i] != FIELD_ALPHA)
+		return COLUMN_FILL[i] ;
+	return TRANSLATE[get_char] ;
+} ;
+
+/*
+* classify_block_scalar - flag the records of a block that contain invalid characters
+* @base first record of the block
+* @nrec number of records in the block
+* @dirty one flag per record, set if the record has any invalid character
+* @return Number of dirty records in the block
+*/
+size_t classify_block_scalar(const char *base, size_t nrec, unsigned char *dirty){
+	size_t r, i, dirty_count = 0 ;
+	const unsigned char *rec ;
+
+	for (r=0;r<nrec;r++){
+		rec = (const unsigned char*) base + r*RECORD_SIZE ;
+		dirty[r] = 0 ;
+		for (i=0;i<RECORD_SIZE && !dirty[r];i++)
+			dirty[r] = byte_invalid(rec[i],i) ;
+		dirty_count += dirty[r] ;
+	}
+	return dirty_count ;
+} ;
+
+/*
+* invalid_bitmap_scalar - bitmap of the invalid characters of a record
+* @rec record to check
+* @bits one bit per byte of the record ((RECORD_SIZE+63)/64 words)
+*/
+void invalid_bitmap_scalar(const char *rec, uint64_t *bits){
+	size_t i ;
+
+	memset(bits,0,((RECORD_SIZE+63)/64)*sizeof(uint64_t)) ;
+	for (i=0;i<RECORD_SIZE;i++)
+		if (byte_invalid((unsigned char) rec[i],i))
+			bits[i>>6] |= (uint64_t) 1 << (i&63) ;
+	return ;
+} ;
+
+/*
+* find_terminator_scalar - offset of the first record divider (0xFA or 0x0A)
+* @p bytes to search
+* @n number of bytes to search
+* @return Offset of the first divider, or n if there is none
+*/
+size_t find_terminator_scalar(const char *p, size_t n){
+	size_t i ;
+
+	for (i=0;i<n;i++)
+		if ((unsigned char) p[i]==END_OF_RECORD || (unsigned char) p[i]==END_OF_RECORD_CR)
+			break ;
+	return i ;
+} ;
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+* The vector kernels test VALID_START..VALID_END with one unsigned saturating
+* subtract: (c - VALID_START) - (VALID_END - VALID_START) is non-zero only for bytes
+* outside the range. The last byte of each record is left to byte_invalid() so that
+* the record divider exception stays in one place.
+*/
+
+/*
+* classify_block_sse2 - SSE2 version of classify_block_scalar
+*/
+__attribute__((target("sse2")))
+size_t classify_block_sse2(const char *base, size_t nrec, unsigned char *dirty){
+	const __m128i start = _mm_set1_epi8((char) VALID_START) ;
+	const __m128i range = _mm_set1_epi8((char) (VALID_END - VALID_START)) ;
+	size_t r, i, body = RECORD_SIZE - 1, dirty_count = 0 ;
+	const char *rec ;
+	__m128i acc ;
+
+	if (body < 16)
+		return classify_block_scalar(base,nrec,dirty) ;
+
+	for (r=0;r<nrec;r++){
+		rec = base + r*RECORD_SIZE ;
+		acc = _mm_setzero_si128() ;
+		for (i=0;i+16<=body;i+=16)
+			acc = _mm_or_si128(acc,_mm_subs_epu8(_mm_sub_epi8(_mm_loadu_si128((const __m128i*)(rec + i)),start),range)) ;
+		/* Overlapping load covers the bytes left before the record divider */
+		if (i<body)
+			acc = _mm_or_si128(acc,_mm_subs_epu8(_mm_sub_epi8(_mm_loadu_si128((const __m128i*)(rec + body - 16)),start),range)) ;
+		dirty[r] = _mm_movemask_epi8(_mm_cmpeq_epi8(acc,_mm_setzero_si128()))!=0xFFFF || byte_invalid((unsigned char) rec[body],body) ;
+		dirty_count += dirty[r] ;
+	}
+	return dirty_count ;
+} ;
+
+/*
+* classify_block_avx2 - AVX2 version of classify_block_scalar
+*/
+__attribute__((target("avx2")))
+size_t classify_block_avx2(const char *base, size_t nrec, unsigned char *dirty){
+	const __m256i start = _mm256_set1_epi8((char) VALID_START) ;
+	const __m256i range = _mm256_set1_epi8((char) (VALID_END - VALID_START)) ;
+	size_t r, i, body = RECORD_SIZE - 1, dirty_count = 0 ;
+	const char *rec ;
+	__m256i acc ;
+
+	if (body < 32)
+		return classify_block_sse2(base,nrec,dirty) ;
+
+	for (r=0;r<nrec;r++){
+		rec = base + r*RECORD_SIZE ;
+		acc = _mm256_setzero_si256() ;
+		for (i=0;i+32<=body;i+=32)
+			acc = _mm256_or_si256(acc,_mm256_subs_epu8(_mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(rec + i)),start),range)) ;
+		if (i<body)
+			acc = _mm256_or_si256(acc,_mm256_subs_epu8(_mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(rec + body - 32)),start),range)) ;
+		dirty[r] = !_mm256_testz_si256(acc,acc) || byte_invalid((unsigned char) rec[body],body) ;
+		dirty_count += dirty[r] ;
+	}
+	return dirty_count ;
+} ;
+
+/*
+* invalid_bitmap_sse2 - SSE2 version of invalid_bitmap_scalar
+*/
+__attribute__((target("sse2")))
+void invalid_bitmap_sse2(const char *rec, uint64_t *bits){
+	const __m128i start = _mm_set1_epi8((char) VALID_START) ;
+	const __m128i range = _mm_set1_epi8((char) (VALID_END - VALID_START)) ;
+	size_t i, last = RECORD_SIZE - 1 ;
+	unsigned int mask ;
+
+	memset(bits,0,((RECORD_SIZE+63)/64)*sizeof(uint64_t)) ;
+	for (i=0;i+16<=RECORD_SIZE;i+=16){
+		mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(_mm_sub_epi8(_mm_loadu_si128((const __m128i*)(rec + i)),start),range),_mm_setzero_si128())) & 0xFFFF ;
+		bits[i>>6] |= (uint64_t) mask << (i&63) ;
+	}
+	for (;i<RECORD_SIZE;i++)
+		if ((unsigned char) rec[i]<VALID_START || (unsigned char) rec[i]>VALID_END)
+			bits[i>>6] |= (uint64_t) 1 << (i&63) ;
+	if (!byte_invalid((unsigned char) rec[last],last))
+		bits[last>>6] &= ~((uint64_t) 1 << (last&63)) ;
+	return ;
+} ;
+
+/*
+* find_terminator_sse2 - SSE2 version of find_terminator_scalar
+*/
+__attribute__((target("sse2")))
+size_t find_terminator_sse2(const char *p, size_t n){
+	const __m128i eor = _mm_set1_epi8((char) END_OF_RECORD) ;
+	const __m128i eor_cr = _mm_set1_epi8((char) END_OF_RECORD_CR) ;
+	size_t i ;
+	unsigned int mask ;
+	__m128i v ;
+
+	for (i=0;i+16<=n;i+=16){
+		v = _mm_loadu_si128((const __m128i*)(p + i)) ;
+		if ((mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v,eor),_mm_cmpeq_epi8(v,eor_cr))))!=0)
+			return i + __builtin_ctz(mask) ;
+	}
+	return i + find_terminator_scalar(p + i,n - i) ;
+} ;
+
+/*
+* find_terminator_avx2 - AVX2 version of find_terminator_scalar
+*/
+__attribute__((target("avx2")))
+size_t find_terminator_avx2(const char *p, size_t n){
+	const __m256i eor = _mm256_set1_epi8((char) END_OF_RECORD) ;
+	const __m256i eor_cr = _mm256_set1_epi8((char) END_OF_RECORD_CR) ;
+	size_t i ;
+	unsigned int mask ;
+	__m256i v ;
+
+	for (i=0;i+32<=n;i+=32){
+		v = _mm256_loadu_si256((const __m256i*)(p + i)) ;
+		if ((mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v,eor),_mm256_cmpeq_epi8(v,eor_cr))))!=0)
+			return i + __builtin_ctz(mask) ;
+	}
+	return i + find_terminator_sse2(p + i,n - i) ;
+} ;
+
+/*
+* The field kernels look every byte up in the validity table of its column's
+* class: the low nibble selects a CLASS_NIBBLES entry (pshufb, second half for
+* bytes from 0x80), the high nibble selects the bit in it. Every class in the
+* layout is looked up and the column masks keep the one that applies, so a record
+* costs the same whatever its layout.
+*/
+
+/*
+* invalid_fields_ssse3 - 0xFF for every byte of 16 that is invalid in its column
+* @v 16 bytes of a record
+* @col offset of the first byte in the record
+*/
+__attribute__((target("ssse3")))
+static inline __m128i invalid_fields_ssse3(__m128i v, size_t col){
+	const __m128i nibble = _mm_set1_epi8(0x0F) ;
+	const __m128i high_bits = _mm_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128) ;
+	__m128i lo = _mm_and_si128(v,nibble), hi = _mm_and_si128(_mm_srli_epi16(v,4),nibble), valid = _mm_setzero_si128() ;
+	__m128i upper = _mm_cmplt_epi8(v,_mm_setzero_si128()), row ;
+	int k ;
+
+	for (k=0;k<FIELD_CLASSES;k++){
+		if (!(CLASSES_USED & (1 << k)))
+			continue ;
+		row = _mm_or_si128(_mm_andnot_si128(upper,_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*) CLASS_NIBBLES[k]),lo)),
+			_mm_and_si128(upper,_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(CLASS_NIBBLES[k] + 16)),lo))) ;
+		valid = _mm_or_si128(valid,_mm_and_si128(row,_mm_loadu_si128((const __m128i*)(COLUMN_MASK + k*RECORD_SIZE + col)))) ;
+	}
+	return _mm_cmpeq_epi8(_mm_and_si128(valid,_mm_shuffle_epi8(high_bits,hi)),_mm_setzero_si128()) ;
+} ;
+
+/*
+* classify_block_fields_ssse3 - SSSE3 field-aware version of classify_block_scalar
+*/
+__attribute__((target("ssse3")))
+size_t classify_block_fields_ssse3(const char *base, size_t nrec, unsigned char *dirty){
+	size_t r, i, body = RECORD_SIZE - 1, dirty_count = 0 ;
+	const char *rec ;
+	__m128i acc ;
+
+	if (body < 16)
+		return classify_block_scalar(base,nrec,dirty) ;
+
+	for (r=0;r<nrec;r++){
+		rec = base + r*RECORD_SIZE ;
+		acc = _mm_setzero_si128() ;
+		for (i=0;i+16<=body;i+=16)
+			acc = _mm_or_si128(acc,invalid_fields_ssse3(_mm_loadu_si128((const __m128i*)(rec + i)),i)) ;
+		if (i<body)
+			acc = _mm_or_si128(acc,invalid_fields_ssse3(_mm_loadu_si128((const __m128i*)(rec + body - 16)),body - 16)) ;
+		dirty[r] = _mm_movemask_epi8(acc)!=0 || byte_invalid((unsigned char) rec[body],body) ;
+		dirty_count += dirty[r] ;
+	}
+	return dirty_count ;
+} ;
+
+/*
+* invalid_bitmap_fields_ssse3 - SSSE3 field-aware version of invalid_bitmap_scalar
+*/
+__attribute__((target("ssse3")))
+void invalid_bitmap_fields_ssse3(const char *rec, uint64_t *bits){
+	size_t i, body = RECORD_SIZE - 1 ;
+
+	memset(bits,0,((RECORD_SIZE+63)/64)*sizeof(uint64_t)) ;
+	for (i=0;i+16<=body;i+=16)
+		bits[i>>6] |= (uint64_t) (_mm_movemask_epi8(invalid_fields_ssse3(_mm_loadu_si128((const __m128i*)(rec + i)),i)) & 0xFFFF) << (i&63) ;
+	for (;i<RECORD_SIZE;i++)
+		if (byte_invalid((unsigned char) rec[i],i))
+			bits[i>>6] |= (uint64_t) 1 << (i&63) ;
+	return ;
+} ;
+
+/*
+* classify_block_fields_avx2 - AVX2 field-aware version of classify_block_scalar
+*/
+__attribute__((target("avx2")))
+size_t classify_block_fields_avx2(const char *base, size_t nrec, unsigned char *dirty){
+	const __m256i nibble = _mm256_set1_epi8(0x0F) ;
+	const __m256i high_bits = _mm256_setr_epi8(1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128,1,2,4,8,16,32,64,-128) ;
+	__m256i tables[FIELD_CLASSES], upper_tables[FIELD_CLASSES], v, lo, upper, valid, acc ;
+	size_t r, i, col, body = RECORD_SIZE - 1, dirty_count = 0 ;
+	const char *rec ;
+	int k ;
+
+	if (body < 32)
+		return classify_block_fields_ssse3(base,nrec,dirty) ;
+	for (k=0;k<FIELD_CLASSES;k++){
+		tables[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*) CLASS_NIBBLES[k])) ;
+		upper_tables[k] = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(CLASS_NIBBLES[k] + 16))) ;
+	}
+
+	for (r=0;r<nrec;r++){
+		rec = base + r*RECORD_SIZE ;
+		acc = _mm256_setzero_si256() ;
+		for (i=0;i<body;i+=32){
+			/* Overlapping load covers the bytes left before the record divider */
+			col = i+32<=body ? i : body - 32 ;
+			v = _mm256_loadu_si256((const __m256i*)(rec + col)) ;
+			lo = _mm256_and_si256(v,nibble) ;
+			upper = _mm256_cmpgt_epi8(_mm256_setzero_si256(),v) ;
+			valid = _mm256_setzero_si256() ;
+			for (k=0;k<FIELD_CLASSES;k++){
+				if (!(CLASSES_USED & (1 << k)))
+					continue ;
+				valid = _mm256_or_si256(valid,_mm256_and_si256(_mm256_blendv_epi8(_mm256_shuffle_epi8(tables[k],lo),_mm256_shuffle_epi8(upper_tables[k],lo),upper),
+					_mm256_loadu_si256((const __m256i*)(COLUMN_MASK + k*RECORD_SIZE + col)))) ;
+			}
+			valid = _mm256_and_si256(valid,_mm256_shuffle_epi8(high_bits,_mm256_and_si256(_mm256_srli_epi16(v,4),nibble))) ;
+			acc = _mm256_or_si256(acc,_mm256_cmpeq_epi8(valid,_mm256_setzero_si256())) ;
+		}
+		dirty[r] = !_mm256_testz_si256(acc,acc) || byte_invalid((unsigned char) rec[body],body) ;
+		dirty_count += dirty[r] ;
+	}
+	return dirty_count ;
+} ;
+#endif
+
+/*
+* set_definition - set the data file definition (XXXDEF.TXT)
+* + the record size comes from the definition unless -l is given
+* @return Definition successfully loaded
+*/
+int set_definition(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&DEFFILE,param,param_size*sizeof(char)) ;
+	DEFFILE[param_size] = '\0' ;
+	message("Definition file: %s\n",DEFFILE) ;
+	if (load_definition(DEFFILE)!=0)
+		return 1 ;
+	if (RECORD_SIZE==0){
+		RECORD_SIZE = DEFINITION_SIZE ;
+		message("Setting record size to: %zu\n",RECORD_SIZE) ;
+	}
+	return 0 ;
+} ;
+
+/*
+* load_definition - read the field layout of a DB/C data file definition
+* + one field per line: name, type and size. DIM (or A) is alpha, FORM (or N)
+* is numeric with size n or n.m (n.m takes n+m+1 columns), DATE (or D) is a date
+* + fields are laid out one after the other from column 0, the record divider
+* follows the last field
+* + blank lines, comments ('.', '*', '#') and lines without a size (LIST,
+* LISTEND, ...) are skipped
+* @path definition file
+* @return Error reading the definition
+*/
+int load_definition(const char *path){
+	FILE *def_file ;
+	char line[ARRAY_SIZE], name[ARRAY_SIZE], type[ARRAY_SIZE], size[ARRAY_SIZE], *point ;
+	size_t offset = 0, capacity = ARRAY_SIZE, length, line_number = 0 ;
+	field_t *grown ;
+	unsigned char class ;
+	int ret_val = 0 ;
+
+	if ((def_file = fopen(path,"r"))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	free(FIELDS) ;
+	FIELD_COUNT = 0 ;
+	if ((FIELDS = malloc(capacity*sizeof(field_t)))==NULL){
+		perror("ERROR") ;
+		fclose(def_file) ;
+		return 1 ;
+	}
+
+	while (ret_val==0 && fgets(line,sizeof(line),def_file)!=NULL){
+		line_number++ ;
+		if (line[0]=='.' || line[0]=='*' || line[0]=='#')
+			continue ;
+		if (sscanf(line,"%1023s %1023s %1023s",name,type,size)!=3 || size[0]<'0' || size[0]>'9')
+			continue ;
+
+		length = (size_t) strtoll(size,&point,10) ;
+		if (strcasecmp(type,"DIM")==0 || strcasecmp(type,"A")==0)
+			class = FIELD_ALPHA ;
+		else if (strcasecmp(type,"FORM")==0 || strcasecmp(type,"N")==0){
+			class = FIELD_NUMERIC ;
+			if (*point=='.' && strtoll(point + 1,NULL,10) > 0)
+				length += (size_t) strtoll(point + 1,NULL,10) + 1 ;
+		}else if (strcasecmp(type,"DATE")==0 || strcasecmp(type,"D")==0)
+			class = FIELD_DATE ;
+		else{
+			message("Definition line %zu: unknown field type %s, checked as alpha.\n",line_number,type) ;
+			class = FIELD_ALPHA ;
+		}
+		if (length == 0)
+			continue ;
+
+		if (FIELD_COUNT == capacity){
+			capacity *= 2 ;
+			if ((grown = realloc(FIELDS,capacity*sizeof(field_t)))==NULL){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			FIELDS = grown ;
+		}
+		FIELDS[FIELD_COUNT].offset = offset ;
+		FIELDS[FIELD_COUNT].length = length ;
+		FIELDS[FIELD_COUNT].class = class ;
+		FIELD_COUNT++ ;
+		offset += length ;
+	}
+	fclose(def_file) ;
+
+	if (ret_val==0 && FIELD_COUNT==0){
+		message("Definition %s has no fields.\n",path) ;
+		ret_val = 1 ;
+	}
+	DEFINITION_SIZE = ret_val==0 ? offset + 1 : 0 ;
+	if (VERBOSE_FLAG && ret_val==0)
+		message("Definition: %zu fields; record size: %zu\n",FIELD_COUNT,DEFINITION_SIZE) ;
+	return ret_val ;
+} ;
+
+/*
+* init_fields - build the per-column validation and fill tables for RECORD_SIZE
+* from the loaded definition (-D) and translation table (-T)
+* + built once per data file, before the classifier is selected
+* + without a definition every column is alpha, which only needs the tables
+* when the translation table is not the plain VALID_START..VALID_END range
+* @return Error building the tables
+*/
+int init_fields( void ){
+	size_t f, i ;
+	unsigned int c ;
+	int k ;
+
+	free(COLUMN_CLASS) ;
+	free(COLUMN_MASK) ;
+	free(COLUMN_FILL) ;
+	COLUMN_CLASS = COLUMN_MASK = COLUMN_FILL = NULL ;
+	CLASSES_USED = 0 ;
+	if (FIELD_COUNT==0 && !TRANSLATE_CUSTOM)
+		return 0 ;
+	if (FIELD_COUNT > 0 && DEFINITION_SIZE != RECORD_SIZE)
+		message("WARNING: Record size %zu does not match the definition (%zu).\n",RECORD_SIZE,DEFINITION_SIZE) ;
+
+	memset(CLASS_VALID,0,sizeof(CLASS_VALID)) ;
+	memcpy(CLASS_VALID[FIELD_ALPHA],TRANSLATE_VALID,sizeof(TRANSLATE_VALID)) ;
+	for (c='0';c<='9';c++)
+		CLASS_VALID[FIELD_NUMERIC][c] = CLASS_VALID[FIELD_DATE][c] = 1 ;
+	CLASS_VALID[FIELD_NUMERIC][' '] = CLASS_VALID[FIELD_NUMERIC]['-'] = CLASS_VALID[FIELD_NUMERIC]['+'] = CLASS_VALID[FIELD_NUMERIC]['.'] = 1 ;
+	CLASS_VALID[FIELD_DATE][' '] = 1 ;
+	CLASS_FILL[FIELD_ALPHA] = FILL_VALUE ;
+	CLASS_FILL[FIELD_NUMERIC] = '0' ;
+	CLASS_FILL[FIELD_DATE] = 0 ;	// not used, see fill_value()
+
+	memset(CLASS_NIBBLES,0,sizeof(CLASS_NIBBLES)) ;
+	for (k=0;k<FIELD_CLASSES;k++)
+		for (c=0;c<256;c++)
+			if (CLASS_VALID[k][c])
+				CLASS_NIBBLES[k][(c&0x0F) + (c>=0x80 ? 16 : 0)] |= 1 << ((c>>4)&7) ;
+
+	if ((COLUMN_CLASS = calloc(RECORD_SIZE,sizeof(unsigned char)))==NULL || (COLUMN_FILL = malloc(RECORD_SIZE))==NULL ||
+		(COLUMN_MASK = calloc(FIELD_CLASSES*RECORD_SIZE,sizeof(unsigned char)))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	for (f=0;f<FIELD_COUNT;f++)
+		for (i=FIELDS[f].offset;i<FIELDS[f].offset + FIELDS[f].length && i<RECORD_SIZE;i++)
+			COLUMN_CLASS[i] = FIELDS[f].class ;
+	for (i=0;i<RECORD_SIZE;i++){
+		COLUMN_MASK[COLUMN_CLASS[i]*RECORD_SIZE + i] = 0xFF ;
+		CLASSES_USED |= 1 << COLUMN_CLASS[i] ;
+		COLUMN_FILL[i] = CLASS_FILL[COLUMN_CLASS[i]] ;
+	}
+	return 0 ;
+} ;
+
+/*
+* set_translation - set the byte translation table (-T)
+* + default, latin1 or cp1252, anything else is read as a map file
+* @return Translation table successfully set
+*/
+int set_translation(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&TRANSLATION,param,param_size*sizeof(char)) ;
+	TRANSLATION[param_size] = '\0' ;
+	message("Translation table: %s\n",TRANSLATION) ;
+	return 0 ;
+} ;
+
+/*
+* translate_fold - add a list of folded bytes to the translation table
+*/
+void translate_fold(const translation_t *fold, size_t count){
+	size_t f ;
+
+	for (f=0;f<count;f++){
+		TRANSLATE_VALID[fold[f].from] = 0 ;
+		TRANSLATE[fold[f].from] = fold[f].to ;
+	}
+	return ;
+} ;
+
+/*
+* parse_translation_byte - byte of a map file line: 0x hex, decimal or a single
+* character
+* @return Token is not a byte
+*/
+int parse_translation_byte(const char *token, unsigned char *value){
+	char *end ;
+	long parsed ;
+
+	if (strlen(token)==1 && (token[0]<'0' || token[0]>'9')){
+		*value = (unsigned char) token[0] ;
+		return 0 ;
+	}
+	parsed = strtol(token,&end,0) ;
+	if (*end!='\0' || parsed<0 || parsed>255)
+		return 1 ;
+	*value = (unsigned char) parsed ;
+	return 0 ;
+} ;
+
+/*
+* init_translation - build the 256-entry validity and translation tables
+* + the default preset is the classic check: VALID_START..VALID_END are kept,
+* everything else becomes FILL_VALUE (0x00 becomes NULL_FILL_VALUE in -x)
+* + latin1 also folds accented letters to ASCII and tab to space, cp1252 adds
+* smart quotes, dashes and the 0x80-0x9F letters
+* + a map file starts from a preset ("preset name" line, default otherwise)
+* followed by "from to" lines, to being "keep" for a byte that is valid as is.
+* A target must be the fill or valid once the map is read, never 0x00 or a
+* record divider
+* @return Error building the tables
+*/
+int init_translation( void ){
+	FILE *map_file = NULL ;
+	char line[ARRAY_SIZE], from_token[ARRAY_SIZE], to_token[ARRAY_SIZE], *preset = TRANSLATION, *comment ;
+	unsigned char from, to ;
+	unsigned int c ;
+	size_t line_number = 0, target_line[256] ;
+	int ret_val = 0 ;
+
+	if (strcmp(TRANSLATION,"default")!=0 && strcmp(TRANSLATION,"latin1")!=0 && strcmp(TRANSLATION,"cp1252")!=0){
+		if ((map_file = fopen(TRANSLATION,"r"))==NULL){
+			perror("ERROR") ;
+			return 1 ;
+		}
+		preset = "default" ;
+	}
+
+	for (c=0;c<256;c++){
+		TRANSLATE_VALID[c] = c>=VALID_START && c<=VALID_END ;
+		TRANSLATE[c] = TRANSLATE_VALID[c] ? c : FILL_VALUE ;
+		target_line[c] = 0 ;
+	}
+	if (map_file != NULL && fgets(line,sizeof(line),map_file)!=NULL){
+		line_number++ ;
+		if (sscanf(line,"preset %1023s",from_token)==1){
+			if (strcmp(from_token,"default")==0)
+				preset = "default" ;
+			else if (strcmp(from_token,"latin1")==0)
+				preset = "latin1" ;
+			else if (strcmp(from_token,"cp1252")==0)
+				preset = "cp1252" ;
+			else{
+				message("Translation map line %zu: unknown preset %s.\n",line_number,from_token) ;
+				ret_val = 1 ;
+			}
+		}else{
+			rewind(map_file) ;
+			line_number = 0 ;
+		}
+	}
+	if (strcmp(preset,"latin1")==0 || strcmp(preset,"cp1252")==0)
+		translate_fold(LATIN1_FOLD,sizeof(LATIN1_FOLD)/sizeof(translation_t)) ;
+	if (strcmp(preset,"cp1252")==0)
+		translate_fold(CP1252_FOLD,sizeof(CP1252_FOLD)/sizeof(translation_t)) ;
+
+	while (map_file != NULL && fgets(line,sizeof(line),map_file)!=NULL){
+		line_number++ ;
+		if ((comment = strchr(line,'#'))!=NULL && comment==line)
+			continue ;
+		if (sscanf(line,"%1023s %1023s",from_token,to_token)!=2)
+			continue ;
+		if (parse_translation_byte(from_token,&from)!=0 ||
+			(strcmp(to_token,"keep")!=0 && parse_translation_byte(to_token,&to)!=0)){
+			message("Translation map line %zu is invalid.\n",line_number) ;
+			ret_val = 1 ;
+			continue ;
+		}
+		if (strcmp(to_token,"keep")==0){
+			TRANSLATE_VALID[from] = 1 ;
+			TRANSLATE[from] = from ;
+			target_line[from] = 0 ;
+		}else{
+			TRANSLATE_VALID[from] = 0 ;
+			TRANSLATE[from] = to ;
+			target_line[from] = line_number ;
+		}
+	}
+	if (map_file != NULL)
+		fclose(map_file) ;
+
+	/* Targets are checked once every "keep" line is known */
+	for (c=0;c<256;c++){
+		to = TRANSLATE[c] ;
+		if (target_line[c] == 0 || (to != FILL_VALUE && TRANSLATE_VALID[to] &&
+			to != NULL_VALUE && to != END_OF_RECORD && to != END_OF_RECORD_CR))
+			continue ;
+		message("Translation map line %zu: target 0x%02x is not a valid character.\n",target_line[c],to) ;
+		ret_val = 1 ;
+	}
+
+	/* The record divider keeps its own rule in byte_invalid() */
+	for (c=0,TRANSLATE_CUSTOM=0;c<256;c++)
+		if (TRANSLATE_VALID[c] != (c>=VALID_START && c<=VALID_END))
+			TRANSLATE_CUSTOM = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* init_classifier - select the byte classification kernels for this CPU
+* + AVX2 is chosen at runtime, SSE2 is the x86 baseline
+* + a loaded definition (-D) selects the field-aware kernels (SSSE3/AVX2)
+*/
+void init_classifier( void ){
+	const char *kernel = "scalar" ;
+
+	CTX->classify_block = classify_block_scalar ;
+	CTX->invalid_bitmap = invalid_bitmap_scalar ;
+	CTX->find_terminator = find_terminator_scalar ;
+	if (COLUMN_CLASS != NULL){
+		/* Field-aware kernels (-D) */
+#if defined(__x86_64__) || defined(__i386__)
+		__builtin_cpu_init() ;
+		if (__builtin_cpu_supports("sse2"))
+			CTX->find_terminator = find_terminator_sse2 ;
+		if (__builtin_cpu_supports("ssse3")){
+			CTX->classify_block = classify_block_fields_ssse3 ;
+			CTX->invalid_bitmap = invalid_bitmap_fields_ssse3 ;
+			kernel = "fields, SSSE3" ;
+		}
+		if (__builtin_cpu_supports("avx2")){
+			CTX->classify_block = classify_block_fields_avx2 ;
+			CTX->find_terminator = find_terminator_avx2 ;
+			kernel = "fields, AVX2" ;
+		}
+#endif
+		if (VERBOSE_FLAG)
+			message("Byte classifier: %s\n",kernel) ;
+		return ;
+	}
+
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init() ;
+	if (__builtin_cpu_supports("sse2")){
+		CTX->classify_block = classify_block_sse2 ;
+		CTX->invalid_bitmap = invalid_bitmap_sse2 ;
+		CTX->find_terminator = find_terminator_sse2 ;
+		kernel = "SSE2" ;
+	}
+	if (__builtin_cpu_supports("avx2")){
+		CTX->classify_block = classify_block_avx2 ;
+		CTX->find_terminator = find_terminator_avx2 ;
+		kernel = "AVX2" ;
+	}
+#endif
+	if (VERBOSE_FLAG)
+		message("Byte classifier: %s\n",kernel) ;
+	return ;
+} ;
+
+/*
+* stride_score - share of the sampled records that end in a record divider at a
+* given record size
+* @samples sampled blocks, DETECT_BLOCK bytes apart
+* @offsets position of each block in the data file
+* @sizes bytes in each block
+* @count number of blocks
+* @stride record size to check
+* @records set to the number of records checked
+* @return Share of the records checked that end in a divider (0..1)
+*/
+double stride_score(const char *samples, const size_t *offsets, const size_t *sizes, size_t count, size_t stride, size_t *records){
+	size_t s, end, matched = 0 ;
+	unsigned char c ;
+
+	*records = 0 ;
+	for (s=0;s<count;s++){
+		/* Last byte of the first record that ends inside the block */
+		for (end=offsets[s]/stride*stride + stride - 1;end < offsets[s] + sizes[s];end += stride){
+			c = (unsigned char) samples[s*DETECT_BLOCK + end - offsets[s]] ;
+			matched += c == END_OF_RECORD || c == END_OF_RECORD_CR ;
+			(*records)++ ;
+		}
+	}
+	return *records > 0 ? (double) matched/(double) *records : 0.0 ;
+} ;
+
+/*
+* detect_record_size - find the record size of a data file from the spacing of
+* its record dividers (-l auto)
+* + DETECT_SAMPLES blocks spread over the file are searched for dividers with the
+* vectorized find_terminator(); the most frequent distance between dividers is
+* the candidate record size
+* + confidence is the share of the sampled records that end in a divider at that
+* size. With -w records are found by their dividers, so the share of distances
+* equal to that size is used instead. The size is ambiguous when the confidence is below DETECT_CONFIDENCE or
+* another frequent distance (not a multiple) fits as well
+* + an ambiguous size is refused in update mode, reports go ahead with a warning
+* @path data file
+* @return Error encountered, no record size found or ambiguous in update mode
+*/
+int detect_record_size(const char *path){
+	char *samples ;
+	uint32_t *gaps ;
+	size_t offsets[DETECT_SAMPLES], sizes[DETECT_SAMPLES], file_size, count, s, pos, term, last, gap ;
+	size_t best = 0, other = 0, records, other_records, gap_count = 0 ;
+	double confidence, other_confidence = 0.0, score ;
+	struct stat file_stat ;
+	ssize_t n ;
+	int fd, ambiguous ;
+
+	if (CTX->find_terminator == NULL)
+		init_classifier() ;
+	if ((fd = open(path,O_RDONLY))<0 || fstat(fd,&file_stat)!=0){
+		perror("ERROR") ;
+		if (fd >= 0)
+			close(fd) ;
+		return 1 ;
+	}
+	file_size = (size_t) file_stat.st_size ;
+	samples = malloc(DETECT_SAMPLES*DETECT_BLOCK) ;
+	gaps = calloc(DETECT_BLOCK + 1,sizeof(uint32_t)) ;
+	if (samples == NULL || gaps == NULL){
+		perror("ERROR") ;
+		free(samples) ;
+		free(gaps) ;
+		close(fd) ;
+		return 1 ;
+	}
+
+	/* Evenly spread blocks, the whole file when it is small */
+	count = file_size <= DETECT_SAMPLES*DETECT_BLOCK ? (file_size + DETECT_BLOCK - 1)/DETECT_BLOCK : DETECT_SAMPLES ;
+	for (s=0;s<count;s++){
+		offsets[s] = count > 1 && file_size > DETECT_SAMPLES*DETECT_BLOCK ? (file_size - DETECT_BLOCK)/(count - 1)*s : s*DETECT_BLOCK ;
+		sizes[s] = file_size - offsets[s] < DETECT_BLOCK ? file_size - offsets[s] : DETECT_BLOCK ;
+		STATS_ADD(read_calls,1) ;
+		if ((n = pread(fd,samples + s*DETECT_BLOCK,sizes[s],offsets[s])) < 0){
+			perror("READ ERROR") ;
+			count = 0 ;
+			break ;
+		}
+		sizes[s] = (size_t) n ;
+
+		/* Distances between the dividers of the block */
+		for (pos=0,last=(size_t) -1;pos<sizes[s];pos=term + 1){
+			term = pos + CTX->find_terminator(samples + s*DETECT_BLOCK + pos,sizes[s] - pos) ;
+			if (term >= sizes[s])
+				break ;
+			if (last != (size_t) -1)
+				gaps[term - last]++ ;
+			last = term ;
+		}
+	}
+	close(fd) ;
+
+	for (gap=2;gap<=DETECT_BLOCK;gap++){
+		gap_count += gaps[gap] ;
+		if (gaps[gap] > gaps[best])
+			best = gap ;
+	}
+	confidence = best > 0 ? stride_score(samples,offsets,sizes,count,best,&records) : 0.0 ;
+	if (best > 0 && WRONG_LENGTH_FLAG)
+		confidence = (double) gaps[best]/(double) gap_count ;
+	/* A second frequent distance that fits as well leaves the choice open */
+	for (gap=2;best > 0 && gap<=DETECT_BLOCK;gap++){
+		if (gap == best || gap%best == 0 || gaps[gap] < gaps[best]/10 || gaps[gap] == 0)
+			continue ;
+		if ((score = stride_score(samples,offsets,sizes,count,gap,&other_records)) > other_confidence){
+			other_confidence = score ;
+			other = gap ;
+		}
+	}
+	free(samples) ;
+	free(gaps) ;
+
+	if (best == 0){
+		message("No record dividers found in %s, use -l length.\n",path) ;
+		return 1 ;
+	}
+	ambiguous = confidence < DETECT_CONFIDENCE || records < DETECT_MIN_RECORDS || other_confidence >= DETECT_CONFIDENCE ;
+	message("Detected record size: %zu (confidence %.1f%%, %zu records sampled)\n",best,confidence*100.0,records) ;
+	if (other > 0 && VERBOSE_FLAG)
+		message("Next candidate: %zu (confidence %.1f%%)\n",other,other_confidence*100.0) ;
+	if (file_size%best != 0)
+		message("WARNING: File size %zu is not a multiple of the record size.\n",file_size) ;
+	if (ambiguous && (UPDATE_FLAG || strlen(PATCHFILE)>0)){
+		message("Record size is ambiguous, refusing to update. Use -l length.\n") ;
+		return 1 ;
+	}
+	if (ambiguous)
+		message("WARNING: Record size is ambiguous, check the report before updating.\n") ;
+	RECORD_SIZE = best ;
+	return 0 ;
+} ;
+
+/*
+* fix_record - full/zero-detection check of a single record
+* + reports every invalid character and builds the replacement record in writebuf
+* @buffer record as read from the data file (RECORD_SIZE bytes)
+* @writebuf replacement record (RECORD_SIZE bytes)
+* @file_pos position of the record in the data file
+* @rep report receiving the record's events
+* @return Number of invalid characters processed in the record
+*/
+size_t fix_record(const char *buffer, char *writebuf, size_t file_pos, report_t *rep){
+	int i, first_pos = 1, null_count = 0, deleted, burst = 0, burst_end = -2 ;
+	size_t w, invalid_count = 0 ;
+	uint64_t bits[(RECORD_SIZE+63)/64], mask, started = stats_clock() ;
+	unsigned char get_char ;
+
+	/* strncpy CANNOT be used because it only copies until a null-terminating
+	character is encountered ('\0', 0x00) */
+	memcpy(writebuf,buffer,RECORD_SIZE*sizeof(char)) ;
+
+	/* Only the invalid characters flagged by the classifier are visited */
+	CTX->invalid_bitmap(buffer,bits) ;
+	for (w=0;w<(RECORD_SIZE+63)/64;w++){
+		for (mask=bits[w];mask!=0;mask&=mask-1){
+			i = w*64 + __builtin_ctzll(mask) ;
+			get_char = buffer[i] ;
+			if (get_char == NULL_VALUE && ZERO_DETECTION_FLAG == 1){
+				if (first_pos == 1){
+					first_pos = 0 ;
+					report_record(rep,file_pos) ;
+				}
+				writebuf[i] = (char) NULL_FILL_VALUE ;
+				null_count++ ;
+				invalid_count++ ;
+				report_change(rep,file_pos,i,buffer[i],writebuf[i]) ;
+				/* Bits come in offset order, a gap ends the current 0x00 run */
+				if (rep->counts->burst_counts != NULL){
+					if (burst > 0 && i != burst_end + 1){
+						rep->counts->burst_counts[burst]++ ;
+						burst = 0 ;
+					}
+					burst++ ;
+					burst_end = i ;
+				}
+			}
+
+			if (get_char != NULL_VALUE && FULL_DETECTION_FLAG == 1){
+				if (first_pos == 1){
+					first_pos = 0 ;
+					report_record(rep,file_pos) ;
+				}
+				writebuf[i] = (char) fill_value(get_char,i) ;
+				invalid_count++ ;
+				report_change(rep,file_pos,i,buffer[i],writebuf[i]) ;
+			}
+		}
+	}
+
+	if (burst > 0)
+		rep->counts->burst_counts[burst]++ ;
+	deleted = ZERO_DETECTION_FLAG == 1 && null_count > DELETE_NULL_THRESHOLD ;
+	if (invalid_count > 0)
+		report_record_done(rep,file_pos,invalid_count,deleted) ;
+	if (ZERO_DETECTION_FLAG == 1){
+		if (null_count > 0)
+			report_nulls(rep,file_pos,null_count) ;
+
+		if (deleted)
+			memset(writebuf, NULL_FILL_VALUE, RECORD_SIZE*sizeof(char)) ;
+	}
+	if (STATS_ENABLED){
+		STATS_ADD(dirty,invalid_count > 0) ;
+		STATS_ADD(deleted,deleted) ;
+		stats_phase(PHASE_FIX,started) ;
+	}
+	return invalid_count ;
+} ;
+
+/*
+* checksum32 - FNV-1a checksum of journal data
+*/
+uint32_t checksum32(const char *data, size_t size){
+	uint32_t hash = 2166136261u ;
+	size_t i ;
+
+	for (i=0;i<size;i++)
+		hash = (hash ^ (unsigned char) data[i])*16777619u ;
+	return hash ;
+} ;
+
+/*
+* init_batch - allocate a write-back batch of BATCH_BYTES worth of records
+* @batch batch to set up
+* @fd descriptor of the data file
+* @return Allocation failed
+*/
+int init_batch(write_batch_t *batch, int fd){
+	memset(batch,0,sizeof(write_batch_t)) ;
+	batch->fd = fd ;
+	batch->rep = &REPORT ;
+	batch->capacity = BATCH_BYTES/RECORD_SIZE > 0 ? BATCH_BYTES/RECORD_SIZE : 1 ;
+	batch->positions = malloc(batch->capacity*sizeof(size_t)) ;
+	batch->old_records = malloc(batch->capacity*RECORD_SIZE) ;
+	batch->new_records = malloc(batch->capacity*RECORD_SIZE) ;
+	if (batch->positions==NULL || batch->old_records==NULL || batch->new_records==NULL){
+		perror("ERROR") ;
+		free_batch(batch) ;
+		return 1 ;
+	}
+	return 0 ;
+} ;
+
+/*
+* free_batch - release a write-back batch (pending records are dropped)
+*/
+void free_batch(write_batch_t *batch){
+	free(batch->positions) ;
+	free(batch->old_records) ;
+	free(batch->new_records) ;
+	batch->positions = NULL ;
+	batch->old_records = batch->new_records = NULL ;
+	batch->count = batch->capacity = 0 ;
+	return ;
+} ;
+
+/*
+* batch_add - queue a repaired record for write-back, flushing the batch when full
+* @batch batch to add to
+* @position position of the record in the data file
+* @old_record record as read from the data file
+* @new_record repaired record
+* @return Error flushing the batch
+*/
+int batch_add(write_batch_t *batch, size_t position, const char *old_record, const char *new_record){
+	batch->positions[batch->count] = position ;
+	memcpy(batch->old_records + batch->count*RECORD_SIZE,old_record,RECORD_SIZE*sizeof(char)) ;
+	memcpy(batch->new_records + batch->count*RECORD_SIZE,new_record,RECORD_SIZE*sizeof(char)) ;
+	if (++batch->count == batch->capacity)
+		return batch_flush(batch) ;
+	return 0 ;
+} ;
+
+/*
+* batch_covers - whether a position overlaps a record still waiting in the batch
+* + callers flush first so the record at position is read with the repairs applied
+*/
+int batch_covers(write_batch_t *batch, size_t position){
+	return batch->count > 0 && position < batch->positions[batch->count - 1] + RECORD_SIZE ;
+} ;
+
+/*
+* batch_overlay - apply the repairs waiting in the batch to a copy of a record
+* + used instead of flushing with --patch-out, where the data file never gets
+* the repairs
+* @record record read from position, updated in place
+* @position position of the record in the data file
+*/
+void batch_overlay(write_batch_t *batch, char *record, size_t position){
+	size_t first = batch->count, start, end ;
+
+	while (first > 0 && batch->positions[first - 1] + RECORD_SIZE > position)
+		first-- ;
+	for (;first<batch->count;first++){
+		start = batch->positions[first] > position ? batch->positions[first] : position ;
+		end = batch->positions[first] + RECORD_SIZE < position + RECORD_SIZE ? batch->positions[first] + RECORD_SIZE : position + RECORD_SIZE ;
+		if (start < end)
+			memcpy(record + (start - position),batch->new_records + first*RECORD_SIZE + (start - batch->positions[first]),end - start) ;
+	}
+	return ;
+} ;
+
+/*
+* journal_append - append the original data of a batch to the undo journal
+* + the journal is synced before the batch is written so an interrupted run can
+* always be rolled back
+* + journal writes count against --max-rate like the data they protect
+* @return Error writing the journal
+*/
+int journal_append(write_batch_t *batch){
+	struct iovec iov[ARRAY_SIZE] ;			// entry + data per record, within IOV_MAX
+	journal_entry_t entries[ARRAY_SIZE/2] ;
+	size_t r, chunk, n, expected, journaled = 0 ;
+	int ret_val = 0 ;
+
+	if (JOURNAL_FD < 0)
+		return 0 ;
+
+	pthread_mutex_lock(&JOURNAL_LOCK) ;
+	for (r=0;r<batch->count && ret_val==0;r+=chunk){
+		chunk = batch->count - r < ARRAY_SIZE/2 ? batch->count - r : ARRAY_SIZE/2 ;
+		for (n=0,expected=0;n<chunk;n++){
+			entries[n].position = batch->positions[r + n] ;
+			entries[n].length = RECORD_SIZE ;
+			entries[n].checksum = checksum32(batch->old_records + (r + n)*RECORD_SIZE,RECORD_SIZE) ;
+			iov[2*n].iov_base = &entries[n] ;
+			iov[2*n].iov_len = sizeof(journal_entry_t) ;
+			iov[2*n + 1].iov_base = batch->old_records + (r + n)*RECORD_SIZE ;
+			iov[2*n + 1].iov_len = RECORD_SIZE ;
+			expected += sizeof(journal_entry_t) + RECORD_SIZE ;
+		}
+		STATS_ADD(write_calls,1) ;
+		if (writev(JOURNAL_FD,iov,2*chunk) != (ssize_t) expected){
+			perror("JOURNAL ERROR") ;
+			ret_val = 1 ;
+		}
+		journaled += expected ;
+	}
+	STATS_ADD(sync_calls,ret_val==0) ;
+	if (ret_val==0 && fdatasync(JOURNAL_FD)!=0){
+		perror("JOURNAL ERROR") ;
+		ret_val = 1 ;
+	}
+	pthread_mutex_unlock(&JOURNAL_LOCK) ;
+	throttle(journaled) ;
+	return ret_val ;
+} ;
+
+/*
+* batch_flush - write the batch back to the data file
+* + goes to the patch file instead with --patch-out, under record locks with --online
+* + original data goes to the undo journal first (-J)
+* + records adjacent in the data file are written with one pwritev, followed by
+* a single fdatasync for the whole batch
+* @return Error writing the batch
+*/
+int batch_flush(write_batch_t *batch){
+	struct iovec iov[ARRAY_SIZE] ;
+	size_t r, run_start, niov ;
+	ssize_t written ;
+	int ret_val = 0 ;
+	uint64_t started = STATS_ENABLED || MAX_RATE > 0 ? monotonic_ns() : 0 ;
+
+	if (batch->count == 0)
+		return 0 ;
+	if (PATCH_OUT != NULL)
+		return patch_append(batch) ;
+	if (ONLINE_FLAG)
+		return batch_flush_online(batch) ;
+	if (journal_append(batch)!=0){
+		/* Never write what could not be journaled */
+		batch->failed += batch->count ;
+		batch->count = 0 ;
+		return 1 ;
+	}
+
+	for (r=0;r<batch->count;){
+		run_start = r ;
+		for (niov=0;r<batch->count && niov<ARRAY_SIZE && (niov==0 || batch->positions[r] == batch->positions[r - 1] + RECORD_SIZE);r++,niov++){
+			iov[niov].iov_base = batch->new_records + r*RECORD_SIZE ;
+			iov[niov].iov_len = RECORD_SIZE ;
+		}
+		STATS_ADD(write_calls,1) ;
+		if ((written = pwritev(batch->fd,iov,niov,batch->positions[run_start])) != (ssize_t) (niov*RECORD_SIZE)){
+			fprintf(stderr, "ERROR: %zd bytes of %zu written.\n",written,niov*RECORD_SIZE) ;
+			batch->failed += niov ;
+			ret_val = 1 ;
+		}
+	}
+	if (fdatasync(batch->fd)!=0){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	if (STATS_ENABLED){
+		STATS_ADD(updated,batch->count) ;
+		STATS_ADD(sync_calls,1) ;
+		stats_phase(PHASE_WRITE,started) ;
+	}
+	if (MAX_RATE > 0){
+		rate_sample(batch->count*RECORD_SIZE,monotonic_ns() - started) ;
+		throttle(batch->count*RECORD_SIZE) ;
+	}
+	batch->count = 0 ;
+	return ret_val ;
+} ;
+
+/*
+* lock_range - take or release a write lock on a byte range of the data file
+* (--online) without waiting
+* + open file description locks (F_OFD_SETLK) where the kernel has them, so
+* threads of this process contend like other processes do; process locks
+* (F_SETLK) otherwise
+* @lock range and type (F_WRLCK, F_UNLCK)
+* @return Lock taken or released
+*/
+int lock_range(int fd, struct flock *lock){
+#ifdef F_OFD_SETLK
+	if (fcntl(fd,F_OFD_SETLK,lock)==0)
+		return 1 ;
+	if (errno != EINVAL)
+		return 0 ;
+#endif
+	return fcntl(fd,F_SETLK,lock)==0 ;
+} ;
+
+/*
+* batch_flush_online - write the batch back while the data file is in use (--online)
+* + each run of up to ONLINE_RUN adjacent records is locked on its own, re-read
+* and compared with the records as scanned. Records changed since the scan are
+* skipped, the rest is journaled (-J) and written before the lock is released
+* + a lock held by someone else is retried ONLINE_RETRIES times with a doubling
+* backoff from ONLINE_BACKOFF, then the run is skipped
+* + one fdatasync for the whole batch, after the locks are released
+* + written and skipped records are reported here to batch->rep, so only the
+* records actually written count as updated
+* @return Error writing the batch
+*/
+int batch_flush_online(write_batch_t *batch){
+	struct flock lock ;
+	struct iovec iov[ONLINE_RUN] ;
+	struct timespec pause ;
+	write_batch_t view ;
+	char current[RECORD_SIZE] ;
+	size_t r, w, start, end, kept, niov, run_start, written_count = 0 ;
+	ssize_t written ;
+	unsigned attempt ;
+	uint64_t started = monotonic_ns(), locked_at, held, longest ;
+	int ret_val = 0, locked ;
+
+	for (start=0;start<batch->count;start=end){
+		for (end=start + 1;end<batch->count && end - start < ONLINE_RUN && batch->positions[end] == batch->positions[end - 1] + RECORD_SIZE;end++) ;
+		memset(&lock,0,sizeof(lock)) ;
+		lock.l_type = F_WRLCK ;
+		lock.l_whence = SEEK_SET ;
+		lock.l_start = (off_t) batch->positions[start] ;
+		lock.l_len = (off_t) ((end - start)*RECORD_SIZE) ;
+		for (attempt=0;!(locked = lock_range(batch->fd,&lock)) && attempt < ONLINE_RETRIES;attempt++){
+			pause.tv_sec = 0 ;
+			pause.tv_nsec = (long) ONLINE_BACKOFF << attempt ;
+			nanosleep(&pause,NULL) ;
+		}
+		if (!locked){
+			for (r=start;r<end;r++)
+				report_skipped(batch->rep,batch->positions[r],ONLINE_SKIP_LOCKED) ;
+			__atomic_fetch_add(&ONLINE_LOCKED,end - start,__ATOMIC_RELAXED) ;
+			continue ;
+		}
+		locked_at = monotonic_ns() ;
+
+		/* Only records nobody changed since the scan are written */
+		for (r=start,kept=start;r<end;r++){
+			STATS_ADD(read_calls,1) ;
+			if (pread(batch->fd,current,RECORD_SIZE,batch->positions[r]) != (ssize_t) RECORD_SIZE ||
+				memcmp(current,batch->old_records + r*RECORD_SIZE,RECORD_SIZE)!=0){
+				report_skipped(batch->rep,batch->positions[r],ONLINE_SKIP_CHANGED) ;
+				__atomic_fetch_add(&ONLINE_CHANGED,1,__ATOMIC_RELAXED) ;
+				continue ;
+			}
+			if (kept != r){
+				batch->positions[kept] = batch->positions[r] ;
+				memcpy(batch->old_records + kept*RECORD_SIZE,batch->old_records + r*RECORD_SIZE,RECORD_SIZE) ;
+				memcpy(batch->new_records + kept*RECORD_SIZE,batch->new_records + r*RECORD_SIZE,RECORD_SIZE) ;
+			}
+			kept++ ;
+		}
+		view = *batch ;
+		view.positions += start ;
+		view.old_records += start*RECORD_SIZE ;
+		view.count = kept - start ;
+		if (kept > start && journal_append(&view)!=0){
+			/* Never write what could not be journaled */
+			batch->failed += kept - start ;
+			ret_val = 1 ;
+			kept = start ;
+		}
+		for (r=start;r<kept;){
+			run_start = r ;
+			for (niov=0;r<kept && (niov==0 || batch->positions[r] == batch->positions[r - 1] + RECORD_SIZE);r++,niov++){
+				iov[niov].iov_base = batch->new_records + r*RECORD_SIZE ;
+				iov[niov].iov_len = RECORD_SIZE ;
+			}
+			STATS_ADD(write_calls,1) ;
+			if ((written = pwritev(batch->fd,iov,niov,batch->positions[run_start])) != (ssize_t) (niov*RECORD_SIZE)){
+				fprintf(stderr, "ERROR: %zd bytes of %zu written.\n",written,niov*RECORD_SIZE) ;
+				batch->failed += niov ;
+				ret_val = 1 ;
+			}else{
+				for (w=run_start;w<r;w++)
+					report_written(batch->rep,batch->positions[w]) ;
+				written_count += niov ;
+			}
+		}
+		lock.l_type = F_UNLCK ;
+		lock_range(batch->fd,&lock) ;
+
+		held = monotonic_ns() - locked_at ;
+		__atomic_fetch_add(&ONLINE_HELD,held,__ATOMIC_RELAXED) ;
+		__atomic_fetch_add(&ONLINE_LOCKS,1,__ATOMIC_RELAXED) ;
+		longest = __atomic_load_n(&ONLINE_LONGEST,__ATOMIC_RELAXED) ;
+		while (held > longest && !__atomic_compare_exchange_n(&ONLINE_LONGEST,&longest,held,0,__ATOMIC_RELAXED,__ATOMIC_RELAXED)) ;
+	}
+	__atomic_fetch_add(&ONLINE_WRITTEN,written_count,__ATOMIC_RELAXED) ;
+
+	if (written_count > 0 && fdatasync(batch->fd)!=0){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	if (STATS_ENABLED){
+		STATS_ADD(updated,written_count) ;
+		STATS_ADD(sync_calls,written_count > 0) ;
+		stats_phase(PHASE_WRITE,started) ;
+	}
+	if (MAX_RATE > 0){
+		rate_sample(batch->count*RECORD_SIZE,monotonic_ns() - started) ;
+		throttle(batch->count*RECORD_SIZE) ;
+	}
+	batch->count = 0 ;
+	return ret_val ;
+} ;
+
+/*
+* open_journal - open the undo journal (-J) for appending
+* + a new journal starts with JOURNAL_MAGIC, an existing one is appended to
+* @return Journal could not be opened
+*/
+int open_journal( void ){
+	struct stat journal_stat ;
+
+	if (strlen(JOURNALFILE)==0)
+		return 0 ;
+	if ((JOURNAL_FD = open(JOURNALFILE,O_WRONLY|O_CREAT|O_APPEND,0644)) < 0 || fstat(JOURNAL_FD,&journal_stat)!=0){
+		perror("JOURNAL ERROR") ;
+		return 1 ;
+	}
+	if (journal_stat.st_size == 0 && write(JOURNAL_FD,JOURNAL_MAGIC,strlen(JOURNAL_MAGIC)) != (ssize_t) strlen(JOURNAL_MAGIC)){
+		perror("JOURNAL ERROR") ;
+		return 1 ;
+	}
+	message("Journaling original data to: %s\n",JOURNALFILE) ;
+	return 0 ;
+} ;
+
+/*
+* rollback_journal - restore the data file from an undo journal (--rollback)
+* + entries are applied newest first so every byte ends up with the value it had
+* before the first journaled run
+* + a torn entry at the end of the journal (interrupted before its batch was
+* written) ends the journal
+* @return Error restoring the data file
+*/
+int rollback_journal( void ){
+	struct stat journal_stat ;
+	journal_entry_t entry ;
+	size_t offset, entry_count = 0, capacity = ARRAY_SIZE, e ;
+	size_t *entry_offsets, *grown ;
+	char *journal ;
+	int journal_fd, data_fd, ret_val = 0 ;
+
+	if ((journal_fd = open(ROLLBACKFILE,O_RDONLY)) < 0 || fstat(journal_fd,&journal_stat)!=0){
+		perror("JOURNAL ERROR") ;
+		return 1 ;
+	}
+	if ((size_t) journal_stat.st_size < strlen(JOURNAL_MAGIC) ||
+		(journal = mmap(NULL,journal_stat.st_size,PROT_READ,MAP_PRIVATE,journal_fd,0)) == MAP_FAILED){
+		fprintf(stderr, "ERROR: %s is not a filefix journal.\n",ROLLBACKFILE) ;
+		close(journal_fd) ;
+		return 1 ;
+	}
+	if (memcmp(journal,JOURNAL_MAGIC,strlen(JOURNAL_MAGIC))!=0 || (data_fd = open(DATAFILE,O_WRONLY)) < 0 ||
+		(entry_offsets = malloc(capacity*sizeof(size_t)))==NULL){
+		fprintf(stderr, "ERROR: Unable to roll back %s with %s.\n",DATAFILE,ROLLBACKFILE) ;
+		munmap(journal,journal_stat.st_size) ;
+		close(journal_fd) ;
+		return 1 ;
+	}
+
+	for (offset=strlen(JOURNAL_MAGIC);offset + sizeof(journal_entry_t) <= (size_t) journal_stat.st_size;){
+		memcpy(&entry,journal + offset,sizeof(journal_entry_t)) ;
+		if (offset + sizeof(journal_entry_t) + entry.length > (size_t) journal_stat.st_size ||
+			checksum32(journal + offset + sizeof(journal_entry_t),entry.length) != entry.checksum){
+			fprintf(stderr, "Journal ends with an incomplete entry at offset %zu.\n",offset) ;
+			break ;
+		}
+		if (entry_count == capacity){
+			capacity *= 2 ;
+			if ((grown = realloc(entry_offsets,capacity*sizeof(size_t)))==NULL){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			entry_offsets = grown ;
+		}
+		entry_offsets[entry_count++] = offset ;
+		offset += sizeof(journal_entry_t) + entry.length ;
+	}
+
+	for (e=entry_count;ret_val==0 && e>0;e--){
+		memcpy(&entry,journal + entry_offsets[e - 1],sizeof(journal_entry_t)) ;
+		if (pwrite(data_fd,journal + entry_offsets[e - 1] + sizeof(journal_entry_t),entry.length,entry.position) != (ssize_t) entry.length){
+			perror("ERROR") ;
+			ret_val = 1 ;
+		}
+	}
+	if (fdatasync(data_fd)!=0){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	message("Records restored from journal: %zu\n",ret_val==0 ? entry_count : entry_count - e) ;
+
+	free(entry_offsets) ;
+	close(data_fd) ;
+	munmap(journal,journal_stat.st_size) ;
+	close(journal_fd) ;
+	return ret_val ;
+} ;
+
+/*
+* open_patch - start the patch file of an offline scan (--patch-out)
+* + written under a temporary name and renamed by close_patch() once the scan
+* succeeded, so a patch is never applied from an interrupted scan
+* @fd descriptor of the data file (size recorded in the header)
+* @return Patch file could not be created
+*/
+int open_patch(int fd){
+	char patch_tmp[ARRAY_SIZE + 8] ;
+	patch_header_t header ;
+	struct stat file_stat ;
+
+	snprintf(patch_tmp,sizeof(patch_tmp),"%s.tmp",PATCHFILE) ;
+	memset(&header,0,sizeof(header)) ;
+	header.record_size = RECORD_SIZE ;
+	header.file_size = fstat(fd,&file_stat)==0 ? (uint64_t) file_stat.st_size : 0 ;
+	if ((PATCH_OUT = fopen(patch_tmp,"wb"))==NULL){
+		perror("PATCH ERROR") ;
+		return 1 ;
+	}
+	setvbuf(PATCH_OUT,NULL,_IOFBF,REPORT_BUFFER) ;
+	PATCH_RECORDS = 0 ;
+	if (fwrite(PATCH_MAGIC,sizeof(char),strlen(PATCH_MAGIC),PATCH_OUT)!=strlen(PATCH_MAGIC) ||
+		fwrite(&header,sizeof(header),1,PATCH_OUT)!=1){
+		perror("PATCH ERROR") ;
+		fclose(PATCH_OUT) ;
+		PATCH_OUT = NULL ;
+		unlink(patch_tmp) ;
+		return 1 ;
+	}
+	message("Writing repairs to patch: %s\n",PATCHFILE) ;
+	return 0 ;
+} ;
+
+/*
+* patch_append - write the repairs of a batch to the patch file instead of the
+* data file (--patch-out)
+* + each record gets a patch_entry_t with the checksum of the record as scanned,
+* followed by one patch_change_t per changed byte
+* @return Error writing the patch
+*/
+int patch_append(write_batch_t *batch){
+	patch_entry_t entry ;
+	patch_change_t changes[ARRAY_SIZE] ;
+	const unsigned char *old_record, *new_record ;
+	size_t r, i, n ;
+	int ret_val = 0 ;
+
+	pthread_mutex_lock(&PATCH_LOCK) ;
+	for (r=0;r<batch->count && ret_val==0;r++){
+		old_record = (const unsigned char*) batch->old_records + r*RECORD_SIZE ;
+		new_record = (const unsigned char*) batch->new_records + r*RECORD_SIZE ;
+		entry.position = batch->positions[r] ;
+		entry.checksum = checksum32((const char*) old_record,RECORD_SIZE) ;
+		for (i=0,entry.changes=0;i<RECORD_SIZE;i++)
+			entry.changes += old_record[i] != new_record[i] ;
+		if (fwrite(&entry,sizeof(entry),1,PATCH_OUT)!=1)
+			ret_val = 1 ;
+		/* Changes go out in chunks of ARRAY_SIZE */
+		for (i=0,n=0;i<RECORD_SIZE && ret_val==0;i++){
+			if (old_record[i] != new_record[i]){
+				changes[n].offset = (uint32_t) i ;
+				changes[n].old_char = old_record[i] ;
+				changes[n].new_char = new_record[i] ;
+				changes[n++].reserved = 0 ;
+			}
+			if ((n == ARRAY_SIZE || i == RECORD_SIZE - 1) && n > 0){
+				if (fwrite(changes,sizeof(patch_change_t),n,PATCH_OUT)!=n)
+					ret_val = 1 ;
+				n = 0 ;
+			}
+		}
+	}
+	PATCH_RECORDS += ret_val==0 ? batch->count : 0 ;
+	pthread_mutex_unlock(&PATCH_LOCK) ;
+	if (ret_val != 0){
+		perror("PATCH ERROR") ;
+		batch->failed += batch->count ;
+	}
+	batch->count = 0 ;
+	return ret_val ;
+} ;
+
+/*
+* close_patch - finish the patch file of an offline scan
+* + the patch only replaces PATCHFILE when the scan succeeded, otherwise it is
+* removed
+* @scan_failed result of the scan
+* @return Error writing the patch
+*/
+int close_patch(int scan_failed){
+	char patch_tmp[ARRAY_SIZE + 8] ;
+	int ret_val = 0 ;
+
+	snprintf(patch_tmp,sizeof(patch_tmp),"%s.tmp",PATCHFILE) ;
+	if (fflush(PATCH_OUT)!=0 || fsync(fileno(PATCH_OUT))!=0){
+		perror("PATCH ERROR") ;
+		ret_val = 1 ;
+	}
+	fclose(PATCH_OUT) ;
+	PATCH_OUT = NULL ;
+	if (ret_val==0 && !scan_failed && rename(patch_tmp,PATCHFILE)!=0){
+		perror("PATCH ERROR") ;
+		ret_val = 1 ;
+	}
+	if (ret_val != 0 || scan_failed){
+		unlink(patch_tmp) ;
+		message("Patch not written.\n") ;
+	}else
+		message("Records in patch: %zu\n",PATCH_RECORDS) ;
+	return ret_val ;
+} ;
+
+/*
+* compare_patch_ref - qsort comparison of patch entries by record position
+*/
+int compare_patch_ref(const void *a, const void *b){
+	const patch_ref_t *ref_a = (const patch_ref_t *) a, *ref_b = (const patch_ref_t *) b ;
+	if (ref_a->position != ref_b->position)
+		return ref_a->position < ref_b->position ? -1 : 1 ;
+	return ref_a->offset < ref_b->offset ? -1 : (ref_a->offset > ref_b->offset) ;
+} ;
+
+/*
+* apply_patch - apply the patch of an offline scan to the data file (--apply-patch)
+* + the whole patch is checked before anything is written, and the data file
+* must still have the size it had when scanned
+* + records are patched in position order through the update mode write-back
+* (pwritev of adjacent records, one fdatasync per batch, undo journal with -J)
+* + a record whose checksum or old bytes no longer match the scan has changed
+* since then and is left alone
+* @return Error applying the patch or records skipped
+*/
+int apply_patch( void ){
+	struct stat patch_stat, data_stat ;
+	patch_header_t header ;
+	patch_entry_t entry ;
+	patch_change_t change ;
+	patch_ref_t *refs, *grown ;
+	write_batch_t batch ;
+	char *patch, *current = NULL, *repaired = NULL ;
+	size_t offset, count = 0, capacity = ARRAY_SIZE, e, c, applied = 0, skipped = 0, header_end ;
+	ssize_t got ;
+	uint64_t started ;
+	int patch_fd, data_fd = -1, ret_val = 0, match ;
+
+	header_end = strlen(PATCH_MAGIC) + sizeof(patch_header_t) ;
+	if ((patch_fd = open(APPLYFILE,O_RDONLY)) < 0 || fstat(patch_fd,&patch_stat)!=0){
+		perror("PATCH ERROR") ;
+		if (patch_fd >= 0)
+			close(patch_fd) ;
+		return 1 ;
+	}
+	if ((size_t) patch_stat.st_size < header_end ||
+		(patch = mmap(NULL,patch_stat.st_size,PROT_READ,MAP_PRIVATE,patch_fd,0)) == MAP_FAILED){
+		fprintf(stderr, "ERROR: %s is not a filefix patch.\n",APPLYFILE) ;
+		close(patch_fd) ;
+		return 1 ;
+	}
+	memcpy(&header,patch + strlen(PATCH_MAGIC),sizeof(header)) ;
+	if (memcmp(patch,PATCH_MAGIC,strlen(PATCH_MAGIC))!=0 || header.record_size == 0 ||
+		(RECORD_SIZE != 0 && RECORD_SIZE != header.record_size) || (refs = malloc(capacity*sizeof(patch_ref_t)))==NULL){
+		fprintf(stderr, "ERROR: Unable to apply %s (record size %" PRIu64 ").\n",APPLYFILE,header.record_size) ;
+		munmap(patch,patch_stat.st_size) ;
+		close(patch_fd) ;
+		return 1 ;
+	}
+	RECORD_SIZE = (size_t) header.record_size ;
+
+	/* Every entry is checked before anything is written */
+	for (offset=header_end;ret_val==0 && offset<(size_t) patch_stat.st_size;offset += sizeof(entry) + entry.changes*sizeof(change)){
+		if (offset + sizeof(entry) > (size_t) patch_stat.st_size){
+			ret_val = 1 ;
+			break ;
+		}
+		memcpy(&entry,patch + offset,sizeof(entry)) ;
+		if (entry.changes == 0 || entry.changes > RECORD_SIZE ||
+			offset + sizeof(entry) + entry.changes*sizeof(change) > (size_t) patch_stat.st_size){
+			ret_val = 1 ;
+			break ;
+		}
+		for (c=0;c<entry.changes;c++){
+			memcpy(&change,patch + offset + sizeof(entry) + c*sizeof(change),sizeof(change)) ;
+			if (change.offset >= RECORD_SIZE)
+				break ;
+		}
+		if (c < entry.changes){
+			ret_val = 1 ;
+			break ;
+		}
+		if (count == capacity){
+			capacity *= 2 ;
+			if ((grown = realloc(refs,capacity*sizeof(patch_ref_t)))==NULL){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			refs = grown ;
+		}
+		refs[count].position = entry.position ;
+		refs[count++].offset = offset ;
+	}
+	if (ret_val != 0)
+		fprintf(stderr, "ERROR: %s is damaged at offset %zu, nothing applied.\n",APPLYFILE,offset) ;
+	else{
+		qsort(refs,count,sizeof(patch_ref_t),compare_patch_ref) ;
+		message("Patch: %zu records for %s (record size %zu)\n",count,DATAFILE,RECORD_SIZE) ;
+	}
+
+	if (ret_val==0 && ((data_fd = open(DATAFILE,O_RDWR)) < 0 || fstat(data_fd,&data_stat)!=0)){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	if (ret_val==0 && (uint64_t) data_stat.st_size != header.file_size){
+		fprintf(stderr, "ERROR: %s is %" PRIu64 " bytes, the patch was made from %" PRIu64 " bytes, nothing applied.\n",
+			DATAFILE,(uint64_t) data_stat.st_size,header.file_size) ;
+		ret_val = 1 ;
+	}
+	if (ret_val==0 && ((current = malloc(RECORD_SIZE))==NULL || (repaired = malloc(RECORD_SIZE))==NULL)){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	if (ret_val==0 && (open_journal()!=0 || init_batch(&batch,data_fd)!=0))
+		ret_val = 1 ;
+	else if (ret_val==0){
+		for (e=0;ret_val==0 && e<count;e++){
+			memcpy(&entry,patch + refs[e].offset,sizeof(entry)) ;
+			/* A record patched twice is read with the first patch applied */
+			if (batch_covers(&batch,entry.position))
+				batch_flush(&batch) ;
+			started = stats_clock() ;
+			got = pread(data_fd,current,RECORD_SIZE,entry.position) ;
+			STATS_ADD(read_calls,1) ;
+			stats_phase(PHASE_READ,started) ;
+
+			match = got == (ssize_t) RECORD_SIZE && checksum32(current,RECORD_SIZE) == entry.checksum ;
+			memcpy(repaired,current,RECORD_SIZE) ;
+			for (c=0;match && c<entry.changes;c++){
+				memcpy(&change,patch + refs[e].offset + sizeof(entry) + c*sizeof(change),sizeof(change)) ;
+				match = (unsigned char) current[change.offset] == change.old_char ;
+				repaired[change.offset] = (char) change.new_char ;
+			}
+			if (!match){
+				message("Record at %" PRIu64 " changed since the scan, not patched.\n",entry.position) ;
+				skipped++ ;
+				continue ;
+			}
+			if (batch_add(&batch,entry.position,current,repaired)!=0)
+				ret_val = 1 ;
+			else
+				applied++ ;
+		}
+		if (batch_flush(&batch)!=0 || batch.failed > 0)
+			ret_val = 1 ;
+		message("Records patched: %zu; skipped: %zu\n",applied - batch.failed,skipped) ;
+		free_batch(&batch) ;
+	}
+	if (data_fd >= 0)
+		close(data_fd) ;
+	if (JOURNAL_FD >= 0){
+		close(JOURNAL_FD) ;
+		JOURNAL_FD = -1 ;
+	}
+
+	free(current) ;
+	free(repaired) ;
+	free(refs) ;
+	munmap(patch,patch_stat.st_size) ;
+	close(patch_fd) ;
+	return ret_val != 0 || skipped > 0 ;
+} ;
+
+/*
+* record_deleted - record was cleared by zero-detection (NULL_FILL_VALUE throughout)
+* @fill record of NULL_FILL_VALUE to compare with
+*/
+static inline int record_deleted(const char *record, const char *fill){
+	return record[0] == fill[0] && record[RECORD_SIZE - 1] == fill[0] && memcmp(record,fill,RECORD_SIZE)==0 ;
+} ;
+
+/*
+* sync_directory - fsync the directory holding a file, so a rename into it is on disk
+* @path file in the directory
+* @return Error opening or syncing the directory
+*/
+int sync_directory(const char *path){
+	char dir[ARRAY_SIZE] ;
+	const char *slash = strrchr(path,'/') ;
+	int fd, ret_val = 0 ;
+
+	if (slash == NULL)
+		strcpy(dir,".") ;
+	else if (slash == path)
+		strcpy(dir,"/") ;
+	else
+		snprintf(dir,sizeof(dir),"%.*s",(int) (slash - path),path) ;
+	if ((fd = open(dir,O_RDONLY | O_DIRECTORY)) < 0)
+		return 1 ;
+	STATS_ADD(sync_calls,1) ;
+	if (fsync(fd)!=0)
+		ret_val = 1 ;
+	close(fd) ;
+	return ret_val ;
+} ;
+
+/*
+* compact_file - remove deleted records from the data file (--compact)
+* + one sequential sweep: live records are copied in COMPACT_BUFFER passes to
+* <data file>.compact next to the data file, which is synced and renamed over
+* the data file. A crash or error leaves the original untouched (the copy is
+* removed), so the compaction needs the free space of a second copy
+* + the copy gets the mode and, if permitted, the owner of the data file. Hard
+* links to the data file keep the old content
+* + the remap file gets one "old_position new_position records" line per run of
+* live records, deleted records have no new position. A trailing partial record
+* is kept at the end of the file
+* + without deleted records the copy is dropped and the data file kept
+* + the remap file is synced and put in place first, then the copy is renamed
+* over the data file and the directory synced: a compacted file never exists
+* without its remap
+* + -J is refused with --compact: journal positions are those before compaction
+* @return Error encountered while compacting
+*/
+int compact_file( void ){
+	struct stat file_stat ;
+	char *buffer = NULL, *fill = NULL, remap_tmp[ARRAY_SIZE + 8], data_tmp[ARRAY_SIZE + 16] ;
+	FILE *remap = NULL ;
+	size_t chunk, file_size, length, got, kept, r, span, removed = 0 ;
+	size_t read_pos = 0, write_pos = 0, run_old = 0, run_new = 0, run_count = 0 ;
+	ssize_t done ;
+	uint64_t started = stats_clock() ;
+	int fd, out_fd = -1, ret_val = 0 ;
+
+	chunk = COMPACT_BUFFER/RECORD_SIZE*RECORD_SIZE ;
+	if (chunk == 0)
+		chunk = RECORD_SIZE ;
+	snprintf(remap_tmp,sizeof(remap_tmp),"%s.tmp",COMPACTFILE) ;
+	snprintf(data_tmp,sizeof(data_tmp),"%s.compact",DATAFILE) ;
+	if ((fd = open(DATAFILE,O_RDONLY)) < 0 || fstat(fd,&file_stat)!=0){
+		perror("ERROR") ;
+		if (fd >= 0)
+			close(fd) ;
+		return 1 ;
+	}
+	if ((buffer = malloc(chunk))==NULL || (fill = malloc(RECORD_SIZE))==NULL ||
+		(out_fd = open(data_tmp,O_WRONLY | O_CREAT | O_TRUNC,file_stat.st_mode & 07777)) < 0 ||
+		(remap = fopen(remap_tmp,"w"))==NULL){
+		perror("ERROR") ;
+		if (out_fd >= 0){
+			close(out_fd) ;
+			unlink(data_tmp) ;
+		}
+		free(buffer) ;
+		free(fill) ;
+		close(fd) ;
+		return 1 ;
+	}
+	/* O_CREAT applies the umask, the owner is kept where permitted */
+	if (fchmod(out_fd,file_stat.st_mode & 07777)!=0 || (fchown(out_fd,file_stat.st_uid,file_stat.st_gid)!=0 && errno!=EPERM)){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	memset(fill,NULL_FILL_VALUE,RECORD_SIZE) ;
+	posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL) ;
+	file_size = (size_t) file_stat.st_size ;
+
+	while (ret_val==0 && read_pos < file_size){
+		length = file_size - read_pos < chunk ? file_size - read_pos : chunk ;
+		throttle(length) ;
+		for (got=0;got<length;got+=done){
+			STATS_ADD(read_calls,1) ;
+			if ((done = pread(fd,buffer + got,length - got,read_pos + got)) <= 0)
+				break ;
+		}
+		if (got < length){
+			perror("ERROR") ;
+			ret_val = 1 ;
+			break ;
+		}
+
+		/* Live spans are moved to the front of the buffer */
+		kept = 0 ;
+		span = 0 ;
+		for (r=0;r + RECORD_SIZE <= length;r+=RECORD_SIZE){
+			if (record_deleted(buffer + r,fill)){
+				if (r > span)
+					memmove(buffer + kept,buffer + span,r - span) ;
+				kept += r - span ;
+				span = r + RECORD_SIZE ;
+				removed++ ;
+				continue ;
+			}
+			if (run_count > 0 && run_old + run_count*RECORD_SIZE == read_pos + r)
+				run_count++ ;
+			else{
+				if (run_count > 0)
+					fprintf(remap,"%zu %zu %zu\n",run_old,run_new,run_count) ;
+				run_old = read_pos + r ;
+				run_new = write_pos + kept + (r - span) ;
+				run_count = 1 ;
+			}
+		}
+		/* The rest of the span, with a trailing partial record in the last pass */
+		if (length > span)
+			memmove(buffer + kept,buffer + span,length - span) ;
+		kept += length - span ;
+
+		if (kept > 0){
+			throttle(kept) ;
+			STATS_ADD(write_calls,1) ;
+			if (pwrite(out_fd,buffer,kept,write_pos) != (ssize_t) kept){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+		}
+		write_pos += kept ;
+		read_pos += length ;
+	}
+
+	if (ret_val==0 && run_count > 0)
+		fprintf(remap,"%zu %zu %zu\n",run_old,run_new,run_count) ;
+	if (ret_val==0 && removed > 0){
+		STATS_ADD(sync_calls,1) ;
+		if (fsync(out_fd)!=0){
+			perror("ERROR") ;
+			ret_val = 1 ;
+		}
+	}
+
+	/* The remap goes in place before the copy replaces the data file */
+	if (fflush(remap)!=0 || fsync(fileno(remap))!=0){
+		perror("REMAP ERROR") ;
+		ret_val = 1 ;
+	}
+	if (fclose(remap)!=0 || (ret_val==0 && rename(remap_tmp,COMPACTFILE)!=0)){
+		perror("REMAP ERROR") ;
+		ret_val = 1 ;
+	}
+	if (ret_val!=0)
+		unlink(remap_tmp) ;
+	if (ret_val==0 && removed > 0 && rename(data_tmp,DATAFILE)!=0){
+		perror("ERROR") ;
+		/* No remap for a compaction that did not take place */
+		unlink(COMPACTFILE) ;
+		ret_val = 1 ;
+	}
+	close(out_fd) ;
+	if (ret_val!=0 || removed == 0)
+		unlink(data_tmp) ;
+	if (ret_val!=0)
+		fprintf(stderr, "ERROR: Compaction of %s stopped at position %zu, the data file is unchanged.\n",DATAFILE,read_pos) ;
+	else if (removed > 0 && sync_directory(DATAFILE)!=0){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+	message("Deleted records removed: %zu; file size: %zu -> %zu\n",removed,file_size,write_pos) ;
+
+	free(buffer) ;
+	free(fill) ;
+	close(fd) ;
+	stats_phase(PHASE_COMPACT,started) ;
+	return ret_val ;
+} ;
+
+/*
+* scan_records - full/zero-detection traversal of records held in memory
+* @records records as read from the data file
+* @base position of the first record in the data file
+* @size bytes of records (a trailing partial record is ignored)
+* @rep report receiving the events
+* @batch write-back batch (update mode)
+* @return Number of invalid characters processed
+*/
+size_t scan_records(const char *records, size_t base, size_t size, report_t *rep, write_batch_t *batch){
+	char writebuf[RECORD_SIZE] ;
+	unsigned char dirty[CLASSIFY_BLOCK] ;
+	size_t record_pos, file_pos, block_pos, nrec, r, invalid_count = 0, record_invalid, dirty_count ;
+	uint64_t started ;
+
+	for (block_pos=0;block_pos + RECORD_SIZE <= size;block_pos += nrec*RECORD_SIZE){
+		nrec = (size - block_pos)/RECORD_SIZE ;
+		if (nrec > CLASSIFY_BLOCK)
+			nrec = CLASSIFY_BLOCK ;
+		started = stats_clock() ;
+		dirty_count = CTX->classify_block(records + block_pos,nrec,dirty) ;
+		if (STATS_ENABLED){
+			STATS_ADD(records,nrec) ;
+			STATS_ADD(bytes,nrec*RECORD_SIZE) ;
+			stats_phase(PHASE_CLASSIFY,started) ;
+		}
+		/* Clean blocks are skipped without touching the per-record logic */
+		if (dirty_count==0)
+			continue ;
+		for (r=0;r<nrec;r++){
+			if (!dirty[r])
+				continue ;
+			record_pos = block_pos + r*RECORD_SIZE ;
+			file_pos = base + record_pos ;
+			record_invalid = fix_record(records + record_pos,writebuf,file_pos,rep) ;
+			invalid_count += record_invalid ;
+			/* Ranges of scan_parallel() threads may share a manifest block */
+			if (MANIFEST_DIRTY != NULL && record_invalid > 0)
+				__atomic_store_n(&MANIFEST_DIRTY[file_pos/MANIFEST_BLOCK_BYTES],1,__ATOMIC_RELAXED) ;
+			if (WRITE_BACK && memcmp(writebuf,records + record_pos,RECORD_SIZE*sizeof(char))!=0){
+				batch_add(batch,file_pos,records + record_pos,writebuf) ;
+				report_updated(rep,file_pos) ;
+			}
+		}
+	}
+	return invalid_count ;
+} ;
+
+/*
+* scan_mapping - full/zero-detection traversal of a record-aligned range of the mapped data file
+* + with --max-rate the range is taken in chunks of CLASSIFY_BLOCK records: the
+* reads happen as page faults while a chunk is classified, so its time is the
+* latency sample of --adaptive, and the chunk is throttled afterwards
+* @map mapping of the data file
+* @start position of the first record of the range
+* @end end of the range (multiple of RECORD_SIZE)
+* @rep report receiving the range's events
+* @batch write-back batch of the range (update mode)
+* @return Number of invalid characters processed in the range
+*/
+size_t scan_mapping(char *map, size_t start, size_t end, report_t *rep, write_batch_t *batch){
+	size_t pos, chunk = CLASSIFY_BLOCK*RECORD_SIZE, invalid_count = 0 ;
+	uint64_t started ;
+
+	if (MAX_RATE <= 0)
+		return scan_records(map + start,start,end - start,rep,batch) ;
+	for (pos=start;pos<end;pos+=chunk){
+		if (chunk > end - pos)
+			chunk = end - pos ;
+		started = monotonic_ns() ;
+		invalid_count += scan_records(map + pos,pos,chunk,rep,batch) ;
+		rate_sample(chunk,monotonic_ns() - started) ;
+		throttle(chunk) ;
+	}
+	return invalid_count ;
+} ;
+
+/*
+* scan_worker - thread entry point for one range of a parallel scan
+* + report output is spilled to an unlinked temporary file until all workers are
+* done so it can be written in file order; a byte level report of a badly damaged
+* file does not fit in memory. Report counts are kept per worker and merged afterwards
+* @arg scan_range_t describing the range
+*/
+void *scan_worker(void *arg){
+	scan_range_t *range = (scan_range_t*) arg ;
+
+	CTX = range->ctx ;
+	range->report.counts = &range->counts ;
+	if (init_counts(&range->counts)!=0 || (range->report.out = tmpfile())==NULL){
+		perror("ERROR") ;
+		range->failed = 1 ;
+		return NULL ;
+	}
+	if (WRITE_BACK && init_batch(&range->batch,range->fd)!=0){
+		range->failed = 1 ;
+		return NULL ;
+	}
+	range->batch.rep = &range->report ;
+	range->invalid_count = scan_mapping(range->map,range->start,range->end,&range->report,&range->batch) ;
+	if (WRITE_BACK){
+		if (batch_flush(&range->batch)!=0 || range->batch.failed > 0)
+			range->failed = 1 ;
+		free_batch(&range->batch) ;
+	}
+	if (fflush(range->report.out)!=0){
+		perror("REPORT ERROR") ;
+		range->failed = 1 ;
+	}
+	return NULL ;
+} ;
+
+/*
+* scan_parallel - split the mapped data file into record-aligned ranges and scan
+* them on THREAD_COUNT threads
+* + reports are copied in file order so the output matches a serial run
+* @fd descriptor of the data file
+* @map mapping of the data file
+* @map_size size of the mapping
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing file
+*/
+int scan_parallel(int fd, char *map, size_t map_size, size_t *invalid_count){
+	size_t nrec = map_size/RECORD_SIZE, per_thread, t, thread_count = THREAD_COUNT, n ;
+	scan_range_t *ranges ;
+	char spill[64*ARRAY_SIZE] ;
+	int ret_val = 0 ;
+
+	if (thread_count > nrec)
+		thread_count = nrec ;
+	per_thread = (nrec + thread_count - 1)/thread_count ;
+	if ((ranges = calloc(thread_count,sizeof(scan_range_t)))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+
+	for (t=0;t<thread_count;t++){
+		ranges[t].fd = fd ;
+		ranges[t].map = map ;
+		ranges[t].ctx = CTX ;
+		ranges[t].start = t*per_thread*RECORD_SIZE ;
+		ranges[t].end = (t+1)*per_thread < nrec ? (t+1)*per_thread*RECORD_SIZE : nrec*RECORD_SIZE ;
+		if (pthread_create(&ranges[t].thread,NULL,scan_worker,&ranges[t])!=0){
+			/* Scan the range on this thread instead */
+			ranges[t].started = 0 ;
+			scan_worker(&ranges[t]) ;
+		}else
+			ranges[t].started = 1 ;
+	}
+
+	fflush(REPORT.out) ;
+	for (t=0;t<thread_count;t++){
+		if (ranges[t].started)
+			pthread_join(ranges[t].thread,NULL) ;
+		if (ranges[t].failed)
+			ret_val = 1 ;
+		if (ranges[t].report.out!=NULL){
+			rewind(ranges[t].report.out) ;
+			while ((n = fread(spill,sizeof(char),sizeof(spill),ranges[t].report.out)) > 0)
+				fwrite(spill,sizeof(char),n,REPORT.out) ;
+			if (ferror(ranges[t].report.out)){
+				perror("REPORT ERROR") ;
+				ret_val = 1 ;
+			}
+			fclose(ranges[t].report.out) ;
+		}
+		merge_counts(REPORT.counts,&ranges[t].counts) ;
+		free_counts(&ranges[t].counts) ;
+		*invalid_count += ranges[t].invalid_count ;
+	}
+	free(ranges) ;
+	return ret_val ;
+} ;
+
+/*
+* process_file_mmap - full/zero-detection traversal over a memory mapping of the data file
+* + the file is mapped read-only. Repairs are written back in batches (see
+* batch_flush()), which the shared mapping sees straight away
+* + a trailing partial record is ignored, same as the stdio traversal
+* @fd descriptor of the opened data file
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing file, or -1 if the file could not be
+* mapped and the stdio traversal should be used instead
+*/
+int process_file_mmap(int fd, size_t *invalid_count){
+	struct stat file_stat ;
+	write_batch_t batch ;
+	char *map ;
+	size_t map_size ;
+	int ret_val = 0 ;
+
+	if (fstat(fd,&file_stat)!=0 || !S_ISREG(file_stat.st_mode) || file_stat.st_size < RECORD_SIZE)
+		return -1 ;
+	map_size = (size_t) file_stat.st_size ;
+
+	if ((map = mmap(NULL,map_size,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED)
+		return -1 ;
+	madvise(map,map_size,MADV_SEQUENTIAL) ;
+
+	if (INCREMENTAL_FLAG)
+		ret_val = scan_incremental(fd,map,map_size,invalid_count) ;
+	else if (strlen(CHECKPOINTFILE)>0)
+		ret_val = scan_checkpointed(fd,map,map_size,invalid_count) ;
+	else if (THREAD_COUNT > 1)
+		ret_val = scan_parallel(fd,map,map_size,invalid_count) ;
+	else if (WRITE_BACK && init_batch(&batch,fd)!=0)
+		ret_val = 1 ;
+	else{
+		*invalid_count += scan_mapping(map,0,map_size - map_size%RECORD_SIZE,&REPORT,&batch) ;
+		if (WRITE_BACK){
+			if (batch_flush(&batch)!=0 || batch.failed > 0)
+				ret_val = 1 ;
+			free_batch(&batch) ;
+		}
+	}
+
+	munmap(map,map_size) ;
+	return ret_val ;
+} ;
+
+/*
+* read_block - read a block, completing short reads through the buffered descriptor
+* + the first read asks for a whole IO_BLOCK, since O_DIRECT only allows aligned
+* lengths and the end of the file simply gives a short read. A short read that
+* is not at the end of the file is finished with plain pread() on data_fd
+* + without O_DIRECT the block is dropped from the page cache once copied
+* (POSIX_FADV_DONTNEED), so the sweep does not fill the page cache at the expense
+* of other applications
+* @buffer destination
+* @offset position of the block in the data file
+* @length bytes wanted (less at the end of the file)
+* @got bytes already in the buffer
+* @return Error encountered while reading
+*/
+int read_block(io_reader_t *reader, char *buffer, size_t offset, size_t length, size_t got){
+	ssize_t n ;
+	int fd = got == 0 ? reader->fd : reader->data_fd ;
+
+	while (got < length){
+		STATS_ADD(read_calls,1) ;
+		if ((n = pread(fd,buffer + got,got == 0 ? IO_BLOCK : length - got,offset + got)) < 0){
+			if (errno == EINTR)
+				continue ;
+			perror("READ ERROR") ;
+			return 1 ;
+		}
+		if (n == 0){
+			fprintf(stderr, "READ ERROR: Unexpected end of file at %zu\n",offset + got) ;
+			return 1 ;
+		}
+		/* The file may have grown since it was opened */
+		got += (size_t) n < length - got ? (size_t) n : length - got ;
+		fd = reader->data_fd ;
+	}
+	if (!reader->direct)
+		posix_fadvise(reader->data_fd,offset,length,POSIX_FADV_DONTNEED) ;
+	return 0 ;
+} ;
+
+/*
+* pread_next - next block of the pread and direct engines
+* @block set to the block read
+* @size set to the bytes in the block, 0 at the end of the file
+* @return Error encountered while reading
+*/
+int pread_next(io_reader_t *reader, char **block, size_t *size){
+	*size = 0 ;
+	if (reader->next_offset >= reader->file_size)
+		return 0 ;
+	*size = reader->file_size - reader->next_offset < IO_BLOCK ? reader->file_size - reader->next_offset : IO_BLOCK ;
+	*block = reader->buffers[0] ;
+	if (read_block(reader,*block,reader->next_offset,*size,0)!=0)
+		return 1 ;
+	reader->next_offset += *size ;
+	reader->sequence++ ;
+	return 0 ;
+} ;
+
+#ifdef HAVE_IO_URING
+/*
+* uring_queue - queue a read of the block at offset into buffer slot
+*/
+void uring_queue(io_reader_t *reader, size_t slot, size_t offset){
+	unsigned tail = *reader->sq_tail, index = tail & *reader->sq_mask ;
+	struct io_uring_sqe *sqe = &reader->sqes[index] ;
+
+	memset(sqe,0,sizeof(*sqe)) ;
+	sqe->opcode = reader->registered ? IORING_OP_READ_FIXED : IORING_OP_READ ;
+	sqe->fd = reader->fd ;
+	sqe->addr = (uint64_t) (uintptr_t) reader->buffers[slot] ;
+	sqe->len = IO_BLOCK ;
+	sqe->off = offset ;
+	sqe->buf_index = reader->registered ? slot : 0 ;
+	sqe->user_data = slot ;
+	reader->sq_array[index] = index ;
+	__atomic_store_n(reader->sq_tail,tail + 1,__ATOMIC_RELEASE) ;
+
+	reader->offsets[slot] = offset ;
+	reader->done[slot] = 0 ;
+	reader->in_flight++ ;
+	return ;
+} ;
+
+/*
+* uring_enter - submit queued reads and optionally wait for one completion
+* + completions are recorded against their buffer slot
+* @return Error returned by io_uring_enter
+*/
+int uring_enter(io_reader_t *reader, unsigned submit, unsigned wait){
+	unsigned head, tail ;
+	struct io_uring_cqe *cqe ;
+
+	STATS_ADD(read_calls,1) ;
+	while (syscall(__NR_io_uring_enter,reader->ring_fd,submit,wait,wait ? IORING_ENTER_GETEVENTS : 0,NULL,0) < 0){
+		if (errno != EINTR){
+			perror("IO_URING ERROR") ;
+			return 1 ;
+		}
+	}
+	head = *reader->cq_head ;
+	tail = __atomic_load_n(reader->cq_tail,__ATOMIC_ACQUIRE) ;
+	for (;head != tail;head++){
+		cqe = &reader->cqes[head & *reader->cq_mask] ;
+		reader->results[cqe->user_data] = cqe->res ;
+		reader->done[cqe->user_data] = 1 ;
+	}
+	__atomic_store_n(reader->cq_head,head,__ATOMIC_RELEASE) ;
+	return 0 ;
+} ;
+
+/*
+* uring_next - next block of the uring engine
+* + the buffer handed out last time is queued again for the next block before
+* waiting, so QUEUE_DEPTH reads stay in flight
+* @block set to the block read
+* @size set to the bytes in the block, 0 at the end of the file
+* @return Error encountered while reading
+*/
+int uring_next(io_reader_t *reader, char **block, size_t *size){
+	size_t slot = reader->sequence % reader->depth, previous ;
+	unsigned submit = 0 ;
+
+	*size = 0 ;
+	if (reader->sequence > 0 && reader->next_offset < reader->file_size){
+		previous = (reader->sequence - 1) % reader->depth ;
+		uring_queue(reader,previous,reader->next_offset) ;
+		reader->next_offset += IO_BLOCK ;
+		submit = 1 ;
+	}
+	if (reader->in_flight == 0)
+		return 0 ;
+	if (uring_enter(reader,submit,0)!=0)
+		return 1 ;
+	while (!reader->done[slot])
+		if (uring_enter(reader,0,1)!=0)
+			return 1 ;
+
+	if (reader->results[slot] < 0){
+		errno = -reader->results[slot] ;
+		perror("READ ERROR") ;
+		return 1 ;
+	}
+	*block = reader->buffers[slot] ;
+	*size = reader->file_size - reader->offsets[slot] < IO_BLOCK ? reader->file_size - reader->offsets[slot] : IO_BLOCK ;
+	if (read_block(reader,*block,reader->offsets[slot],*size,(size_t) reader->results[slot] < *size ? (size_t) reader->results[slot] : *size)!=0)
+		return 1 ;
+	reader->in_flight-- ;
+	reader->sequence++ ;
+	return 0 ;
+} ;
+
+/*
+* open_uring - set up the ring, register the buffers and queue the first reads
+* @return Error setting up io_uring (the caller falls back to pread)
+*/
+int open_uring(io_reader_t *reader){
+	struct io_uring_params params ;
+	struct iovec iov[reader->depth] ;
+	size_t b ;
+
+	memset(&params,0,sizeof(params)) ;
+	if ((reader->ring_fd = syscall(__NR_io_uring_setup,(unsigned) reader->depth,&params)) < 0)
+		return 1 ;
+	reader->sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned) ;
+	reader->cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(struct io_uring_cqe) ;
+	if (params.features & IORING_FEAT_SINGLE_MMAP){
+		if (reader->cq_ring_size > reader->sq_ring_size)
+			reader->sq_ring_size = reader->cq_ring_size ;
+		reader->cq_ring_size = 0 ;
+	}
+	reader->sqes_size = params.sq_entries*sizeof(struct io_uring_sqe) ;
+	reader->sq_ring = mmap(NULL,reader->sq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,reader->ring_fd,IORING_OFF_SQ_RING) ;
+	reader->cq_ring = reader->cq_ring_size == 0 ? reader->sq_ring :
+		mmap(NULL,reader->cq_ring_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,reader->ring_fd,IORING_OFF_CQ_RING) ;
+	reader->sqes = mmap(NULL,reader->sqes_size,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_POPULATE,reader->ring_fd,IORING_OFF_SQES) ;
+	if (reader->sq_ring == MAP_FAILED || reader->cq_ring == MAP_FAILED || reader->sqes == MAP_FAILED){
+		close(reader->ring_fd) ;
+		reader->ring_fd = -1 ;
+		return 1 ;
+	}
+	reader->sq_tail = (unsigned*) ((char*) reader->sq_ring + params.sq_off.tail) ;
+	reader->sq_mask = (unsigned*) ((char*) reader->sq_ring + params.sq_off.ring_mask) ;
+	reader->sq_array = (unsigned*) ((char*) reader->sq_ring + params.sq_off.array) ;
+	reader->cq_head = (unsigned*) ((char*) reader->cq_ring + params.cq_off.head) ;
+	reader->cq_tail = (unsigned*) ((char*) reader->cq_ring + params.cq_off.tail) ;
+	reader->cq_mask = (unsigned*) ((char*) reader->cq_ring + params.cq_off.ring_mask) ;
+	reader->cqes = (struct io_uring_cqe*) ((char*) reader->cq_ring + params.cq_off.cqes) ;
+
+	/* Registered buffers skip the per-read page pinning. Plain reads are used
+	if they cannot be registered (RLIMIT_MEMLOCK) */
+	for (b=0;b<reader->depth;b++){
+		iov[b].iov_base = reader->buffers[b] ;
+		iov[b].iov_len = IO_BLOCK ;
+	}
+	reader->registered = syscall(__NR_io_uring_register,reader->ring_fd,IORING_REGISTER_BUFFERS,iov,(unsigned) reader->depth) == 0 ;
+
+	for (b=0;b<reader->depth && reader->next_offset < reader->file_size;b++){
+		uring_queue(reader,b,reader->next_offset) ;
+		reader->next_offset += IO_BLOCK ;
+	}
+	if (VERBOSE_FLAG)
+		message("io_uring: %zu reads in flight, %s buffers\n",reader->depth,reader->registered ? "registered" : "unregistered") ;
+	return uring_enter(reader,reader->in_flight,0) ;
+} ;
+#endif
+
+/*
+* close_reader - release a block reader
+*/
+void close_reader(io_reader_t *reader){
+	size_t b ;
+
+#ifdef HAVE_IO_URING
+	if (reader->ring_fd >= 0){
+		munmap(reader->sqes,reader->sqes_size) ;
+		if (reader->cq_ring != reader->sq_ring)
+			munmap(reader->cq_ring,reader->cq_ring_size) ;
+		munmap(reader->sq_ring,reader->sq_ring_size) ;
+		/* Closing the ring cancels reads still in flight */
+		close(reader->ring_fd) ;
+	}
+#endif
+	if (reader->fd != reader->data_fd)
+		close(reader->fd) ;
+	for (b=0;reader->buffers!=NULL && b<reader->depth;b++)
+		free(reader->buffers[b]) ;
+	free(reader->buffers) ;
+	free(reader->offsets) ;
+	free(reader->results) ;
+	free(reader->done) ;
+	return ;
+} ;
+
+/*
+* open_reader - set up the block reader of the selected engine
+* + direct and uring read through an O_DIRECT descriptor so the sweep leaves the
+* page cache of other applications alone. Without O_DIRECT (pread engine, file
+* systems without it) read_block() drops each block from the page cache after
+* reading it. POSIX_FADV_NOREUSE is set as well but only acts from Linux 6.3
+* + uring falls back to pread when io_uring is unavailable
+* @fd buffered descriptor of the data file
+* @return Error encountered while setting up the reader
+*/
+int open_reader(io_reader_t *reader, int fd){
+	struct stat file_stat ;
+	size_t b ;
+
+	memset(reader,0,sizeof(*reader)) ;
+	reader->fd = reader->data_fd = fd ;
+	reader->next = pread_next ;
+	reader->close = close_reader ;
+	reader->depth = IO_ENGINE == ENGINE_URING ? QUEUE_DEPTH : 1 ;
+#ifdef HAVE_IO_URING
+	reader->ring_fd = -1 ;
+#endif
+	if (fstat(fd,&file_stat)!=0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	reader->file_size = (size_t) file_stat.st_size ;
+
+	if ((reader->buffers = calloc(reader->depth,sizeof(char*)))==NULL || (reader->offsets = calloc(reader->depth,sizeof(size_t)))==NULL ||
+		(reader->results = calloc(reader->depth,sizeof(int)))==NULL || (reader->done = calloc(reader->depth,1))==NULL){
+		perror("ERROR") ;
+		close_reader(reader) ;
+		return 1 ;
+	}
+	for (b=0;b<reader->depth;b++)
+		if (posix_memalign((void**) &reader->buffers[b],IO_ALIGN,IO_BLOCK)!=0){
+			reader->buffers[b] = NULL ;
+			perror("ERROR") ;
+			close_reader(reader) ;
+			return 1 ;
+		}
+
+	if (IO_ENGINE == ENGINE_DIRECT || IO_ENGINE == ENGINE_URING){
+		if ((reader->fd = open(DATAFILE,O_RDONLY|O_DIRECT)) >= 0)
+			reader->direct = 1 ;
+		else{
+			reader->fd = fd ;
+			if (VERBOSE_FLAG)
+				message("O_DIRECT not supported for %s, reading through the page cache.\n",DATAFILE) ;
+		}
+	}
+	if (!reader->direct)
+		posix_fadvise(reader->fd,0,0,POSIX_FADV_NOREUSE) ;
+
+	if (IO_ENGINE == ENGINE_URING){
+#ifdef HAVE_IO_URING
+		if (open_uring(reader)==0)
+			reader->next = uring_next ;
+		else{
+			if (reader->ring_fd >= 0){
+				close_reader(reader) ;
+				return 1 ;
+			}
+			message("io_uring unavailable, using pread.\n") ;
+		}
+#else
+		message("io_uring unavailable, using pread.\n") ;
+#endif
+	}
+	return 0 ;
+} ;
+
+/*
+* scan_block - full/zero-detection traversal of one block read from the data file
+* + records that straddle two blocks are put together in carry
+* @block block as read from the data file
+* @offset position of the block in the data file
+* @size bytes in the block
+* @carry partial record left over from the previous block (RECORD_SIZE bytes)
+* @carry_size bytes held in carry, updated for the next block
+* @batch write-back batch (update mode)
+* @return Number of invalid characters processed
+*/
+size_t scan_block(const char *block, size_t offset, size_t size, char *carry, size_t *carry_size, write_batch_t *batch){
+	size_t used = 0, whole, invalid_count = 0 ;
+
+	if (*carry_size > 0){
+		used = RECORD_SIZE - *carry_size < size ? RECORD_SIZE - *carry_size : size ;
+		memcpy(carry + *carry_size,block,used) ;
+		*carry_size += used ;
+		if (*carry_size == RECORD_SIZE){
+			invalid_count += scan_records(carry,offset + used - RECORD_SIZE,RECORD_SIZE,&REPORT,batch) ;
+			*carry_size = 0 ;
+		}
+	}
+	whole = (size - used) - (size - used)%RECORD_SIZE ;
+	invalid_count += scan_records(block + used,offset + used,whole,&REPORT,batch) ;
+	if (used + whole < size){
+		*carry_size += size - used - whole ;
+		memcpy(carry,block + used + whole,size - used - whole) ;
+	}
+	return invalid_count ;
+} ;
+
+/*
+* process_file_blocks - full/zero-detection traversal through a block reader
+* (pread, direct and uring engines)
+* + records that straddle two blocks are put together in a separate buffer
+* + a trailing partial record is ignored, same as the other engines
+* @fd descriptor of the opened data file
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing file
+*/
+int process_file_blocks(int fd, size_t *invalid_count){
+	io_reader_t reader ;
+	write_batch_t batch ;
+	char carry[RECORD_SIZE], *block ;
+	size_t size, carry_size = 0, offset = 0 ;
+	uint64_t started ;
+	int ret_val = 0 ;
+
+	if (open_reader(&reader,fd)!=0)
+		return 1 ;
+	if (WRITE_BACK && init_batch(&batch,fd)!=0){
+		reader.close(&reader) ;
+		return 1 ;
+	}
+
+	for (;;){
+		/* Only the read is timed for --adaptive, classification is not device latency */
+		started = STATS_ENABLED || MAX_RATE > 0 ? monotonic_ns() : 0 ;
+		if ((ret_val = reader.next(&reader,&block,&size))!=0 || size == 0)
+			break ;
+		stats_phase(PHASE_READ,started) ;
+		if (MAX_RATE > 0){
+			rate_sample(size,monotonic_ns() - started) ;
+			throttle(size) ;
+		}
+		*invalid_count += scan_block(block,offset,size,carry,&carry_size,&batch) ;
+		offset += size ;
+	}
+
+	if (WRITE_BACK){
+		if (batch_flush(&batch)!=0 || batch.failed > 0)
+			ret_val = 1 ;
+		free_batch(&batch) ;
+	}
+	reader.close(&reader) ;
+	return ret_val ;
+} ;
+
+/*
+* set_sample - quick check of a number of random blocks (--sample)
+* @return Number of blocks invalid
+*/
+int set_sample(const char *param){
+	int ret_val = 0 ;
+	if (is_number((char**)&param) && strtoll(param,(char**)NULL,10) > 0){
+		SAMPLE_BLOCKS = (size_t) strtoll(param,(char**)NULL,10) ;
+		message("Sampling %zu blocks.\n",SAMPLE_BLOCKS) ;
+	}else
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+/*
+* set_sample_fraction - quick check of a share of the data file (--sample-fraction)
+* @return Share invalid (not in 0..1)
+*/
+int set_sample_fraction(const char *param){
+	char *end ;
+	double fraction = strtod(param,&end) ;
+
+	if (end == param || *end != '\0' || fraction <= 0 || fraction > 1)
+		return 1 ;
+	SAMPLE_FRACTION = fraction ;
+	message("Sampling %.2f%% of the data file.\n",fraction*100.0) ;
+	return 0 ;
+} ;
+
+/*
+* set_sample_seed - seed of the block selection, so a quick check can be repeated
+* on the same blocks (--sample-seed)
+* @return Seed invalid (not a positive number)
+*/
+int set_sample_seed(const char *param){
+	char *end ;
+	unsigned long long seed ;
+
+	errno = 0 ;
+	seed = strtoull(param,&end,10) ;
+	if (end == param || *end != '\0' || *param == '-' || errno == ERANGE || seed == 0)
+		return 1 ;
+	SAMPLE_SEED = (uint64_t) seed ;
+	message("Sample seed: %" PRIu64 "\n",SAMPLE_SEED) ;
+	return 0 ;
+} ;
+
+/*
+* sample_random - xorshift64* generator of the block selection
+*/
+uint64_t sample_random(uint64_t *state){
+	*state ^= *state >> 12 ;
+	*state ^= *state << 25 ;
+	*state ^= *state >> 27 ;
+	return *state*2685821657736338717ULL ;
+} ;
+
+/*
+* sample_file - quick check of a data file from random blocks (--sample,
+* --sample-fraction)
+* + the file is cut into SAMPLE_BLOCK blocks of whole records; blocks are drawn
+* without replacement by selection sampling, which yields them in file order so
+* the reads move forward through the file
+* + every block goes through scan_records(), the same classifier and fix_record()
+* rules as the full traversal, with the report silenced and only counted
+* + the rates are ratio estimates over the sampled blocks. The confidence
+* intervals use the variance between blocks (corruption comes in clusters) with
+* the finite population correction. With no dirty record found the rule of three
+* is applied to blocks: at most 3/n of the blocks are dirty, and a dirty block may
+* be dirty throughout
+* + the seed is printed so the same blocks can be drawn again (--sample-seed)
+* @return Error encountered while reading the data file
+*/
+int sample_file( void ){
+	report_counts_t counts ;
+	report_t rep ;
+	struct stat file_stat ;
+	char *buffer = NULL ;
+	size_t per_block, file_records, block_count, wanted, b, got, nrec, dirty, block_dirty, invalid_count = 0 ;
+	size_t sampled = 0, sampled_records = 0 ;
+	double sum_d2 = 0.0, sum_dn = 0.0, sum_n2 = 0.0, rate, se = 0.0, lower, upper, var, mean_n, fpc ;
+	uint64_t seed, state, started = monotonic_ns() ;
+	unsigned char report_level = REPORT_LEVEL ;
+	ssize_t n ;
+	int fd, ret_val = 0 ;
+
+	if ((fd = open(DATAFILE,O_RDONLY))<0 || fstat(fd,&file_stat)!=0){
+		perror("ERROR") ;
+		if (fd >= 0)
+			close(fd) ;
+		return 1 ;
+	}
+	per_block = SAMPLE_BLOCK/RECORD_SIZE > 0 ? SAMPLE_BLOCK/RECORD_SIZE : 1 ;
+	file_records = (size_t) file_stat.st_size/RECORD_SIZE ;
+	block_count = (file_records + per_block - 1)/per_block ;
+	wanted = SAMPLE_BLOCKS > 0 ? SAMPLE_BLOCKS : (size_t) ceil(SAMPLE_FRACTION*block_count) ;
+	if (wanted > block_count)
+		wanted = block_count ;
+	if (wanted == 0){
+		message("No whole records in %s to sample.\n",DATAFILE) ;
+		close(fd) ;
+		return 1 ;
+	}
+	if (init_counts(&counts)!=0 || (buffer = malloc(per_block*RECORD_SIZE))==NULL){
+		perror("ERROR") ;
+		free(buffer) ;
+		free_counts(&counts) ;
+		close(fd) ;
+		return 1 ;
+	}
+	posix_fadvise(fd,0,0,POSIX_FADV_RANDOM) ;
+	rep.out = LOG ;
+	rep.counts = &counts ;
+	REPORT_LEVEL = REPORT_SUMMARY ;
+	seed = SAMPLE_SEED > 0 ? SAMPLE_SEED : (started ^ ((uint64_t) getpid() << 32)) ;
+	state = seed | 1 ;
+
+	for (b=0;b<block_count && sampled<wanted && ret_val==0;b++){
+		/* Block b is taken with probability (still wanted)/(blocks left) */
+		if ((sample_random(&state) >> 11)*(1.0/9007199254740992.0)*(block_count - b) >= wanted - sampled)
+			continue ;
+		nrec = file_records - b*per_block < per_block ? file_records - b*per_block : per_block ;
+		for (got=0;got<nrec*RECORD_SIZE;got+=n){
+			STATS_ADD(read_calls,1) ;
+			if ((n = pread(fd,buffer + got,nrec*RECORD_SIZE - got,b*per_block*RECORD_SIZE + got)) <= 0){
+				perror("READ ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+		}
+		if (ret_val != 0)
+			break ;
+		throttle(nrec*RECORD_SIZE) ;
+		dirty = counts.dirty_records ;
+		invalid_count += scan_records(buffer,b*per_block*RECORD_SIZE,nrec*RECORD_SIZE,&rep,NULL) ;
+		block_dirty = counts.dirty_records - dirty ;
+		sum_d2 += (double) block_dirty*block_dirty ;
+		sum_dn += (double) block_dirty*nrec ;
+		sum_n2 += (double) nrec*nrec ;
+		sampled_records += nrec ;
+		sampled++ ;
+	}
+	REPORT_LEVEL = report_level ;
+	close(fd) ;
+	free(buffer) ;
+
+	if (ret_val==0){
+		rate = (double) counts.dirty_records/sampled_records ;
+		mean_n = (double) sampled_records/sampled ;
+		fpc = 1.0 - (double) sampled/block_count ;
+		if (sampled > 1){
+			var = (sum_d2 - 2.0*rate*sum_dn + rate*rate*sum_n2)/(sampled - 1) ;
+			se = sqrt(fpc*(var > 0 ? var : 0.0)/sampled)/mean_n ;
+		}else
+			se = sqrt(fpc*rate*(1.0 - rate)/sampled_records) ;
+		lower = rate - SAMPLE_Z*se > 0 ? rate - SAMPLE_Z*se : 0.0 ;
+		upper = rate + SAMPLE_Z*se < 1 ? rate + SAMPLE_Z*se : 1.0 ;
+		/* Corruption is clustered: the rule of three holds for blocks, not records */
+		if (counts.dirty_records == 0)
+			upper = fpc > 0 ? (3.0 < sampled ? 3.0/sampled : 1.0) : 0.0 ;
+
+		message("Sampled %zu of %zu blocks: %zu of %zu records (%.2f%%) in %.3f s (seed %" PRIu64 ")\n",sampled,block_count,sampled_records,file_records,
+			100.0*sampled_records/file_records,(monotonic_ns() - started)/1e9,seed) ;
+		message("Records with invalid characters: %zu sampled, %.3f%% (95%% CI %.3f%% - %.3f%%)\n",counts.dirty_records,100.0*rate,100.0*lower,100.0*upper) ;
+		message("Estimated in the file: %.0f records with invalid characters (%.0f - %.0f), %.0f deleted (0x00 threshold), %.0f invalid characters\n",
+			rate*file_records,lower*file_records,upper*file_records,(double) counts.deleted_records*file_records/sampled_records,
+			(double) invalid_count*file_records/sampled_records) ;
+		if (counts.dirty_records == 0 && upper*file_records < 1.0)
+			message("Recommendation: no full scan needed, the sample covers the file and it is clean.\n") ;
+		else if (counts.dirty_records == 0)
+			message("Recommendation: likely clean (fewer than %.0f of %zu blocks with invalid characters at 95%% confidence). Sample more or scan when convenient.\n",
+				ceil(upper*block_count),block_count) ;
+		else
+			message("Recommendation: full scan, about %.0f records need repair.\n",rate*file_records) ;
+	}
+	INVALID_COUNT = invalid_count ;
+	free_counts(&counts) ;
+	return ret_val ;
+} ;
+
+/*
+* ring_pop - take the next slot index from a pipeline ring, waiting while it is
+* empty (spin briefly, then sleep in short steps)
+*/
+size_t ring_pop(spsc_ring_t *ring){
+	size_t tail = __atomic_load_n(&ring->tail,__ATOMIC_RELAXED), value ;
+	struct timespec pause = { 0, PIPELINE_SLEEP } ;
+	unsigned spins = 0 ;
+
+	while (__atomic_load_n(&ring->head,__ATOMIC_ACQUIRE) == tail){
+		if (++spins < PIPELINE_SPINS){
+#if defined(__x86_64__) || defined(__i386__)
+			_mm_pause() ;
+#endif
+		}else
+			nanosleep(&pause,NULL) ;
+	}
+	value = ring->slots[tail % PIPELINE_RING] ;
+	__atomic_store_n(&ring->tail,tail + 1,__ATOMIC_RELEASE) ;
+	return value ;
+} ;
+
+/*
+* ring_push - hand a slot index to the consumer of a pipeline ring
+* + never waits: a ring holds more slots than the pool circulating through it
+*/
+void ring_push(spsc_ring_t *ring, size_t value){
+	size_t head = __atomic_load_n(&ring->head,__ATOMIC_RELAXED) ;
+
+	ring->slots[head % PIPELINE_RING] = value ;
+	__atomic_store_n(&ring->head,head + 1,__ATOMIC_RELEASE) ;
+	return ;
+} ;
+
+/*
+* pipeline_reader - reader stage: fills free blocks in file order
+* + the last block pushed has size 0 (failed set on a read error)
+*/
+void *pipeline_reader(void *arg){
+	pipeline_t *pipeline = (pipeline_t*) arg ;
+	pipeline_block_t *block ;
+	size_t offset = 0, b ;
+	uint64_t started ;
+
+	CTX = pipeline->ctx ;
+	do{
+		b = ring_pop(&pipeline->free_blocks) ;
+		started = stats_clock() ;
+		block = &pipeline->blocks[b] ;
+		block->offset = offset ;
+		block->size = pipeline->reader.file_size - offset < IO_BLOCK ? pipeline->reader.file_size - offset : IO_BLOCK ;
+		block->failed = 0 ;
+		if (MAX_RATE > 0)
+			started = monotonic_ns() ;	// the read alone is the --adaptive sample
+		if (block->size > 0 && read_block(&pipeline->reader,block->data,offset,block->size,0)!=0){
+			block->size = 0 ;
+			block->failed = 1 ;
+		}
+		offset += block->size ;
+		stats_phase(PHASE_READ,started) ;
+		if (MAX_RATE > 0){
+			rate_sample(block->size,monotonic_ns() - started) ;
+			throttle(block->size) ;
+		}
+		ring_push(&pipeline->full_blocks,b) ;
+	}while (block->size > 0) ;
+	return NULL ;
+} ;
+
+/*
+* pipeline_writer - writer stage: writes back (and journals) full batches until
+* PIPELINE_END
+*/
+void *pipeline_writer(void *arg){
+	pipeline_t *pipeline = (pipeline_t*) arg ;
+	size_t b ;
+
+	CTX = pipeline->ctx ;
+	while ((b = ring_pop(&pipeline->full_batches)) != PIPELINE_END){
+		if (batch_flush(&pipeline->batches[b])!=0)
+			pipeline->write_failed = 1 ;
+		ring_push(&pipeline->free_batches,b) ;
+	}
+	return NULL ;
+} ;
+
+/*
+* process_file_pipeline - full/zero-detection traversal as a pipeline (--pipeline)
+* + a reader thread reads IO_BLOCK blocks (pread, O_DIRECT with -e direct) ahead
+* of the classifier on this thread, which checks and repairs records and writes
+* the report. Repairs go to a writer thread in whole batches, so neither reads
+* nor write-back wait for classification
+* + stages are linked by single-producer/single-consumer rings of block and batch
+* indexes. Blocks and batches are allocated once and recycled
+* @fd descriptor of the opened data file
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing file, or -1 if the pipeline could
+* not be started and the stdio traversal should be used instead
+*/
+int process_file_pipeline(int fd, size_t *invalid_count){
+	pipeline_t *pipeline ;
+	pipeline_block_t *block ;
+	write_batch_t *batch = NULL ;
+	char carry[RECORD_SIZE] ;
+	size_t carry_size = 0, b, current = 0, batch_count = 0 ;
+	pthread_t reader_thread, writer_thread ;
+	int ret_val = 0 ;
+
+	if ((pipeline = calloc(1,sizeof(pipeline_t)))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	pipeline->ctx = CTX ;
+	if (open_reader(&pipeline->reader,fd)!=0){
+		free(pipeline) ;
+		return 1 ;
+	}
+	for (b=0;ret_val==0 && b<PIPELINE_BLOCKS;b++){
+		if (posix_memalign((void**) &pipeline->blocks[b].data,IO_ALIGN,IO_BLOCK)!=0){
+			pipeline->blocks[b].data = NULL ;
+			perror("ERROR") ;
+			ret_val = 1 ;
+		}else
+			ring_push(&pipeline->free_blocks,b) ;
+	}
+	for (b=0;ret_val==0 && WRITE_BACK && b<PIPELINE_BATCHES;b++){
+		if (init_batch(&pipeline->batches[b],fd)!=0)
+			ret_val = 1 ;
+		else if (b > 0)
+			ring_push(&pipeline->free_batches,b) ;
+		batch_count = b + 1 ;
+	}
+
+	if (ret_val==0 && pthread_create(&reader_thread,NULL,pipeline_reader,pipeline)!=0)
+		ret_val = -1 ;
+	else if (ret_val==0 && WRITE_BACK && pthread_create(&writer_thread,NULL,pipeline_writer,pipeline)!=0){
+		/* Let the reader run out before falling back */
+		while (pipeline->blocks[b = ring_pop(&pipeline->full_blocks)].size > 0)
+			ring_push(&pipeline->free_blocks,b) ;
+		pthread_join(reader_thread,NULL) ;
+		ret_val = -1 ;
+	}
+	if (ret_val < 0)
+		message("Unable to start the pipeline, using stdio.\n") ;
+
+	if (ret_val==0){
+		if (WRITE_BACK)
+			batch = &pipeline->batches[current] ;
+		for (;;){
+			block = &pipeline->blocks[b = ring_pop(&pipeline->full_blocks)] ;
+			if (block->size == 0){
+				ret_val = block->failed ;
+				break ;
+			}
+			*invalid_count += scan_block(block->data,block->offset,block->size,carry,&carry_size,batch) ;
+			ring_push(&pipeline->free_blocks,b) ;
+
+			/* Hand the batch over before the next block could fill it up */
+			if (batch != NULL && batch->count > 0 && batch->count + IO_BLOCK/RECORD_SIZE + 1 >= batch->capacity){
+				ring_push(&pipeline->full_batches,current) ;
+				batch = &pipeline->batches[current = ring_pop(&pipeline->free_batches)] ;
+			}
+		}
+		pthread_join(reader_thread,NULL) ;
+		if (WRITE_BACK){
+			if (batch->count > 0)
+				ring_push(&pipeline->full_batches,current) ;
+			ring_push(&pipeline->full_batches,PIPELINE_END) ;
+			pthread_join(writer_thread,NULL) ;
+			if (pipeline->write_failed)
+				ret_val = 1 ;
+		}
+	}
+
+	for (b=0;b<batch_count;b++){
+		if (pipeline->batches[b].failed > 0)
+			ret_val = ret_val < 0 ? ret_val : 1 ;
+		free_batch(&pipeline->batches[b]) ;
+	}
+	for (b=0;b<PIPELINE_BLOCKS;b++)
+		free(pipeline->blocks[b].data) ;
+	pipeline->reader.close(&pipeline->reader) ;
+	free(pipeline) ;
+	return ret_val ;
+} ;
+
+/*
+* xxh64 - XXH64 hash of a buffer (manifest block checksums)
+*/
+#define	XXH_PRIME1 11400714785074694791ULL
+#define	XXH_PRIME2 14029467366897019727ULL
+#define	XXH_PRIME3 1609587929392839161ULL
+#define	XXH_PRIME4 9650029242287828579ULL
+#define	XXH_PRIME5 2870177450012600261ULL
+#define	XXH_ROTL(x,r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t xxh64_round(uint64_t acc, uint64_t input){
+	acc += input*XXH_PRIME2 ;
+	return XXH_ROTL(acc,31)*XXH_PRIME1 ;
+} ;
+
+static inline uint64_t xxh64_merge(uint64_t acc, uint64_t val){
+	acc ^= xxh64_round(0,val) ;
+	return acc*XXH_PRIME1 + XXH_PRIME4 ;
+} ;
+
+uint64_t xxh64(const void *data, size_t size, uint64_t seed){
+	const unsigned char *p = (const unsigned char*) data, *end = p + size ;
+	uint64_t v1, v2, v3, v4, h, k ;
+	uint32_t k32 ;
+
+	if (size >= 32){
+		v1 = seed + XXH_PRIME1 + XXH_PRIME2 ;
+		v2 = seed + XXH_PRIME2 ;
+		v3 = seed ;
+		v4 = seed - XXH_PRIME1 ;
+		do{
+			memcpy(&k,p,8) ; v1 = xxh64_round(v1,k) ;
+			memcpy(&k,p + 8,8) ; v2 = xxh64_round(v2,k) ;
+			memcpy(&k,p + 16,8) ; v3 = xxh64_round(v3,k) ;
+			memcpy(&k,p + 24,8) ; v4 = xxh64_round(v4,k) ;
+			p += 32 ;
+		}while (p + 32 <= end) ;
+		h = XXH_ROTL(v1,1) + XXH_ROTL(v2,7) + XXH_ROTL(v3,12) + XXH_ROTL(v4,18) ;
+		h = xxh64_merge(h,v1) ;
+		h = xxh64_merge(h,v2) ;
+		h = xxh64_merge(h,v3) ;
+		h = xxh64_merge(h,v4) ;
+	}else
+		h = seed + XXH_PRIME5 ;
+	h += (uint64_t) size ;
+
+	for (;p + 8 <= end;p += 8){
+		memcpy(&k,p,8) ;
+		h ^= xxh64_round(0,k) ;
+		h = XXH_ROTL(h,27)*XXH_PRIME1 + XXH_PRIME4 ;
+	}
+	if (p + 4 <= end){
+		memcpy(&k32,p,4) ;
+		h ^= (uint64_t) k32*XXH_PRIME1 ;
+		h = XXH_ROTL(h,23)*XXH_PRIME2 + XXH_PRIME3 ;
+		p += 4 ;
+	}
+	for (;p < end;p++){
+		h ^= (*p)*XXH_PRIME5 ;
+		h = XXH_ROTL(h,11)*XXH_PRIME1 ;
+	}
+	h ^= h >> 33 ;
+	h *= XXH_PRIME2 ;
+	h ^= h >> 29 ;
+	h *= XXH_PRIME3 ;
+	h ^= h >> 32 ;
+	return h ;
+} ;
+
+/*
+* manifest_config - hash of the settings that decide whether a block is clean
+* + a manifest written with other settings is ignored
+*/
+uint64_t manifest_config( void ){
+	uint64_t settings[4] = { RECORD_SIZE, FULL_DETECTION_FLAG, ZERO_DETECTION_FLAG, DELETE_NULL_THRESHOLD } ;
+	uint64_t hash ;
+
+	hash = xxh64(settings,sizeof(settings),0) ;
+	hash = xxh64(TRANSLATE_VALID,sizeof(TRANSLATE_VALID),hash) ;
+	if (COLUMN_CLASS != NULL)
+		hash = xxh64(COLUMN_CLASS,RECORD_SIZE,hash) ;
+	return hash ;
+} ;
+
+/*
+* scan_incremental - full/zero-detection traversal that skips blocks unchanged
+* since the last clean run (-m)
+* + the file is split into blocks of whole records. The sidecar manifest
+* (DATAFILE.ffm) keeps the xxh64 of every block and whether it was clean
+* + an unchanged size and mtime with every block clean skips the file outright.
+* Otherwise blocks are hashed and only changed, appended or previously dirty
+* blocks are classified
+* + the manifest is rewritten after a successful run. Blocks with invalid
+* characters are recorded as dirty so they are checked again (repaired blocks
+* are confirmed clean by the next run)
+* @return Error encountered while processing file
+*/
+int scan_incremental(int fd, char *map, size_t map_size, size_t *invalid_count){
+	char manifest_path[ARRAY_SIZE], manifest_tmp[ARRAY_SIZE] ;
+	manifest_header_t header, stored ;
+	manifest_block_t *blocks = NULL, *old_blocks = NULL ;
+	write_batch_t batch ;
+	struct stat file_stat ;
+	size_t scan_size = map_size - map_size%RECORD_SIZE, block_count, b, run_end, changed = 0, old_count = 0 ;
+	int manifest_fd, ret_val = 0, unchanged ;
+	FILE *manifest ;
+
+	if (snprintf(manifest_path,ARRAY_SIZE,"%s%s",DATAFILE,MANIFEST_SUFFIX) >= ARRAY_SIZE ||
+		snprintf(manifest_tmp,ARRAY_SIZE,"%s%s.tmp",DATAFILE,MANIFEST_SUFFIX) >= ARRAY_SIZE){
+		fprintf(stderr, "ERROR: Manifest path too long.\n") ;
+		return 1 ;
+	}
+	fstat(fd,&file_stat) ;
+	MANIFEST_BLOCK_BYTES = MANIFEST_BLOCK/RECORD_SIZE > 0 ? (MANIFEST_BLOCK/RECORD_SIZE)*RECORD_SIZE : RECORD_SIZE ;
+	block_count = (scan_size + MANIFEST_BLOCK_BYTES - 1)/MANIFEST_BLOCK_BYTES ;
+
+	memset(&header,0,sizeof(header)) ;
+	memcpy(header.magic,MANIFEST_MAGIC,sizeof(MANIFEST_MAGIC)) ;
+	header.record_size = RECORD_SIZE ;
+	header.block_bytes = MANIFEST_BLOCK_BYTES ;
+	header.config_hash = manifest_config() ;
+	header.block_count = block_count ;
+
+	/* Previous manifest, if it was written with the same settings */
+	memset(&stored,0,sizeof(stored)) ;
+	if ((manifest = fopen(manifest_path,"rb"))!=NULL){
+		if (fread(&stored,sizeof(stored),1,manifest)==1 && memcmp(stored.magic,header.magic,sizeof(header.magic))==0 &&
+			stored.record_size==header.record_size && stored.block_bytes==header.block_bytes && stored.config_hash==header.config_hash &&
+			(old_blocks = malloc(stored.block_count*sizeof(manifest_block_t) + 1))!=NULL &&
+			fread(old_blocks,sizeof(manifest_block_t),stored.block_count,manifest)==stored.block_count)
+			old_count = stored.block_count ;
+		fclose(manifest) ;
+	}
+
+	if ((blocks = calloc(block_count + 1,sizeof(manifest_block_t)))==NULL || (MANIFEST_DIRTY = calloc(block_count + 1,1))==NULL){
+		perror("ERROR") ;
+		free(blocks) ;
+		free(old_blocks) ;
+		return 1 ;
+	}
+
+	/* Quick check: same size and mtime as a fully clean run */
+	unchanged = old_count > 0 && old_count == block_count && stored.file_size == (uint64_t) file_stat.st_size &&
+		stored.mtime_sec == (int64_t) file_stat.st_mtim.tv_sec && stored.mtime_nsec == (int64_t) file_stat.st_mtim.tv_nsec ;
+	for (b=0;unchanged && b<old_count;b++)
+		unchanged = old_blocks[b].clean ;
+
+	if (unchanged)
+		memcpy(blocks,old_blocks,block_count*sizeof(manifest_block_t)) ;
+	else{
+		for (b=0;b<block_count;b++){
+			blocks[b].hash = xxh64(map + b*MANIFEST_BLOCK_BYTES,
+				(b + 1)*MANIFEST_BLOCK_BYTES <= scan_size ? MANIFEST_BLOCK_BYTES : scan_size - b*MANIFEST_BLOCK_BYTES,0) ;
+			/* Blocks left unchanged and clean are not checked again */
+			MANIFEST_DIRTY[b] = b >= old_count || !old_blocks[b].clean || old_blocks[b].hash != blocks[b].hash ;
+			changed += MANIFEST_DIRTY[b] ;
+		}
+	}
+	message("Incremental scan: %zu of %zu blocks changed\n",changed,block_count) ;
+
+	if (changed == block_count && changed > 0 && THREAD_COUNT > 1){
+		memset(MANIFEST_DIRTY,0,block_count) ;
+		ret_val = scan_parallel(fd,map,map_size,invalid_count) ;
+	}else if (changed > 0){
+		if (WRITE_BACK && init_batch(&batch,fd)!=0)
+			ret_val = 1 ;
+		/* Runs of changed blocks; the flags are reset to record what the scan finds */
+		for (b=0;ret_val==0 && b<block_count;b=run_end){
+			if (!MANIFEST_DIRTY[b]){
+				run_end = b + 1 ;
+				continue ;
+			}
+			for (run_end=b;run_end<block_count && MANIFEST_DIRTY[run_end];run_end++)
+				MANIFEST_DIRTY[run_end] = 0 ;
+			*invalid_count += scan_mapping(map,b*MANIFEST_BLOCK_BYTES,
+				run_end*MANIFEST_BLOCK_BYTES < scan_size ? run_end*MANIFEST_BLOCK_BYTES : scan_size,&REPORT,&batch) ;
+		}
+		if (WRITE_BACK && ret_val==0){
+			if (batch_flush(&batch)!=0 || batch.failed > 0)
+				ret_val = 1 ;
+			free_batch(&batch) ;
+		}
+	}
+
+	/* New manifest, replaced atomically */
+	if (ret_val==0){
+		fstat(fd,&file_stat) ;
+		header.file_size = (uint64_t) file_stat.st_size ;
+		header.mtime_sec = (int64_t) file_stat.st_mtim.tv_sec ;
+		header.mtime_nsec = (int64_t) file_stat.st_mtim.tv_nsec ;
+		for (b=0;b<block_count;b++)
+			blocks[b].clean = !MANIFEST_DIRTY[b] ;
+		if ((manifest_fd = open(manifest_tmp,O_WRONLY|O_CREAT|O_TRUNC,0644)) < 0 ||
+			write(manifest_fd,&header,sizeof(header)) != (ssize_t) sizeof(header) ||
+			write(manifest_fd,blocks,block_count*sizeof(manifest_block_t)) != (ssize_t) (block_count*sizeof(manifest_block_t)) ||
+			close(manifest_fd)!=0 || rename(manifest_tmp,manifest_path)!=0){
+			perror("MANIFEST ERROR") ;
+			unlink(manifest_tmp) ;
+		}
+	}
+
+	free(MANIFEST_DIRTY) ;
+	MANIFEST_DIRTY = NULL ;
+	free(blocks) ;
+	free(old_blocks) ;
+	return ret_val ;
+} ;
+
+/*
+* check_record - invalid character check of a record at a reported position
+* + reports every invalid character and builds the replacement record in writebuf
+* @buffer record as read from the data file (RECORD_SIZE bytes)
+* @writebuf replacement record (RECORD_SIZE bytes)
+* @current_pos position of the record in the data file
+* @rep report receiving the record's events
+* @return Number of invalid characters processed in the record
+*/
+size_t check_record(const char *buffer, char *writebuf, size_t current_pos, report_t *rep){
+	int i ;
+	size_t w, invalid_count = 0 ;
+	uint64_t bits[(RECORD_SIZE+63)/64], mask, started = stats_clock() ;
+	unsigned char get_char ;
+
+	memcpy(writebuf,buffer,RECORD_SIZE*sizeof(char)) ;
+
+	CTX->invalid_bitmap(buffer,bits) ;
+	for (w=0;w<(RECORD_SIZE+63)/64;w++){
+		for (mask=bits[w];mask!=0;mask&=mask-1){
+			i = w*64 + __builtin_ctzll(mask) ;
+			get_char = buffer[i] ;
+			report_invalid(rep,current_pos,i,get_char) ;
+			invalid_count++ ;
+			writebuf[i] = (char) fill_value(get_char,i) ;
+		}
+	}
+	report_position_done(rep,current_pos,invalid_count) ;
+	if (STATS_ENABLED){
+		STATS_ADD(records,1) ;
+		STATS_ADD(bytes,RECORD_SIZE) ;
+		STATS_ADD(dirty,invalid_count > 0) ;
+		stats_phase(PHASE_FIX,started) ;
+	}
+	return invalid_count ;
+} ;
+
+/*
+* compare_positions - qsort comparator ordering positions by file position, then input order
+*/
+int compare_positions(const void *a, const void *b){
+	const position_t *pa = (const position_t*) a, *pb = (const position_t*) b ;
+
+	if (pa->pos != pb->pos)
+		return pa->pos < pb->pos ? -1 : 1 ;
+	return pa->order < pb->order ? -1 : (pa->order > pb->order) ;
+} ;
+
+/*
+* compare_order - qsort comparator ordering positions by input order
+*/
+int compare_order(const void *a, const void *b){
+	const position_t *pa = *(const position_t**) a, *pb = *(const position_t**) b ;
+
+	return pa->order < pb->order ? -1 : (pa->order > pb->order) ;
+} ;
+
+/*
+* load_positions - load the record positions set with -p and -i
+* + the single position (-p) comes first, followed by the input file in line order
+* + positions are returned sorted by file position with duplicates removed
+* @input_file opened input file, or NULL (closed once read)
+* @positions set to a malloc'd array of positions (caller frees)
+* @count set to the number of positions
+* + any invalid or out of range line fails the whole load, so a damaged list
+* never gets half processed
+* @return Invalid position encountered
+*/
+int load_positions(FILE *input_file, position_t **positions, size_t *count){
+	char *contents = NULL, *line, *line_end, *grown ;
+	size_t contents_size = 0, capacity = ARRAY_SIZE, read_size, line_number = 0, i, unique ;
+	unsigned long long value ;
+	position_t *list, *grown_list ;
+	int ret_val = 0 ;
+
+	*count = 0 ;
+	if ((list = malloc(capacity*sizeof(position_t)))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if (POSITION_SET){
+		list[0].pos = RECORD_POSITION ;
+		list[0].order = 0 ;
+		*count = 1 ;
+	}
+
+	if (input_file != NULL){
+		/* Read the whole input file, then parse it in place */
+		do{
+			if ((grown = realloc(contents,contents_size + ARRAY_SIZE*ARRAY_SIZE + 1))==NULL){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			contents = grown ;
+			read_size = fread(contents + contents_size,sizeof(char),ARRAY_SIZE*ARRAY_SIZE,input_file) ;
+			contents_size += read_size ;
+		}while (read_size == ARRAY_SIZE*ARRAY_SIZE) ;
+		fclose(input_file) ;
+
+		for (line=contents;ret_val==0 && line < contents + contents_size;line = line_end + 1){
+			if ((line_end = memchr(line,'\n',contents + contents_size - line))==NULL)
+				line_end = contents + contents_size ;
+			*line_end = '\0' ;
+			line_number++ ;
+			if (line == line_end)
+				continue ;
+
+			for (i=0;line + i < line_end && line[i]>='0' && line[i]<='9';i++) ;
+			errno = 0 ;
+			value = line + i == line_end ? strtoull(line,(char**)NULL,10) : 0 ;
+			if (line + i != line_end || errno == ERANGE || value > SIZE_MAX){
+				message("Input file position (%s) on line %zu is invalid.\n",line,line_number) ;
+				ret_val = 1 ;
+				break ;
+			}
+
+			if (*count == capacity){
+				capacity *= 2 ;
+				if ((grown_list = realloc(list,capacity*sizeof(position_t)))==NULL){
+					perror("ERROR") ;
+					ret_val = 1 ;
+					break ;
+				}
+				list = grown_list ;
+			}
+			list[*count].pos = (size_t) value ;
+			list[*count].order = *count ;
+			(*count)++ ;
+		}
+		free(contents) ;
+	}
+
+	/* Sort by file position and drop duplicates, keeping the first occurrence */
+	qsort(list,*count,sizeof(position_t),compare_positions) ;
+	for (i=0,unique=0;i<*count;i++){
+		if (unique > 0 && list[unique - 1].pos == list[i].pos)
+			continue ;
+		list[unique] = list[i] ;
+		list[unique].report = NULL ;
+		list[unique].report_size = 0 ;
+		unique++ ;
+	}
+	*count = unique ;
+	*positions = list ;
+	return ret_val ;
+} ;
+
+/*
+* process_positions - check the records at the given positions for invalid characters
+* + positions that are at most COALESCE_GAP bytes apart and do not overlap are read
+* as one group with a single preadv. Overlapping positions start a new group so they
+* see the repairs made before them
+* + repairs are written back in batches (see batch_flush())
+* + the report follows the input order, or file order with -s
+* @fd descriptor of the data file
+* @positions positions sorted by file position, without duplicates
+* @count number of positions
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing positions
+*/
+int process_positions(int fd, position_t *positions, size_t count, size_t *invalid_count){
+	struct iovec iov[2*COALESCE_RECORDS] ;
+	size_t first, last, r, niov, offset, available, span_end ;
+	size_t seg_start[COALESCE_RECORDS], seg_end[COALESCE_RECORDS], upd_start[COALESCE_RECORDS], upd_end[COALESCE_RECORDS] ;
+	char *records = NULL, *repairs = NULL, *gap = NULL, *report = NULL, *updates = NULL ;
+	unsigned char dirty[COALESCE_RECORDS] ;
+	size_t report_size = 0, updates_size = 0, text_size ;
+	position_t **by_order ;
+	report_t group, group_updates ;
+	write_batch_t batch ;
+	ssize_t read_size ;
+	uint64_t started ;
+	int ret_val = 0 ;
+
+	if (WRITE_BACK && init_batch(&batch,fd)!=0)
+		return 1 ;
+	records = malloc(COALESCE_RECORDS*RECORD_SIZE) ;
+	repairs = malloc(COALESCE_RECORDS*RECORD_SIZE) ;
+	gap = malloc(COALESCE_GAP) ;
+	if (records==NULL || repairs==NULL || gap==NULL){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+
+	for (first=0;ret_val==0 && first<count;first=last){
+		/* Group non-overlapping positions that are close enough to be read together */
+		span_end = positions[first].pos + RECORD_SIZE ;
+		iov[0].iov_base = records ;
+		iov[0].iov_len = RECORD_SIZE ;
+		for (last=first + 1,niov=1;last<count && last - first < COALESCE_RECORDS;last++){
+			if (positions[last].pos < span_end || positions[last].pos - span_end > COALESCE_GAP)
+				break ;
+			if (positions[last].pos > span_end){
+				iov[niov].iov_base = gap ;
+				iov[niov++].iov_len = positions[last].pos - span_end ;
+			}
+			iov[niov].iov_base = records + (last - first)*RECORD_SIZE ;
+			iov[niov++].iov_len = RECORD_SIZE ;
+			span_end = positions[last].pos + RECORD_SIZE ;
+		}
+		/* Overlapping records must be read with earlier repairs applied */
+		if (UPDATE_FLAG && batch_covers(&batch,positions[first].pos))
+			batch_flush(&batch) ;
+		started = stats_clock() ;
+		read_size = preadv(fd,iov,niov,positions[first].pos) ;
+		STATS_ADD(read_calls,1) ;
+		stats_phase(PHASE_READ,started) ;
+		if (PATCH_OUT != NULL && read_size >= (ssize_t) RECORD_SIZE && batch_covers(&batch,positions[first].pos))
+			batch_overlay(&batch,records,positions[first].pos) ;
+		throttle(span_end - positions[first].pos) ;
+
+		/* Report events of the group are collected in memory, "updated" events
+		separately as they are only known once the group is checked */
+		group.counts = group_updates.counts = REPORT.counts ;
+		if ((group.out = open_memstream(&report,&report_size))==NULL || (group_updates.out = open_memstream(&updates,&updates_size))==NULL){
+			perror("ERROR") ;
+			ret_val = 1 ;
+			break ;
+		}
+		for (r=0;r<last - first;r++){
+			seg_start[r] = ftello(group.out) ;
+			dirty[r] = 0 ;
+			report_position(&group,positions[first + r].pos) ;
+			offset = positions[first + r].pos - positions[first].pos ;
+			available = read_size > (ssize_t) offset ? (size_t) read_size - offset : 0 ;
+			if (available < RECORD_SIZE){
+				fprintf(stderr, "ERROR: %d bytes of %zu read.\n",(int) available,RECORD_SIZE) ;
+				if (read_size >= 0)
+					fprintf(stderr, "Hit end of file (EOF)!\n");
+				else
+					fprintf(stderr, "An unknown error interrupted read!\n");
+			}else{
+				*invalid_count += check_record(records + r*RECORD_SIZE,repairs + r*RECORD_SIZE,positions[first + r].pos,&group) ;
+				dirty[r] = WRITE_BACK && memcmp(records + r*RECORD_SIZE,repairs + r*RECORD_SIZE,RECORD_SIZE*sizeof(char))!=0 ;
+			}
+			seg_end[r] = ftello(group.out) ;
+		}
+		fclose(group.out) ;
+
+		for (r=0;r<last - first;r++){
+			upd_start[r] = ftello(group_updates.out) ;
+			if (dirty[r]){
+				batch_add(&batch,positions[first + r].pos,records + r*RECORD_SIZE,repairs + r*RECORD_SIZE) ;
+				report_updated(&group_updates,positions[first + r].pos) ;
+			}
+			upd_end[r] = ftello(group_updates.out) ;
+		}
+		fclose(group_updates.out) ;
+
+		for (r=0;r<last - first;r++){
+			if (SORTED_REPORT_FLAG){
+				fwrite(report + seg_start[r],sizeof(char),seg_end[r] - seg_start[r],REPORT.out) ;
+				fwrite(updates + upd_start[r],sizeof(char),upd_end[r] - upd_start[r],REPORT.out) ;
+				continue ;
+			}
+			/* Kept until all groups are done to be written in input order */
+			text_size = seg_end[r] - seg_start[r] ;
+			positions[first + r].report_size = text_size + upd_end[r] - upd_start[r] ;
+			if (positions[first + r].report_size == 0)
+				continue ;
+			if ((positions[first + r].report = malloc(positions[first + r].report_size))==NULL){
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			memcpy(positions[first + r].report,report + seg_start[r],text_size) ;
+			memcpy(positions[first + r].report + text_size,updates + upd_start[r],upd_end[r] - upd_start[r]) ;
+		}
+		free(report) ;
+		free(updates) ;
+		report = updates = NULL ;
+	}
+	if (WRITE_BACK){
+		if (batch_flush(&batch)!=0 || batch.failed > 0)
+			ret_val = 1 ;
+		free_batch(&batch) ;
+	}
+
+	if (!SORTED_REPORT_FLAG && (by_order = malloc(count*sizeof(position_t*)))!=NULL){
+		for (r=0;r<count;r++)
+			by_order[r] = &positions[r] ;
+		qsort(by_order,count,sizeof(position_t*),compare_order) ;
+		for (r=0;r<count;r++)
+			if (by_order[r]->report != NULL)
+				fwrite(by_order[r]->report,sizeof(char),by_order[r]->report_size,REPORT.out) ;
+		free(by_order) ;
+	}
+	for (r=0;r<count;r++)
+		free(positions[r].report) ;
+
+	free(records) ;
+	free(repairs) ;
+	free(gap) ;
+	return ret_val ;
+} ;
+
+/*
+* record_aligned - returns whether the record at a position ends in a divider
+* (0xFA or 0x0A) at RECORD_SIZE-1
+*/
+static inline int record_aligned(const char *map, size_t map_size, size_t start){
+	unsigned char c ;
+
+	if (start + RECORD_SIZE > map_size)
+		return 0 ;
+	c = (unsigned char) map[start + RECORD_SIZE - 1] ;
+	return c == END_OF_RECORD || c == END_OF_RECORD_CR ;
+} ;
+
+/*
+* find_wrong_length - locate the records whose divider (0xFA or 0x0A) is not at the
+* expected RECORD_SIZE stride, as filechk reports them
+* + a record that ends in a divider but holds another one is reported at its
+* own position and the scan goes on at the next record: the stray divider is an
+* invalid byte of that record and does not shift the records after it
+* + a record without a divider at RECORD_SIZE-1 is short or long, the next one
+* starts after its divider. Such records are only reported (see
+* process_wrong_length()). A trailing record without a divider is also reported
+* @map data file contents
+* @map_size size of the data file
+* @positions set to a malloc'd array of record positions (caller frees)
+* @return Number of wrong length records found
+*/
+size_t find_wrong_length(const char *map, size_t map_size, size_t **positions){
+	size_t start = 0, term, count = 0, capacity = 0 ;
+	size_t *grown ;
+
+	*positions = NULL ;
+	while (start < map_size){
+		/* Fast path: divider exactly where the record length puts it and nowhere before */
+		if (record_aligned(map,map_size,start) && CTX->find_terminator(map + start,RECORD_SIZE)==RECORD_SIZE - 1){
+			start += RECORD_SIZE ;
+			continue ;
+		}
+		if (count == capacity){
+			capacity = capacity ? capacity*2 : ARRAY_SIZE ;
+			if ((grown = realloc(*positions,capacity*sizeof(size_t)))==NULL){
+				perror("ERROR") ;
+				break ;
+			}
+			*positions = grown ;
+		}
+		(*positions)[count++] = start ;
+		if (record_aligned(map,map_size,start))
+			start += RECORD_SIZE ;
+		else{
+			/* Short or long: the next record starts after its divider */
+			term = start + CTX->find_terminator(map + start,map_size - start) ;
+			start = term + 1 ;
+		}
+	}
+	return count ;
+} ;
+
+/*
+* process_wrong_length - find wrong length records and check them for invalid characters
+* in a single pass over a mapping of the data file (replaces filechk + -i)
+* + positions are reported and repaired in file order, each one seeing the repairs
+* made before it, same as processing the filechk output with -i
+* @fd descriptor of the opened data file
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while processing file
+*/
+int process_wrong_length(int fd, size_t *invalid_count){
+	struct stat file_stat ;
+	write_batch_t batch ;
+	char *map, *record, writebuf[RECORD_SIZE], overlay[RECORD_SIZE] ;
+	size_t map_size, *positions = NULL, position_count, p ;
+	uint64_t started ;
+	int ret_val = 0 ;
+
+	if (fstat(fd,&file_stat)!=0 || !S_ISREG(file_stat.st_mode)){
+		fprintf(stderr, "ERROR: Wrong length detection requires a regular data file.\n") ;
+		return 1 ;
+	}
+	if (file_stat.st_size == 0)
+		return 0 ;
+	map_size = (size_t) file_stat.st_size ;
+
+	if ((map = mmap(NULL,map_size,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	madvise(map,map_size,MADV_SEQUENTIAL) ;
+	if (WRITE_BACK && init_batch(&batch,fd)!=0){
+		munmap(map,map_size) ;
+		return 1 ;
+	}
+
+	started = stats_clock() ;
+	position_count = find_wrong_length(map,map_size,&positions) ;
+	STATS_ADD(bytes,map_size) ;
+	stats_phase(PHASE_CLASSIFY,started) ;
+	message("Wrong length records found: %zu\n",position_count) ;
+
+	for (p=0;p<position_count;p++){
+		report_position(&REPORT,positions[p]) ;
+		if (positions[p] + RECORD_SIZE > map_size){
+			fprintf(stderr, "ERROR: %d bytes of %zu read.\n",(int) (map_size - positions[p]),RECORD_SIZE) ;
+			fprintf(stderr, "Hit end of file (EOF)!\n");
+			continue ;
+		}
+		/* Short or long records are only reported: repairing RECORD_SIZE bytes from
+		their position would overwrite the next record's data and divider */
+		if (!record_aligned(map,map_size,positions[p])){
+			message("Record at %zu has no divider at %zu, left unchanged.\n",positions[p],positions[p] + RECORD_SIZE - 1) ;
+			continue ;
+		}
+		/* Overlapping records must be checked with earlier repairs applied */
+		record = map + positions[p] ;
+		if (UPDATE_FLAG && batch_covers(&batch,positions[p]))
+			batch_flush(&batch) ;
+		else if (PATCH_OUT != NULL && batch_covers(&batch,positions[p])){
+			memcpy(overlay,record,RECORD_SIZE) ;
+			batch_overlay(&batch,overlay,positions[p]) ;
+			record = overlay ;
+		}
+		*invalid_count += check_record(record,writebuf,positions[p],&REPORT) ;
+		if (WRITE_BACK && memcmp(writebuf,record,RECORD_SIZE*sizeof(char))!=0){
+			batch_add(&batch,positions[p],record,writebuf) ;
+			report_updated(&REPORT,positions[p]) ;
+		}
+	}
+
+	if (WRITE_BACK){
+		if (batch_flush(&batch)!=0 || batch.failed > 0)
+			ret_val = 1 ;
+		free_batch(&batch) ;
+	}
+	munmap(map,map_size) ;
+	free(positions) ;
+	return ret_val ;
+} ;
+
+/*
+* monotonic_ns - monotonic clock in nanoseconds
+*/
+uint64_t monotonic_ns( void ){
+	struct timespec now ;
+
+	clock_gettime(CLOCK_MONOTONIC,&now) ;
+	return (uint64_t) now.tv_sec*1000000000ULL + now.tv_nsec ;
+} ;
+
+/*
+* throttle - token bucket of --max-rate, called after bytes were read or written
+* + the bucket holds at most one second of tokens. A caller that overdraws it
+* sleeps until the debt is paid, other threads queue behind the debt
+*/
+void throttle(size_t bytes){
+	uint64_t now ;
+	double wait ;
+	struct timespec pause ;
+
+	if (MAX_RATE <= 0)
+		return ;
+	pthread_mutex_lock(&RATE_LIMIT.lock) ;
+	now = monotonic_ns() ;
+	if (RATE_LIMIT.last == 0)
+		RATE_LIMIT.tokens = RATE_LIMIT.rate ;
+	else
+		RATE_LIMIT.tokens += (now - RATE_LIMIT.last)/1e9*RATE_LIMIT.rate ;
+	if (RATE_LIMIT.tokens > RATE_LIMIT.rate)
+		RATE_LIMIT.tokens = RATE_LIMIT.rate ;
+	RATE_LIMIT.last = now ;
+	RATE_LIMIT.tokens -= bytes ;
+	wait = RATE_LIMIT.tokens < 0 ? -RATE_LIMIT.tokens/RATE_LIMIT.rate : 0 ;
+	pthread_mutex_unlock(&RATE_LIMIT.lock) ;
+
+	if (wait > 0){
+		pause.tv_sec = (time_t) wait ;
+		pause.tv_nsec = (long) ((wait - pause.tv_sec)*1e9) ;
+		while (nanosleep(&pause,&pause)!=0 && errno == EINTR) ;
+	}
+	return ;
+} ;
+
+/*
+* rate_sample - feed the latency of an I/O operation to the adaptive limit (--adaptive)
+* + the moving average per MB is compared with the best average seen so far:
+* above RATE_SLOW times that the rate backs off, otherwise it climbs back to
+* --max-rate in RATE_STEP increments
+* @bytes bytes transferred
+* @elapsed time the transfer took (ns)
+*/
+void rate_sample(size_t bytes, uint64_t elapsed){
+	double latency ;
+
+	if (!ADAPTIVE_RATE || MAX_RATE <= 0 || bytes == 0)
+		return ;
+	latency = (double) elapsed*(1024*1024)/bytes ;
+	pthread_mutex_lock(&RATE_LIMIT.lock) ;
+	RATE_LIMIT.latency = RATE_LIMIT.latency == 0 ? latency : 0.8*RATE_LIMIT.latency + 0.2*latency ;
+	if (RATE_LIMIT.baseline == 0 || RATE_LIMIT.latency < RATE_LIMIT.baseline)
+		RATE_LIMIT.baseline = RATE_LIMIT.latency ;
+	if (RATE_LIMIT.latency > RATE_SLOW*RATE_LIMIT.baseline){
+		RATE_LIMIT.rate *= RATE_BACKOFF ;
+		if (RATE_LIMIT.rate < RATE_FLOOR*MAX_RATE)
+			RATE_LIMIT.rate = RATE_FLOOR*MAX_RATE ;
+	}else if ((RATE_LIMIT.rate += RATE_STEP*MAX_RATE) > MAX_RATE)
+		RATE_LIMIT.rate = MAX_RATE ;
+	pthread_mutex_unlock(&RATE_LIMIT.lock) ;
+	return ;
+} ;
+
+/*
+* save_checkpoint - record that everything before offset is done (--checkpoint)
+* + written to a temporary file and renamed, so an interrupted save keeps the
+* previous checkpoint
+* @offset end of the records done
+* @invalid_count invalid characters processed so far
+* @return Error writing the checkpoint
+*/
+int save_checkpoint(size_t offset, size_t invalid_count){
+	char checkpoint_tmp[ARRAY_SIZE + 4] ;
+	checkpoint_t checkpoint ;
+	uint64_t counts[256], record_count ;
+	report_counts_t *report_counts = REPORT.counts ;
+	struct stat file_stat ;
+	size_t i ;
+	FILE *checkpoint_file ;
+	int ret_val = 0 ;
+
+	if (stat(DATAFILE,&file_stat)!=0){
+		perror("CHECKPOINT ERROR") ;
+		return 1 ;
+	}
+	memset(&checkpoint,0,sizeof(checkpoint)) ;
+	memcpy(checkpoint.magic,CHECKPOINT_MAGIC,sizeof(checkpoint.magic)) ;
+	checkpoint.file_size = (uint64_t) file_stat.st_size ;
+	checkpoint.record_size = RECORD_SIZE ;
+	checkpoint.config_hash = manifest_config() ;
+	checkpoint.update = UPDATE_FLAG ;
+	checkpoint.offset = offset ;
+	checkpoint.invalid_count = invalid_count ;
+	checkpoint.dirty_records = report_counts->dirty_records ;
+	checkpoint.deleted_records = report_counts->deleted_records ;
+	checkpoint.updated_records = report_counts->updated_records ;
+	for (i=0;i<256;i++)
+		counts[i] = report_counts->byte_counts[i] ;
+
+	snprintf(checkpoint_tmp,sizeof(checkpoint_tmp),"%s.tmp",CHECKPOINTFILE) ;
+	if ((checkpoint_file = fopen(checkpoint_tmp,"wb"))==NULL){
+		perror("CHECKPOINT ERROR") ;
+		return 1 ;
+	}
+	if (fwrite(&checkpoint,sizeof(checkpoint),1,checkpoint_file)!=1 || fwrite(counts,sizeof(uint64_t),256,checkpoint_file)!=256)
+		ret_val = 1 ;
+	for (i=0;ret_val==0 && i<=RECORD_SIZE;i++){
+		record_count = report_counts->record_counts[i] ;
+		if (fwrite(&record_count,sizeof(uint64_t),1,checkpoint_file)!=1)
+			ret_val = 1 ;
+	}
+	if (fflush(checkpoint_file)!=0 || fdatasync(fileno(checkpoint_file))!=0)
+		ret_val = 1 ;
+	if (fclose(checkpoint_file)!=0 || ret_val!=0 || rename(checkpoint_tmp,CHECKPOINTFILE)!=0){
+		perror("CHECKPOINT ERROR") ;
+		unlink(checkpoint_tmp) ;
+		return 1 ;
+	}
+	return 0 ;
+} ;
+
+/*
+* load_checkpoint - restore offset and report counts from the checkpoint file (--resume)
+* + a checkpoint of another file size, record size, mode or validation table
+* is refused
+* @file_size size of the data file
+* @offset set to the offset to continue from (0 without a checkpoint)
+* @invalid_count set to the invalid characters processed before the checkpoint
+* @return Checkpoint does not match the run
+*/
+int load_checkpoint(size_t file_size, size_t *offset, size_t *invalid_count){
+	checkpoint_t checkpoint ;
+	uint64_t counts[256], record_count ;
+	report_counts_t *report_counts = REPORT.counts ;
+	size_t i ;
+	FILE *checkpoint_file ;
+	int ret_val = 0 ;
+
+	*offset = 0 ;
+	if ((checkpoint_file = fopen(CHECKPOINTFILE,"rb"))==NULL){
+		message("No checkpoint found, starting at offset 0.\n") ;
+		return 0 ;
+	}
+	if (fread(&checkpoint,sizeof(checkpoint),1,checkpoint_file)!=1 || memcmp(checkpoint.magic,CHECKPOINT_MAGIC,sizeof(checkpoint.magic))!=0 ||
+		fread(counts,sizeof(uint64_t),256,checkpoint_file)!=256){
+		fprintf(stderr, "ERROR: %s is not a checkpoint file.\n",CHECKPOINTFILE) ;
+		fclose(checkpoint_file) ;
+		return 1 ;
+	}
+	if (checkpoint.file_size != file_size || checkpoint.record_size != RECORD_SIZE || checkpoint.config_hash != manifest_config() ||
+		checkpoint.update != UPDATE_FLAG || checkpoint.offset > file_size || checkpoint.offset%RECORD_SIZE != 0){
+		fprintf(stderr, "ERROR: Checkpoint %s was written for another file or other options.\n",CHECKPOINTFILE) ;
+		fclose(checkpoint_file) ;
+		return 1 ;
+	}
+	for (i=0;ret_val==0 && i<=RECORD_SIZE;i++){
+		if (fread(&record_count,sizeof(uint64_t),1,checkpoint_file)!=1)
+			ret_val = 1 ;
+		else
+			report_counts->record_counts[i] = record_count ;
+	}
+	fclose(checkpoint_file) ;
+	if (ret_val!=0){
+		fprintf(stderr, "ERROR: Checkpoint %s is truncated.\n",CHECKPOINTFILE) ;
+		return 1 ;
+	}
+
+	for (i=0;i<256;i++)
+		report_counts->byte_counts[i] = counts[i] ;
+	report_counts->dirty_records = checkpoint.dirty_records ;
+	report_counts->deleted_records = checkpoint.deleted_records ;
+	report_counts->updated_records = checkpoint.updated_records ;
+	*offset = checkpoint.offset ;
+	*invalid_count = checkpoint.invalid_count ;
+	message("Resuming at offset %zu (%zu invalid characters processed before).\n",*offset,*invalid_count) ;
+	return 0 ;
+} ;
+
+/*
+* scan_checkpointed - serial full/zero-detection traversal with a checkpoint every
+* CHECKPOINT_BYTES (--checkpoint)
+* + repairs are flushed before each checkpoint, so a killed run can continue
+* from it (--resume) without losing or repeating write-back
+* + the checkpoint is removed once the whole file is done
+* @return Error encountered while processing file
+*/
+int scan_checkpointed(int fd, char *map, size_t map_size, size_t *invalid_count){
+	write_batch_t batch ;
+	size_t scan_size = map_size - map_size%RECORD_SIZE, interval, offset = 0, end, resumed = 0 ;
+	int ret_val = 0 ;
+
+	interval = CHECKPOINT_BYTES/RECORD_SIZE > 0 ? (CHECKPOINT_BYTES/RECORD_SIZE)*RECORD_SIZE : RECORD_SIZE ;
+	if (RESUME_FLAG && load_checkpoint(map_size,&offset,&resumed)!=0)
+		return 1 ;
+	*invalid_count += resumed ;
+	if (WRITE_BACK && init_batch(&batch,fd)!=0)
+		return 1 ;
+
+	for (;ret_val==0 && offset<scan_size;offset=end){
+		end = scan_size - offset < interval ? scan_size : offset + interval ;
+		*invalid_count += scan_mapping(map,offset,end,&REPORT,&batch) ;
+		if (WRITE_BACK && (batch_flush(&batch)!=0 || batch.failed > 0))
+			ret_val = 1 ;
+		fflush(REPORT.out) ;
+		if (ret_val==0 && end < scan_size)
+			ret_val = save_checkpoint(end,*invalid_count) ;
+	}
+
+	if (WRITE_BACK)
+		free_batch(&batch) ;
+	if (ret_val==0)
+		unlink(CHECKPOINTFILE) ;
+	return ret_val ;
+} ;
+
+/*
+* stats_clock - monotonic clock in nanoseconds, 0 when instrumentation is off
+*/
+uint64_t stats_clock( void ){
+	return STATS_ENABLED ? monotonic_ns() : 0 ;
+} ;
+
+/*
+* stats_phase - add the time since start to a phase
+*/
+void stats_phase(int phase, uint64_t start){
+	if (STATS_ENABLED)
+		__atomic_fetch_add(&STATS.phase_ns[phase],stats_clock() - start,__ATOMIC_RELAXED) ;
+	return ;
+} ;
+
+/*
+* progress_worker - thread printing a progress line every PROGRESS_INTERVAL seconds
+* + throughput is over the whole run, the ETA needs the total size
+*/
+void *progress_worker(void *arg){
+	struct timespec wake ;
+	uint64_t start, bytes ;
+	double seconds, rate ;
+	long eta ;
+
+	CTX = (filefix_ctx_t*) arg ;
+	start = stats_clock() ;
+	pthread_mutex_lock(&PROGRESS_LOCK) ;
+	clock_gettime(CLOCK_REALTIME,&wake) ;
+	while (PROGRESS_RUNNING){
+		wake.tv_sec += PROGRESS_INTERVAL ;
+		if (pthread_cond_timedwait(&PROGRESS_STOP,&PROGRESS_LOCK,&wake)==0 && !PROGRESS_RUNNING)
+			break ;
+		bytes = __atomic_load_n(&STATS.bytes,__ATOMIC_RELAXED) ;
+		seconds = (stats_clock() - start)/1e9 ;
+		rate = seconds > 0 ? bytes/seconds : 0 ;
+		if (STATS.total_bytes > 0){
+			eta = rate > 0 && STATS.total_bytes > bytes ? (long) ((STATS.total_bytes - bytes)/rate) : 0 ;
+			fprintf(stderr, "Progress: %.1f%% %.1f MB/s %" PRIu64 " dirty, ETA %ld:%02ld:%02ld\n",100.0*bytes/STATS.total_bytes,
+				rate/(1024*1024),__atomic_load_n(&STATS.dirty,__ATOMIC_RELAXED),eta/3600,eta/60%60,eta%60) ;
+		}else
+			fprintf(stderr, "Progress: %.1f MB %.1f MB/s %" PRIu64 " dirty\n",bytes/(1024.0*1024),rate/(1024*1024),
+				__atomic_load_n(&STATS.dirty,__ATOMIC_RELAXED)) ;
+	}
+	pthread_mutex_unlock(&PROGRESS_LOCK) ;
+	return arg ;
+} ;
+
+/*
+* start_progress - start the progress thread (--progress)
+* @total_bytes bytes to scan, 0 if unknown
+*/
+void start_progress(uint64_t total_bytes){
+	STATS.total_bytes = total_bytes ;
+	if (PROGRESS_INTERVAL == 0 || PROGRESS_RUNNING)
+		return ;
+	PROGRESS_RUNNING = 1 ;
+	if (pthread_create(&PROGRESS_THREAD,NULL,progress_worker,CTX)!=0)
+		PROGRESS_RUNNING = 0 ;
+	return ;
+} ;
+
+/*
+* stop_progress - stop the progress thread
+*/
+void stop_progress( void ){
+	if (!PROGRESS_RUNNING)
+		return ;
+	pthread_mutex_lock(&PROGRESS_LOCK) ;
+	PROGRESS_RUNNING = 0 ;
+	pthread_cond_signal(&PROGRESS_STOP) ;
+	pthread_mutex_unlock(&PROGRESS_LOCK) ;
+	pthread_join(PROGRESS_THREAD,NULL) ;
+	return ;
+} ;
+
+/*
+* print_stats - counters and phase timings as one JSON object on stderr (--stats)
+* + phase times are summed over threads and may exceed the total with -j
+*/
+void print_stats(size_t invalid_count){
+	double total = (stats_clock() - STATS_START)/1e9 ;
+	int phase ;
+
+	if (LOG != NULL)
+		fflush(LOG) ;
+	fprintf(stderr, "{\"bytes\":%" PRIu64 ",\"records\":%" PRIu64 ",\"dirty_records\":%" PRIu64 ",\"deleted_records\":%" PRIu64
+		",\"updated_records\":%" PRIu64 ",\"invalid_characters\":%zu,",STATS.bytes,STATS.records,STATS.dirty,STATS.deleted,STATS.updated,invalid_count) ;
+	fprintf(stderr, "\"syscalls\":{\"read\":%" PRIu64 ",\"write\":%" PRIu64 ",\"sync\":%" PRIu64 "},",
+		STATS.read_calls,STATS.write_calls,STATS.sync_calls) ;
+	fprintf(stderr, "\"seconds\":{\"total\":%.6f",total) ;
+	for (phase=0;phase<PHASES;phase++)
+		fprintf(stderr, ",\"%s\":%.6f",PHASE_NAMES[phase],STATS.phase_ns[phase]/1e9) ;
+	fprintf(stderr, "},\"mb_per_s\":%.2f,\"records_per_s\":%.0f}\n",total > 0 ? STATS.bytes/total/(1024*1024) : 0.0,
+		total > 0 ? STATS.records/total : 0.0) ;
+	return ;
+} ;
+
+/*
+* open_stream - keep stdout for the repaired stream in filter mode (-d -)
+* + called before any argument is parsed: from then on stdout is redirected to
+* stderr so that messages and the report never mix with the data
+* + stdout belongs to the process, so it is only taken over once
+* @return Error encountered while redirecting stdout
+*/
+int open_stream( void ){
+	if (STREAM_STDOUT < 0){
+		fflush(stdout) ;
+		if ((STREAM_STDOUT = dup(STDOUT_FILENO)) < 0 || dup2(STDERR_FILENO,STDOUT_FILENO) < 0){
+			perror("ERROR") ;
+			return 1 ;
+		}
+	}
+	STREAM_FD = STREAM_STDOUT ;
+	return 0 ;
+} ;
+
+/*
+* write_stream - write a buffer to the filter output, retrying short writes
+* @return Error encountered while writing
+*/
+int write_stream(const char *buffer, size_t size){
+	ssize_t written ;
+
+	while (size > 0){
+		STATS_ADD(write_calls,1) ;
+		if ((written = write(STREAM_FD,buffer,size)) < 0){
+			if (errno == EINTR)
+				continue ;
+			perror("STREAM ERROR") ;
+			return 1 ;
+		}
+		buffer += written ;
+		size -= written ;
+	}
+	return 0 ;
+} ;
+
+/*
+* process_stream - full/zero-detection repair of stdin to stdout (-d -)
+* + records are read in large buffers, classified a block at a time and the
+* invalid ones repaired in place before the buffer is written out. A trailing
+* partial record is passed through unchanged
+* + positions in the report are offsets in the stream
+* @return Error encountered while processing the stream
+*/
+int process_stream( void ){
+	char *buffer, writebuf[RECORD_SIZE] ;
+	unsigned char dirty[CLASSIFY_BLOCK] ;
+	size_t buffer_size = STREAM_BUFFER/RECORD_SIZE > 0 ? (STREAM_BUFFER/RECORD_SIZE)*RECORD_SIZE : RECORD_SIZE ;
+	size_t filled = 0, scan_size, block_pos, nrec, r, record_pos, stream_pos = 0, invalid_count = 0 ;
+	ssize_t got = 1 ;
+	uint64_t started ;
+	int ret_val = 0 ;
+
+	if ((buffer = malloc(buffer_size))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	/* Larger pipes mean fewer wakeups on both sides. Ignored if not a pipe */
+	fcntl(STDIN_FILENO,F_SETPIPE_SZ,STREAM_PIPE) ;
+	fcntl(STREAM_FD,F_SETPIPE_SZ,STREAM_PIPE) ;
+	posix_fadvise(STDIN_FILENO,0,0,POSIX_FADV_SEQUENTIAL) ;
+	start_progress(0) ;
+
+	while (ret_val==0 && got > 0){
+		/* Fill the buffer: pipes return short reads */
+		started = stats_clock() ;
+		while (filled < buffer_size && (got = read(STDIN_FILENO,buffer + filled,buffer_size - filled)) != 0){
+			STATS_ADD(read_calls,1) ;
+			if (got < 0){
+				if (errno == EINTR)
+					continue ;
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			filled += got ;
+		}
+		stats_phase(PHASE_READ,started) ;
+		if (ret_val!=0)
+			break ;
+
+		scan_size = filled - filled%RECORD_SIZE ;
+		STATS_ADD(records,scan_size/RECORD_SIZE) ;
+		STATS_ADD(bytes,scan_size) ;
+		throttle(filled) ;
+		for (block_pos=0;block_pos<scan_size;block_pos+=nrec*RECORD_SIZE){
+			nrec = (scan_size - block_pos)/RECORD_SIZE ;
+			if (nrec > CLASSIFY_BLOCK)
+				nrec = CLASSIFY_BLOCK ;
+			if (CTX->classify_block(buffer + block_pos,nrec,dirty)==0)
+				continue ;
+			for (r=0;r<nrec;r++){
+				if (!dirty[r])
+					continue ;
+				record_pos = block_pos + r*RECORD_SIZE ;
+				invalid_count += fix_record(buffer + record_pos,writebuf,stream_pos + record_pos,&REPORT) ;
+				memcpy(buffer + record_pos,writebuf,RECORD_SIZE) ;
+			}
+		}
+
+		/* At end of input the partial record goes out as it came in */
+		if (got == 0)
+			scan_size = filled ;
+		started = stats_clock() ;
+		if (write_stream(buffer,scan_size)!=0)
+			ret_val = 1 ;
+		stats_phase(PHASE_WRITE,started) ;
+		memmove(buffer,buffer + scan_size,filled - scan_size) ;
+		filled -= scan_size ;
+		stream_pos += scan_size ;
+	}
+
+	stop_progress() ;
+	started = stats_clock() ;
+	report_summary(&REPORT,invalid_count) ;
+	fflush(REPORT.out) ;
+	if (write_heatmap(REPORT.counts)!=0)
+		ret_val = 1 ;
+	stats_phase(PHASE_REPORT,started) ;
+	message("Number of invalid characters processed: %zu\n",invalid_count) ;
+	INVALID_COUNT = invalid_count ;
+
+	free(buffer) ;
+	if (close(STREAM_FD)!=0 && ret_val==0){
+		perror("STREAM ERROR") ;
+		ret_val = 1 ;
+	}
+	return ret_val ;
+} ;
+
+/*
+* process_file
+* @return Error encountered while processing file
+*/
+int process_file(void){
+	FILE *data_file = NULL, *input_file = NULL ;
+	char buffer[RECORD_SIZE], writebuf[RECORD_SIZE] ;
+	int ret_val = 0 ;
+	int map_ret ;
+	size_t file_pos = 0, invalid_count = 0, position_count = 0 ;
+	position_t *positions = NULL ;
+	write_batch_t batch ;
+	unsigned char dirty ;
+	struct stat file_stat ;
+	uint64_t started = stats_clock() ;
+
+	if ( (data_file = fopen(DATAFILE, "r+b"))==NULL ){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}
+
+	if (strlen(INPUTFILE)>0){
+		if ((input_file = fopen(INPUTFILE, "rb"))==NULL){
+			perror("ERROR") ;
+			ret_val = 1 ;
+		}
+	}
+
+	/* Original records are journaled before they are overwritten */
+	if (ret_val==0 && UPDATE_FLAG && open_journal()!=0)
+		ret_val = 1 ;
+	if (ret_val==0 && strlen(PATCHFILE)>0 && open_patch(fileno(data_file))!=0)
+		ret_val = 1 ;
+	ONLINE_WRITTEN = ONLINE_LOCKED = ONLINE_CHANGED = ONLINE_LOCKS = ONLINE_HELD = ONLINE_LONGEST = 0 ;
+	stats_phase(PHASE_OPEN,started) ;
+	if (ret_val==0 && PROGRESS_INTERVAL > 0 && fstat(fileno(data_file),&file_stat)==0)
+		start_progress((uint64_t) file_stat.st_size) ;
+	
+	/* Process until any issue is encountered. If any issue is encountered, abort
+	and write out the changes already made to the file */
+	if (ret_val==0){
+
+	/* Perform hex-zero detection */
+	if (FULL_DETECTION_FLAG==1 || ZERO_DETECTION_FLAG==1){
+		/* The memory-mapped engine handles the traversal whenever the file can be
+		mapped, unless another engine was selected (-e). Otherwise fall back to
+		the stdio loop below */
+		if (IO_ENGINE == ENGINE_STDIO)
+			map_ret = -1 ;
+		else if (PIPELINE_FLAG)
+			map_ret = process_file_pipeline(fileno(data_file),&invalid_count) ;
+		else if (IO_ENGINE != ENGINE_MMAP)
+			map_ret = process_file_blocks(fileno(data_file),&invalid_count) ;
+		else
+			map_ret = process_file_mmap(fileno(data_file),&invalid_count) ;
+		if (map_ret >= 0)
+			ret_val = map_ret ;
+		else if (WRITE_BACK && init_batch(&batch,fileno(data_file))!=0)
+			ret_val = 1 ;
+		else if (fseek(data_file,0,SEEK_SET)==0){
+			file_pos = ftello(data_file) ;
+			while (fread(&buffer,sizeof(char),RECORD_SIZE,data_file)==RECORD_SIZE){
+				STATS_ADD(records,1) ;
+				STATS_ADD(bytes,RECORD_SIZE) ;
+				if (CTX->classify_block(buffer,1,&dirty)==0){
+					file_pos += RECORD_SIZE ;
+					continue ;
+				}
+				invalid_count += fix_record(buffer,writebuf,file_pos,&REPORT) ;
+
+//				if (UPDATE_FLAG && strncmp(&writebuf,&buffer,RECORD_SIZE*sizeof(char))!=0){
+				if (WRITE_BACK && memcmp(&writebuf,&buffer,RECORD_SIZE*sizeof(char))!=0){
+					batch_add(&batch,file_pos,buffer,writebuf) ;
+					report_updated(&REPORT,file_pos) ;
+				}
+				file_pos = ftello(data_file) ;
+			}
+			if (WRITE_BACK){
+				if (batch_flush(&batch)!=0 || batch.failed > 0)
+					ret_val = 1 ;
+				free_batch(&batch) ;
+			}
+		}
+	}else{
+			/* Positions from -p and -i are loaded up front and processed in file order */
+			if (load_positions(input_file,&positions,&position_count)!=0){
+				message("No positions processed. Exiting program.\n") ;
+				ret_val = 1 ;
+			}
+			else if (position_count > 0 && process_positions(fileno(data_file),positions,position_count,&invalid_count)!=0)
+				ret_val = 1 ;
+			free(positions) ;
+
+			/* Wrong length records are located natively instead of through filechk */
+			if (WRONG_LENGTH_FLAG==1 && ret_val==0){
+				fflush(data_file) ;
+				ret_val = process_wrong_length(fileno(data_file),&invalid_count) ;
+			}
+		}
+	}
+
+	stop_progress() ;
+	started = stats_clock() ;
+	report_summary(&REPORT,invalid_count) ;
+	fflush(REPORT.out) ;
+	if (write_heatmap(REPORT.counts)!=0)
+		ret_val = 1 ;
+	stats_phase(PHASE_REPORT,started) ;
+	message("Number of invalid characters processed: %zu\n",invalid_count) ;
+	if (ONLINE_FLAG)
+		message("Online: %" PRIu64 " records written, %" PRIu64 " skipped (locked), %" PRIu64 " skipped (changed); %" PRIu64 " locks, %.1f us average, %.1f us longest\n",
+			ONLINE_WRITTEN,ONLINE_LOCKED,ONLINE_CHANGED,ONLINE_LOCKS,ONLINE_LOCKS > 0 ? ONLINE_HELD/1000.0/ONLINE_LOCKS : 0.0,ONLINE_LONGEST/1000.0) ;
+
+	INVALID_COUNT = invalid_count ;
+
+	if (data_file != NULL)
+		fclose(data_file) ;
+	if (JOURNAL_FD >= 0){
+		close(JOURNAL_FD) ;
+		JOURNAL_FD = -1 ;
+	}
+	if (PATCH_OUT != NULL && close_patch(ret_val)!=0)
+		ret_val = 1 ;
+	return ret_val ;
+} ;
+
+
+
+/*
+* compare_job_size - qsort comparison scheduling the largest data files first
+*/
+int compare_job_size(const void *a, const void *b){
+	const batch_job_t *job_a = *(batch_job_t * const *) a, *job_b = *(batch_job_t * const *) b ;
+	if (job_a->file_size != job_b->file_size)
+		return job_a->file_size < job_b->file_size ? 1 : -1 ;
+	return job_a->order < job_b->order ? -1 : (job_a->order > job_b->order) ;
+} ;
+
+/*
+* compare_job_name - qsort comparison for directory listings
+*/
+int compare_job_name(const void *a, const void *b){
+	return strcmp(((const batch_job_t *) a)->path,((const batch_job_t *) b)->path) ;
+} ;
+
+/*
+* load_batch - build the job list of a batch run from BATCHPATH
+* + a directory contributes every regular file in it (sorted by name) with the
+* record size set by -l. Without -l each file XXX... is checked against the
+* XXXDEF.TXT definition of the directory, definitions themselves are skipped
+* + a manifest contributes one "file length" or "file definition" pair per line,
+* length being the record size as given to -l. Blank lines and lines starting
+* with '#' are skipped
+* @jobs allocated job list (shared mapping)
+* @count number of jobs
+* @mapped jobs the list was mapped for, the size to unmap it with
+* @return Error loading the batch
+*/
+int load_batch(batch_job_t **jobs, size_t *count, size_t *mapped){
+	struct stat path_stat ;
+	batch_job_t *list ;
+	DIR *dir = NULL ;
+	struct dirent *entry ;
+	FILE *manifest = NULL ;
+	char line[2*ARRAY_SIZE], path[ARRAY_SIZE], second[ARRAY_SIZE], *comment, *second_param = second ;
+	size_t capacity = 0, name_size, j ;
+	int ret_val = 0, fields ;
+
+	*count = 0 ;
+	*mapped = 0 ;
+	*jobs = NULL ;
+	if (stat(BATCHPATH,&path_stat)!=0){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if (S_ISDIR(path_stat.st_mode)){
+		if ((dir = opendir(BATCHPATH))==NULL){
+			perror("ERROR") ;
+			return 1 ;
+		}
+		while ((entry = readdir(dir))!=NULL)
+			capacity++ ;
+		rewinddir(dir) ;
+	}else{
+		if ((manifest = fopen(BATCHPATH,"r"))==NULL){
+			perror("ERROR") ;
+			return 1 ;
+		}
+		while (fgets(line,sizeof(line),manifest)!=NULL)
+			capacity++ ;
+		rewind(manifest) ;
+	}
+
+	/* Workers write their results straight into the job list */
+	if (capacity == 0 || (list = mmap(NULL,capacity*sizeof(batch_job_t),PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0)) == MAP_FAILED){
+		if (capacity > 0)
+			perror("ERROR") ;
+		else
+			message("Batch is empty.\n") ;
+		if (dir != NULL)
+			closedir(dir) ;
+		if (manifest != NULL)
+			fclose(manifest) ;
+		return 1 ;
+	}
+
+	if (dir != NULL){
+		while ((entry = readdir(dir))!=NULL && *count < capacity){
+			name_size = strlen(entry->d_name) ;
+			if (entry->d_name[0]=='.' || (RECORD_SIZE==0 && name_size>=7 && strcmp(entry->d_name + name_size - 7,"DEF.TXT")==0))
+				continue ;
+			if (snprintf(list[*count].path,ARRAY_SIZE,"%s%s%s",BATCHPATH,
+				BATCHPATH[strlen(BATCHPATH) - 1]=='/' ? "" : FILEPATH_SEPARATOR,entry->d_name) >= ARRAY_SIZE)
+				continue ;
+			if (stat(list[*count].path,&path_stat)!=0 || !S_ISREG(path_stat.st_mode))
+				continue ;
+			list[*count].record_size = RECORD_SIZE ;
+			if (RECORD_SIZE==0 && !AUTO_SIZE && snprintf(list[*count].definition,ARRAY_SIZE,"%s%s%.3sDEF.TXT",BATCHPATH,
+				BATCHPATH[strlen(BATCHPATH) - 1]=='/' ? "" : FILEPATH_SEPARATOR,entry->d_name) >= ARRAY_SIZE)
+				continue ;
+			(*count)++ ;
+		}
+		closedir(dir) ;
+		qsort(list,*count,sizeof(batch_job_t),compare_job_name) ;
+	}else{
+		while (fgets(line,sizeof(line),manifest)!=NULL && *count < capacity){
+			if ((comment = strchr(line,'#'))!=NULL)
+				*comment = '\0' ;
+			if ((fields = sscanf(line,"%1023s %1023s",path,second)) <= 0)
+				continue ;
+			if (fields != 2 || (is_number(&second_param) && strtoll(second,NULL,10) <= 0)){
+				message("Manifest line (%s) is invalid.\n",path) ;
+				ret_val = 1 ;
+				continue ;
+			}
+			strcpy(list[*count].path,path) ;
+			if (is_number(&second_param))
+				list[*count].record_size = (size_t) strtoll(second,NULL,10) ;
+			else if (strcmp(second,"auto")==0)
+				list[*count].record_size = 0 ;
+			else
+				strcpy(list[*count].definition,second) ;
+			(*count)++ ;
+		}
+		fclose(manifest) ;
+	}
+
+	for (j=0;j<*count;j++){
+		list[j].order = j ;
+		if (stat(list[j].path,&path_stat)==0)
+			list[j].file_size = (size_t) path_stat.st_size ;
+	}
+	if (*count == 0){
+		message("Batch is empty.\n") ;
+		ret_val = 1 ;
+	}
+	if (ret_val != 0){
+		munmap(list,capacity*sizeof(batch_job_t)) ;
+		*count = 0 ;
+		return ret_val ;
+	}
+	*jobs = list ;
+	*mapped = capacity ;
+	return 0 ;
+} ;
+
+/*
+* run_batch_job - worker process side of a batch job
+* + runs process_file() on the job's data file, single-threaded, with messages
+* and the report redirected to the job's temporary files
+* + never returns
+*/
+void run_batch_job(batch_job_t *job){
+	int ret_val ;
+
+	LOG = job->log ;
+	REPORT.out = job->report != NULL ? job->report : LOG ;
+	REPORT.counts = &REPORT_COUNTS ;
+	THREAD_COUNT = 1 ;
+	POSITION_SET = 0 ;
+	STATS_ENABLED = STATS_FLAG = 0 ;
+	PROGRESS_INTERVAL = 0 ;
+	INPUTFILE[0] = '\0' ;
+	if (job->definition[0]!='\0'){
+		message("Definition file: %s\n",job->definition) ;
+		if (load_definition(job->definition)!=0)
+			_exit(1) ;
+	}
+	RECORD_SIZE = job->record_size > 0 ? job->record_size : DEFINITION_SIZE ;
+	/* No length and no definition: detected from the file (-l auto or "auto" in the manifest) */
+	if (job->record_size==0 && job->definition[0]=='\0' && detect_record_size(job->path)!=0)
+		RECORD_SIZE = 0 ;
+	job->record_size = RECORD_SIZE ;
+	/* One journal per data file so each file can be rolled back on its own */
+	if (strlen(JOURNALFILE)>0)
+		snprintf(JOURNALFILE + strlen(JOURNALFILE),ARRAY_SIZE - strlen(JOURNALFILE),".%s",
+			strrchr(job->path,'/') != NULL ? strrchr(job->path,'/') + 1 : job->path) ;
+	if (strlen(HEATMAPFILE)>0)
+		snprintf(HEATMAPFILE + strlen(HEATMAPFILE),ARRAY_SIZE - strlen(HEATMAPFILE),".%s",
+			strrchr(job->path,'/') != NULL ? strrchr(job->path,'/') + 1 : job->path) ;
+
+	set_data_file(job->path) ;
+	message("Record size: %zu\n",RECORD_SIZE) ;
+	/* Tables are built for this file's record size and definition */
+	if (RECORD_SIZE==0 || init_counts(&REPORT_COUNTS)!=0 || init_fields()!=0)
+		ret_val = 1 ;
+	else{
+		init_classifier() ;
+		ret_val = process_file() ;
+	}
+
+	fflush(REPORT.out) ;
+	fflush(LOG) ;
+	job->invalid_count = INVALID_COUNT ;
+	job->ret_val = ret_val ;
+	_exit(ret_val) ;
+} ;
+
+/*
+* report_batch_file - per-file line of the batch summary
+*/
+void report_batch_file(report_t *rep, batch_job_t *job){
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"file\",\"file\":\"%s\",\"length\":%zu,\"size\":%zu,\"invalid\":%zu,\"seconds\":%.3f,\"failed\":%d}\n",
+			job->path,job->record_size,job->file_size,job->invalid_count,job->seconds,job->failed) ;
+	else if (REPORT_FORMAT == FORMAT_BINARY)
+		report_binary(rep,EVENT_FILE,job->invalid_count,(uint32_t) (job->seconds*1000),job->failed,0) ;
+	else
+		fprintf(rep->out,"\t%s; length: %zu; size: %zu; invalid: %zu; seconds: %.3f%s\n",
+			job->path,job->record_size,job->file_size,job->invalid_count,job->seconds,job->failed ? "; FAILED" : "") ;
+	return ;
+} ;
+
+/*
+* report_batch_summary - aggregated report of a batch run, files in listing order
+*/
+void report_batch_summary(report_t *rep, batch_job_t *jobs, size_t count, double seconds){
+	size_t j, failed = 0, invalid_count = 0 ;
+
+	if (REPORT_FORMAT == FORMAT_TEXT)
+		fprintf(rep->out,"Batch summary:\n") ;
+	for (j=0;j<count;j++){
+		report_batch_file(rep,&jobs[j]) ;
+		failed += jobs[j].failed ;
+		invalid_count += jobs[j].invalid_count ;
+	}
+	if (REPORT_FORMAT == FORMAT_JSON)
+		fprintf(rep->out,"{\"event\":\"batch\",\"files\":%zu,\"failed\":%zu,\"invalid\":%zu,\"seconds\":%.3f}\n",
+			count,failed,invalid_count,seconds) ;
+	else if (REPORT_FORMAT == FORMAT_TEXT)
+		fprintf(rep->out,"Files: %zu; failed: %zu; invalid characters: %zu; seconds: %.3f\n",
+			count,failed,invalid_count,seconds) ;
+	return ;
+} ;
+
+/*
+* process_batch - batch mode (-b): run process_file() over many data files
+* + one worker process per data file, at most THREAD_COUNT at a time, started
+* largest file first so the pool finishes together
+* + each file's output is written out as soon as its worker is done, followed
+* by a summary of all files with their timings and invalid character counts
+* @return Any data file failed
+*/
+int process_batch( void ){
+	batch_job_t *jobs, **schedule ;
+	struct timespec batch_start, now ;
+	size_t count, mapped, next = 0, running = 0, j, read_size ;
+	char copybuf[ARRAY_SIZE*ARRAY_SIZE/16] ;
+	pid_t pid ;
+	int status, ret_val = 0 ;
+
+	if (load_batch(&jobs,&count,&mapped)!=0)
+		return 1 ;
+	if ((schedule = malloc(count*sizeof(batch_job_t*)))==NULL){
+		perror("ERROR") ;
+		munmap(jobs,mapped*sizeof(batch_job_t)) ;
+		return 1 ;
+	}
+	for (j=0;j<count;j++)
+		schedule[j] = &jobs[j] ;
+	qsort(schedule,count,sizeof(batch_job_t*),compare_job_size) ;
+	message("Batch files: %zu; workers: %zu\n",count,THREAD_COUNT) ;
+	clock_gettime(CLOCK_MONOTONIC,&batch_start) ;
+
+	while (next < count || running > 0){
+		/* Keep the pool full */
+		while (next < count && running < THREAD_COUNT){
+			batch_job_t *job = schedule[next++] ;
+			if ((job->log = tmpfile())==NULL || (REPORT.out != LOG && (job->report = tmpfile())==NULL)){
+				perror("ERROR") ;
+				job->failed = 1 ;
+				continue ;
+			}
+			if (LOG != NULL)
+				fflush(LOG) ;
+			fflush(REPORT.out) ;
+			clock_gettime(CLOCK_MONOTONIC,&job->started) ;
+			/* The job list is shared, so only the scheduler sets the pid */
+			if ((pid = fork()) == 0)
+				run_batch_job(job) ;
+			if (pid < 0){
+				perror("ERROR") ;
+				job->failed = 1 ;
+				continue ;
+			}
+			job->pid = pid ;
+			running++ ;
+		}
+		if (running == 0)
+			continue ;
+
+		if ((pid = waitpid(-1,&status,0)) < 0){
+			perror("ERROR") ;
+			ret_val = 1 ;
+			break ;
+		}
+		clock_gettime(CLOCK_MONOTONIC,&now) ;
+		for (j=0;j<count && jobs[j].pid != pid;j++) ;
+		if (j == count)
+			continue ;
+		running-- ;
+		jobs[j].seconds = (now.tv_sec - jobs[j].started.tv_sec) + (now.tv_nsec - jobs[j].started.tv_nsec)/1e9 ;
+		jobs[j].failed = !WIFEXITED(status) || WEXITSTATUS(status)!=0 ;
+
+		/* Worker output, in completion order */
+		message("Batch file %zu of %zu done: %s\n",jobs[j].order + 1,count,jobs[j].path) ;
+		rewind(jobs[j].log) ;
+		while (LOG != NULL && (read_size = fread(copybuf,sizeof(char),sizeof(copybuf),jobs[j].log)) > 0)
+			fwrite(copybuf,sizeof(char),read_size,LOG) ;
+		fclose(jobs[j].log) ;
+		if (jobs[j].report != NULL){
+			rewind(jobs[j].report) ;
+			while ((read_size = fread(copybuf,sizeof(char),sizeof(copybuf),jobs[j].report)) > 0)
+				fwrite(copybuf,sizeof(char),read_size,REPORT.out) ;
+			fclose(jobs[j].report) ;
+		}
+	}
+
+	clock_gettime(CLOCK_MONOTONIC,&now) ;
+	for (j=0;j<count;j++)
+		ret_val |= jobs[j].failed ;
+	report_batch_summary(&REPORT,jobs,count,(now.tv_sec - batch_start.tv_sec) + (now.tv_nsec - batch_start.tv_nsec)/1e9) ;
+	fflush(REPORT.out) ;
+
+	free(schedule) ;
+	munmap(jobs,mapped*sizeof(batch_job_t)) ;
+	return ret_val ;
+} ;
+
+/*
+* set_watch - set the directory followed by the watch daemon (--watch)
+* @return Directory successfully set
+*/
+int set_watch(const char *param){
+	int param_size = strlen(param) ;
+	if (param_size == 0 || param_size >= ARRAY_SIZE)
+		return 1 ;
+	strncpy((char*)&WATCHDIR,param,param_size*sizeof(char)) ;
+	WATCHDIR[param_size] = '\0' ;
+	message("Watching: %s\n",WATCHDIR) ;
+	return 0 ;
+} ;
+
+/*
+* watch_signal - SIGINT/SIGTERM handler of the watch daemon
+*/
+void watch_signal(int sig){
+	(void) sig ;
+	WATCH_STOP = 1 ;
+	return ;
+} ;
+
+/*
+* watch_name - returns whether a directory entry is a data file to follow
+* + hidden files (the state file), definitions, manifests, temporary files and
+* the undo journals of the daemon are left out
+*/
+int watch_name(const char *name){
+	char path[ARRAY_SIZE] ;
+	size_t name_size = strlen(name) ;
+
+	if (name[0]=='.' || name_size >= sizeof(((watch_file_t*)0)->name))
+		return 0 ;
+	if ((name_size>=7 && strcmp(name + name_size - 7,"DEF.TXT")==0) ||
+		(name_size>=strlen(MANIFEST_SUFFIX) && strcmp(name + name_size - strlen(MANIFEST_SUFFIX),MANIFEST_SUFFIX)==0) ||
+		(name_size>=4 && strcmp(name + name_size - 4,".tmp")==0))
+		return 0 ;
+	if (strlen(JOURNALFILE)>0 && snprintf(path,ARRAY_SIZE,"%s%s%s",WATCHDIR,
+		WATCHDIR[strlen(WATCHDIR) - 1]=='/' ? "" : FILEPATH_SEPARATOR,name) < ARRAY_SIZE &&
+		strncmp(path,JOURNALFILE,strlen(JOURNALFILE))==0)
+		return 0 ;
+	return 1 ;
+} ;
+
+/*
+* watch_find - find a followed file by name, adding it when it is new
+* @files followed files, grown as needed
+* @count number of followed files
+* @capacity entries allocated
+* @name file name in the watched directory
+* @return Entry of the file, NULL if out of memory
+*/
+watch_file_t *watch_find(watch_file_t **files, size_t *count, size_t *capacity, const char *name){
+	watch_file_t *grown ;
+	size_t f ;
+
+	for (f=0;f<*count;f++)
+		if (strcmp((*files)[f].name,name)==0)
+			return &(*files)[f] ;
+	if (*count == *capacity){
+		if ((grown = realloc(*files,(*capacity > 0 ? 2*(*capacity) : 64)*sizeof(watch_file_t)))==NULL){
+			perror("ERROR") ;
+			return NULL ;
+		}
+		*files = grown ;
+		*capacity = *capacity > 0 ? 2*(*capacity) : 64 ;
+	}
+	memset(&(*files)[*count],0,sizeof(watch_file_t)) ;
+	strcpy((*files)[*count].name,name) ;
+	return &(*files)[(*count)++] ;
+} ;
+
+/*
+* watch_list - mark every data file of the watched directory as pending
+* + used at start and when inotify dropped events (queue overflow)
+* @return Directory could not be read
+*/
+int watch_list(watch_file_t **files, size_t *count, size_t *capacity){
+	struct dirent *entry ;
+	watch_file_t *file ;
+	DIR *dir ;
+
+	if ((dir = opendir(WATCHDIR))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	while ((entry = readdir(dir))!=NULL){
+		if (!watch_name(entry->d_name))
+			continue ;
+		if ((file = watch_find(files,count,capacity,entry->d_name))==NULL){
+			closedir(dir) ;
+			return 1 ;
+		}
+		file->pending = 1 ;
+	}
+	closedir(dir) ;
+	return 0 ;
+} ;
+
+/*
+* load_watch_state - validated offsets of a previous run of the daemon
+* + WATCH_STATE lines: validated bytes, inode, modification time (seconds and
+* nanoseconds), file name
+* @return Out of memory
+*/
+int load_watch_state(watch_file_t **files, size_t *count, size_t *capacity){
+	char path[ARRAY_SIZE], name[256] ;
+	watch_file_t state, *file ;
+	FILE *state_file ;
+
+	if (snprintf(path,ARRAY_SIZE,"%s%s%s",WATCHDIR,WATCHDIR[strlen(WATCHDIR) - 1]=='/' ? "" : FILEPATH_SEPARATOR,WATCH_STATE) >= ARRAY_SIZE ||
+		(state_file = fopen(path,"r"))==NULL)
+		return 0 ;
+	while (fscanf(state_file,"%zu %" SCNu64 " %" SCNd64 " %" SCNd64 " %255[^\n]\n",&state.validated,&state.inode,
+		&state.mtime_sec,&state.mtime_nsec,name)==5){
+		if (!watch_name(name))
+			continue ;
+		if ((file = watch_find(files,count,capacity,name))==NULL){
+			fclose(state_file) ;
+			return 1 ;
+		}
+		file->validated = state.validated ;
+		file->inode = state.inode ;
+		file->mtime_sec = state.mtime_sec ;
+		file->mtime_nsec = state.mtime_nsec ;
+	}
+	fclose(state_file) ;
+	message("Watch state: %zu files from %s\n",*count,path) ;
+	return 0 ;
+} ;
+
+/*
+* save_watch_state - write the validated offsets to WATCH_STATE
+* + written under a temporary name and renamed, a crash keeps the last state
+* @return State could not be written
+*/
+int save_watch_state(const watch_file_t *files, size_t count){
+	char path[ARRAY_SIZE], state_tmp[ARRAY_SIZE + 8] ;
+	FILE *state_file ;
+	size_t f ;
+
+	if (snprintf(path,ARRAY_SIZE,"%s%s%s",WATCHDIR,WATCHDIR[strlen(WATCHDIR) - 1]=='/' ? "" : FILEPATH_SEPARATOR,WATCH_STATE) >= ARRAY_SIZE)
+		return 1 ;
+	snprintf(state_tmp,sizeof(state_tmp),"%s.tmp",path) ;
+	if ((state_file = fopen(state_tmp,"w"))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	for (f=0;f<count;f++)
+		fprintf(state_file,"%zu %" PRIu64 " %" PRId64 " %" PRId64 " %s\n",files[f].validated,files[f].inode,
+			files[f].mtime_sec,files[f].mtime_nsec,files[f].name) ;
+	if (fclose(state_file)!=0 || rename(state_tmp,path)!=0){
+		perror("ERROR") ;
+		unlink(state_tmp) ;
+		return 1 ;
+	}
+	return 0 ;
+} ;
+
+/*
+* watch_scan - check what changed in a followed file since its last scan
+* + records appended after the validated offset are scanned from a mapping with
+* scan_mapping(), the same classifier and fix_record() rules as process_file()
+* + a change at the same size (modified in place) goes through
+* process_file_mmap(): with -m only the manifest blocks whose hash changed are
+* checked, otherwise the whole file
+* + inotify does not tell which bytes were written: an in-place change made in
+* the same round as an append is not seen, as only the appended records are
+* scanned. Rescanning on every append would cost a full read (or with -m a hash
+* of every block) per event
+* + a new inode (file replaced) or a shorter file starts over from offset 0
+* + a trailing partial record is left for the next scan
+* + with -u the repairs are written at once, journaled to journal.<file> with -J
+* @file followed file
+* @invalid_count running count of invalid characters processed
+* @return Error encountered while scanning the file
+*/
+int watch_scan(watch_file_t *file, size_t *invalid_count){
+	char journal[ARRAY_SIZE], *map ;
+	struct stat file_stat ;
+	write_batch_t batch ;
+	size_t end, start, found = 0, updated = REPORT_COUNTS.updated_records ;
+	int fd, ret_val = 0, in_place ;
+
+	file->pending = 0 ;
+	if (snprintf(DATAFILE,ARRAY_SIZE,"%s%s%s",WATCHDIR,WATCHDIR[strlen(WATCHDIR) - 1]=='/' ? "" : FILEPATH_SEPARATOR,file->name) >= ARRAY_SIZE)
+		return 1 ;
+	/* Gone again before the scan: the delete or rename event follows */
+	if ((fd = open(DATAFILE,UPDATE_FLAG ? O_RDWR : O_RDONLY)) < 0 || fstat(fd,&file_stat)!=0 || !S_ISREG(file_stat.st_mode)){
+		if (fd >= 0)
+			close(fd) ;
+		return 0 ;
+	}
+	end = (size_t) file_stat.st_size - (size_t) file_stat.st_size%RECORD_SIZE ;
+	if ((uint64_t) file_stat.st_ino != file->inode || end < file->validated){
+		file->validated = 0 ;
+		file->inode = (uint64_t) file_stat.st_ino ;
+	}
+	start = file->validated ;
+	in_place = end > 0 && end == start && (file->mtime_sec != (int64_t) file_stat.st_mtim.tv_sec ||
+		file->mtime_nsec != (int64_t) file_stat.st_mtim.tv_nsec) ;
+	if (end == start && !in_place){
+		close(fd) ;
+		return 0 ;
+	}
+
+	/* One journal per data file, as in batch mode */
+	strcpy(journal,JOURNALFILE) ;
+	if (strlen(JOURNALFILE)>0)
+		snprintf(JOURNALFILE + strlen(JOURNALFILE),ARRAY_SIZE - strlen(JOURNALFILE),".%s",file->name) ;
+	message("Watch: %s records %zu to %zu (%s)\n",file->name,in_place ? 0 : start/RECORD_SIZE,end/RECORD_SIZE,
+		in_place ? "changed in place" : start == 0 ? "whole file" : "appended") ;
+	if (UPDATE_FLAG && open_journal()!=0)
+		ret_val = 1 ;
+	else if (in_place){
+		if (process_file_mmap(fd,&found)!=0)
+			ret_val = 1 ;
+	}else if ((map = mmap(NULL,end,PROT_READ,MAP_SHARED,fd,0)) == MAP_FAILED){
+		perror("ERROR") ;
+		ret_val = 1 ;
+	}else{
+		if (WRITE_BACK && init_batch(&batch,fd)!=0)
+			ret_val = 1 ;
+		else{
+			found = scan_mapping(map,start,end,&REPORT,&batch) ;
+			if (WRITE_BACK){
+				if (batch_flush(&batch)!=0 || batch.failed > 0)
+					ret_val = 1 ;
+				free_batch(&batch) ;
+			}
+		}
+		munmap(map,end) ;
+	}
+	if (JOURNAL_FD >= 0){
+		close(JOURNAL_FD) ;
+		JOURNAL_FD = -1 ;
+	}
+	strcpy(JOURNALFILE,journal) ;
+
+	message("Watch: %s %zu invalid characters processed\n",file->name,found) ;
+	if (ret_val==0){
+		/* The repairs just written move the modification time */
+		if (REPORT_COUNTS.updated_records != updated)
+			fstat(fd,&file_stat) ;
+		file->validated = end ;
+		file->mtime_sec = (int64_t) file_stat.st_mtim.tv_sec ;
+		file->mtime_nsec = (int64_t) file_stat.st_mtim.tv_nsec ;
+	}
+	*invalid_count += found ;
+	close(fd) ;
+	return ret_val ;
+} ;
+
+/*
+* process_watch - watch daemon over a data directory (--watch)
+* + inotify reports files written, created or moved into the directory; they are
+* scanned by watch_scan() once no event came for WATCH_SETTLE ms, or after
+* WATCH_LATENCY ms while writers keep appending
+* + the validated offset of every file is kept in WATCH_STATE, so a restarted
+* daemon only checks what changed while it was down
+* + runs until SIGINT or SIGTERM, then prints the summary of the whole run
+* @return Error encountered while watching or scanning
+*/
+int process_watch( void ){
+	struct sigaction action, old_int, old_term ;
+	struct pollfd watch_poll ;
+	struct inotify_event *event ;
+	watch_file_t *files = NULL, *file ;
+	char *events ;
+	size_t count = 0, capacity = 0, f, kept, invalid_count = 0 ;
+	uint64_t first_pending = 0 ;
+	ssize_t got, e ;
+	int ret_val = 0, failed = 0, ready, pending ;
+
+	if ((events = malloc(WATCH_EVENTS))==NULL){
+		perror("ERROR") ;
+		return 1 ;
+	}
+	if ((watch_poll.fd = inotify_init1(IN_CLOEXEC)) < 0 ||
+		inotify_add_watch(watch_poll.fd,WATCHDIR,IN_MODIFY|IN_CLOSE_WRITE|IN_CREATE|IN_MOVED_TO|IN_DELETE|IN_MOVED_FROM) < 0){
+		perror("ERROR") ;
+		if (watch_poll.fd >= 0)
+			close(watch_poll.fd) ;
+		free(events) ;
+		return 1 ;
+	}
+	watch_poll.events = POLLIN ;
+
+	/* Saved offsets of files that are gone are dropped */
+	if (load_watch_state(&files,&count,&capacity)!=0 || watch_list(&files,&count,&capacity)!=0)
+		ret_val = 1 ;
+	for (f=0,kept=0;f<count;f++)
+		if (files[f].pending)
+			files[kept++] = files[f] ;
+	count = kept ;
+	pending = count > 0 ;
+	message("Watching %s: %zu data files\n",WATCHDIR,count) ;
+
+	memset(&action,0,sizeof(action)) ;
+	action.sa_handler = watch_signal ;
+	sigemptyset(&action.sa_mask) ;
+	sigaction(SIGINT,&action,&old_int) ;
+	sigaction(SIGTERM,&action,&old_term) ;
+	WATCH_STOP = 0 ;
+
+	while (ret_val==0 && !WATCH_STOP){
+		/* Signals interrupt the wait, the timeout only bounds a missed one */
+		if ((ready = poll(&watch_poll,1,pending ? WATCH_SETTLE : 1000)) < 0){
+			if (errno == EINTR)
+				continue ;
+			perror("ERROR") ;
+			ret_val = 1 ;
+			break ;
+		}
+		if (ready > 0){
+			if ((got = read(watch_poll.fd,events,WATCH_EVENTS)) <= 0){
+				if (got < 0 && errno == EINTR)
+					continue ;
+				perror("ERROR") ;
+				ret_val = 1 ;
+				break ;
+			}
+			if (!pending)
+				first_pending = monotonic_ns() ;
+			for (e=0;ret_val==0 && e<got;e+=sizeof(struct inotify_event) + event->len){
+				event = (struct inotify_event*) (events + e) ;
+				if (event->mask & IN_Q_OVERFLOW){
+					message("Watch: events dropped, checking all files\n") ;
+					ret_val = watch_list(&files,&count,&capacity) ;
+					pending = 1 ;
+					continue ;
+				}
+				if (event->len == 0 || !watch_name(event->name))
+					continue ;
+				if (event->mask & (IN_DELETE|IN_MOVED_FROM)){
+					for (f=0;f<count && strcmp(files[f].name,event->name)!=0;f++) ;
+					if (f < count)
+						memmove(&files[f],&files[f + 1],(count - f - 1)*sizeof(watch_file_t)) ;
+					count -= f < count ;
+					continue ;
+				}
+				if ((file = watch_find(&files,&count,&capacity,event->name))==NULL)
+					ret_val = 1 ;
+				else
+					file->pending = pending = 1 ;
+			}
+		}
+
+		if (pending && ret_val==0 && (ready == 0 || monotonic_ns() - first_pending >= WATCH_LATENCY*1000000ULL)){
+			for (f=0;f<count;f++)
+				if (files[f].pending && watch_scan(&files[f],&invalid_count)!=0){
+					message("Watch: scan of %s failed, retried on its next change\n",files[f].name) ;
+					failed = 1 ;
+				}
+			if (save_watch_state(files,count)!=0)
+				failed = 1 ;
+			fflush(REPORT.out) ;
+			if (LOG != NULL)
+				fflush(LOG) ;
+			pending = 0 ;
+		}
+	}
+
+	sigaction(SIGINT,&old_int,NULL) ;
+	sigaction(SIGTERM,&old_term,NULL) ;
+	close(watch_poll.fd) ;
+	free(events) ;
+	free(files) ;
+
+	report_summary(&REPORT,invalid_count) ;
+	fflush(REPORT.out) ;
+	message("Number of invalid characters processed: %zu\n",invalid_count) ;
+	INVALID_COUNT = invalid_count ;
+	return ret_val | failed ;
+} ;
+
+/*
+* filefix_new - context with the defaults of the command line
+* + messages are discarded until filefix_set_log() is called
+* @return New context, NULL if out of memory
+*/
+filefix_ctx_t *filefix_new( void ){
+	filefix_ctx_t *ctx ;
+
+	pthread_once(&ENV_ONCE,get_env) ;
+	if ((ctx = calloc(1,sizeof(filefix_ctx_t)))==NULL)
+		return NULL ;
+	ctx->fill_value = 32 ;
+	ctx->null_fill_value = 255 ;
+	ctx->itest_version = 1 ;
+	ctx->thread_count = 1 ;
+	ctx->report_level = REPORT_BYTE ;
+	ctx->report_format = FORMAT_TEXT ;
+	ctx->journal_fd = -1 ;
+	ctx->io_engine = ENGINE_MMAP ;
+	ctx->queue_depth = 8 ;
+	ctx->stream_fd = -1 ;
+	strcpy(ctx->translation,"default") ;
+	pthread_mutex_init(&ctx->journal_lock,NULL) ;
+	pthread_mutex_init(&ctx->patch_lock,NULL) ;
+	pthread_mutex_init(&ctx->progress_lock,NULL) ;
+	pthread_cond_init(&ctx->progress_stop,NULL) ;
+	pthread_mutex_init(&ctx->rate_limit.lock,NULL) ;
+	return ctx ;
+} ;
+
+/*
+* filefix_free - release a context and the tables it holds
+*/
+void filefix_free(filefix_ctx_t *ctx){
+	if (ctx == NULL)
+		return ;
+	free(ctx->fields) ;
+	free(ctx->column_class) ;
+	free(ctx->column_mask) ;
+	free(ctx->column_fill) ;
+	free(ctx->manifest_dirty) ;
+	free_counts(&ctx->report_counts) ;
+	pthread_mutex_destroy(&ctx->journal_lock) ;
+	pthread_mutex_destroy(&ctx->patch_lock) ;
+	pthread_mutex_destroy(&ctx->progress_lock) ;
+	pthread_cond_destroy(&ctx->progress_stop) ;
+	pthread_mutex_destroy(&ctx->rate_limit.lock) ;
+	if (CTX == ctx)
+		CTX = NULL ;
+	free(ctx) ;
+	return ;
+} ;
+
+/*
+* filefix_option - kind of a command line option
+* @option option including its dash(es), e.g. "-l" or "--max-rate"
+* @return -1 unknown option, 0 option without a value, 1 option with a value
+*/
+int filefix_option(const char *option){
+	const char *cmd ;
+
+	if (option == NULL || option[0] != '-' || !valid_cmd((char*) option + 1))
+		return -1 ;
+	cmd = option + 1 ;
+	if (strcmp(cmd,"m")==0 || strcmp(cmd,"s")==0 || strcmp(cmd,"-stats")==0 || strcmp(cmd,"-adaptive")==0 || 
+		strcmp(cmd,"-online")==0 || strcmp(cmd,"-pipeline")==0 || strcmp(cmd,"-resume")==0 || strcmp(cmd,"t")==0 || strcmp(cmd,"u")==0 || strcmp(cmd,"v")==0 || 
+		strcmp(cmd,"w")==0 || strcmp(cmd,"x")==0 || strcmp(cmd,"y")==0)
+		return 0 ;
+	return 1 ;
+} ;
+
+/*
+* filefix_set - set a command line option on a context
+* @option option including its dash(es)
+* @value value of the option, ignored for options without one
+* @return Option unknown, value missing or invalid
+*/
+int filefix_set(filefix_ctx_t *ctx, const char *option, const char *value){
+	int kind = filefix_option(option) ;
+
+	CTX = ctx ;
+	if (kind < 0 || (kind == 1 && value == NULL))
+		return 1 ;
+	return parse_cmd(option + 1,kind ? value : NULL) ;
+} ;
+
+/*
+* filefix_set_log - stream for the messages of a context, NULL discards them
+* + the report goes to the same stream unless a report file (-o) or a callback
+* is set
+*/
+void filefix_set_log(filefix_ctx_t *ctx, FILE *log){
+	ctx->log = log ;
+	return ;
+} ;
+
+/*
+* filefix_set_callback - deliver the report of a context as events
+* + the callback runs on the thread that started the run, in file order (input
+* order for -p/-i unless -s is set), including the summary events
+*/
+void filefix_set_callback(filefix_ctx_t *ctx, filefix_callback_t callback, void *user){
+	ctx->callback = callback ;
+	ctx->callback_user = user ;
+	return ;
+} ;
+
+/*
+* filefix_stream - filter mode (-d -) for a context, see open_stream()
+* @return Error encountered while redirecting stdout
+*/
+int filefix_stream(filefix_ctx_t *ctx){
+	CTX = ctx ;
+	return open_stream() ;
+} ;
+
+/*
+* filefix_run - run with the options set on a context
+* + the options are checked first. Then one of: rollback, batch mode, filter
+* mode or the data file, followed by ITEST (-t) and --stats
+* @return Options incomplete or run failed
+*/
+int filefix_run(filefix_ctx_t *ctx){
+	uint64_t started ;
+	int ret_val = 1 ;
+
+	CTX = ctx ;
+	memset(&STATS,0,sizeof(STATS)) ;
+	STATS_START = stats_clock() ;
+	if (strlen(ROLLBACKFILE)>0){
+		if (strlen(DATAFILE)==0)
+			message("No data file provided for rollback. Exiting program.\n") ;
+		else
+			ret_val = rollback_journal() ;
+	}
+	else if (strlen(APPLYFILE)>0){
+		if (strlen(DATAFILE)==0)
+			message("No data file provided for the patch. Exiting program.\n") ;
+		else
+			ret_val = apply_patch() ;
+	}
+	else if (strlen(BATCHPATH)>0 && FULL_DETECTION_FLAG==0 && ZERO_DETECTION_FLAG==0 && WRONG_LENGTH_FLAG==0)
+		message("Batch mode requires -w, -x or -y. Exiting program.\n") ;
+	else if (RESUME_FLAG && strlen(CHECKPOINTFILE)==0)
+		message("--resume requires --checkpoint. Exiting program.\n") ;
+	else if (RESUME_FLAG && strlen(HEATMAPFILE)>0)
+		message("--heatmap requires a whole pass and no --resume. Exiting program.\n") ;
+	else if ((SAMPLE_BLOCKS > 0 || SAMPLE_FRACTION > 0) && ((FULL_DETECTION_FLAG==0 && ZERO_DETECTION_FLAG==0) || UPDATE_FLAG ||
+		strlen(BATCHPATH)>0 || STREAM_FD >= 0 || POSITION_SET || strlen(INPUTFILE)>0 || WRONG_LENGTH_FLAG || INCREMENTAL_FLAG ||
+		strlen(PATCHFILE)>0 || strlen(CHECKPOINTFILE)>0 || strlen(HEATMAPFILE)>0))
+		message("--sample requires -x or -y and no -u, -b, -i, -m, -p, -w, --patch-out, --checkpoint, --heatmap or filter mode. Exiting program.\n") ;
+	else if (strlen(WATCHDIR)>0 && ((FULL_DETECTION_FLAG==0 && ZERO_DETECTION_FLAG==0) || RECORD_SIZE==0 || AUTO_SIZE || strlen(DATAFILE)>0 ||
+		strlen(BATCHPATH)>0 || STREAM_FD >= 0 || POSITION_SET || strlen(INPUTFILE)>0 || WRONG_LENGTH_FLAG || strlen(PATCHFILE)>0 ||
+		strlen(CHECKPOINTFILE)>0 || strlen(COMPACTFILE)>0 || strlen(HEATMAPFILE)>0 || PIPELINE_FLAG || SAMPLE_BLOCKS > 0 || SAMPLE_FRACTION > 0))
+		message("--watch requires -x or -y, -l length or -D and no -d, -b, -i, -p, -w, --patch-out, --checkpoint, --compact, --heatmap, --pipeline or --sample. Exiting program.\n") ;
+	else if (strlen(COMPACTFILE)>0 && (UPDATE_FLAG==0 || strlen(JOURNALFILE)>0 || strlen(BATCHPATH)>0 || STREAM_FD >= 0))
+		message("--compact requires -u and no -J, -b or filter mode. Exiting program.\n") ;
+	else if (ONLINE_FLAG && (UPDATE_FLAG==0 || strlen(COMPACTFILE)>0 || STREAM_FD >= 0))
+		message("--online requires -u and no --compact or filter mode. Exiting program.\n") ;
+	else if (strlen(PATCHFILE)>0 && (UPDATE_FLAG || strlen(JOURNALFILE)>0 || strlen(BATCHPATH)>0 || STREAM_FD >= 0 || strlen(CHECKPOINTFILE)>0))
+		message("--patch-out runs in report mode and requires no -u, -J, -b, --checkpoint or filter mode. Exiting program.\n") ;
+	else if (strlen(CHECKPOINTFILE)>0 && (IO_ENGINE != ENGINE_MMAP || THREAD_COUNT > 1 || INCREMENTAL_FLAG || strlen(BATCHPATH)>0 ||
+		STREAM_FD >= 0 || (FULL_DETECTION_FLAG==0 && ZERO_DETECTION_FLAG==0)))
+		message("--checkpoint requires -x or -y with the mmap engine and no -b, -j, -m or filter mode. Exiting program.\n") ;
+	else if (PIPELINE_FLAG && (IO_ENGINE == ENGINE_STDIO || IO_ENGINE == ENGINE_URING || (THREAD_COUNT > 1 && strlen(BATCHPATH)==0) ||
+		INCREMENTAL_FLAG || strlen(CHECKPOINTFILE)>0))
+		message("--pipeline requires the mmap, pread or direct engine and no -m, --checkpoint or -j outside batch mode. Exiting program.\n") ;
+	else if (AUTO_SIZE && STREAM_FD >= 0)
+		message("-l auto requires a data file (-d or -b). Exiting program.\n") ;
+	else if (AUTO_SIZE && strlen(BATCHPATH)==0 && strlen(DATAFILE)>0 && detect_record_size(DATAFILE)!=0)
+		message("Record size detection failed. Exiting program.\n") ;
+	else if (INCREMENTAL_FLAG && IO_ENGINE != ENGINE_MMAP)
+		message("Incremental mode (-m) requires the mmap engine. Exiting program.\n") ;
+	else if (REPORT_FORMAT == FORMAT_BINARY && CTX->callback == NULL && strlen(REPORTFILE)==0)
+		message("-F binary requires a report file (-o). Exiting program.\n") ;
+	else if (STREAM_FD >= 0 && ((FULL_DETECTION_FLAG==0 && ZERO_DETECTION_FLAG==0) || POSITION_SET || strlen(INPUTFILE)>0 ||
+		WRONG_LENGTH_FLAG || INCREMENTAL_FLAG || strlen(BATCHPATH)>0 || ITEST_FLAG))
+		message("Filter mode (-d -) requires -x or -y and no -b, -i, -m, -p, -t or -w. Exiting program.\n") ;
+	else if (strlen(BATCHPATH)==0 && strlen(WATCHDIR)==0 && (strlen(DATAFILE)==0 || RECORD_SIZE==0 || ((POSITION_SET==0 && INPUTFILE==NULL) && FULL_DETECTION_FLAG==0 &&
+		ZERO_DETECTION_FLAG == 0 && WRONG_LENGTH_FLAG == 0))){
+		message("Not all parameters provided. Exiting program.\n") ;
+		message("Data file: %s; RECORD_SIZE: %zu; POSITION_SET = %zu\n",DATAFILE,RECORD_SIZE,POSITION_SET) ;
+	}
+	else{
+		message("Using fill character: '%c' (hex: %x; dec: %d).\n",FILL_VALUE,FILL_VALUE&0xff,FILL_VALUE);
+		if (init_translation()==0 && init_fields()==0 && init_report()==0){
+			init_classifier() ;
+			if (SAMPLE_BLOCKS > 0 || SAMPLE_FRACTION > 0)
+				ret_val = sample_file() ;
+			else if (strlen(WATCHDIR)>0)
+				ret_val = process_watch() ;
+			else if (strlen(BATCHPATH)>0)
+				ret_val = process_batch() ;
+			else if (STREAM_FD >= 0)
+				ret_val = process_stream() ;
+			else if ((ret_val = process_file())==0 && strlen(COMPACTFILE)>0)
+				ret_val = compact_file() ;
+			if (ITEST_FLAG == 1){
+				started = stats_clock() ;
+				run_itest() ;
+				stats_phase(PHASE_ITEST,started) ;
+			}
+			if (STATS_FLAG)
+				print_stats(INVALID_COUNT) ;
+		}
+		close_report() ;
+	}
+	return ret_val ;
+} ;
+
+/*
+* filefix_scan - run over one data file with the options set on a context
+* @data_file data file including its path
+* @invalid_count invalid characters processed, may be NULL
+* @return Options incomplete or run failed
+*/
+int filefix_scan(filefix_ctx_t *ctx, const char *data_file, size_t *invalid_count){
+	int ret_val ;
+
+	CTX = ctx ;
+	INVALID_COUNT = 0 ;
+	if (strlen(data_file) >= ARRAY_SIZE || set_data_file(data_file)!=0)
+		return 1 ;
+	ret_val = filefix_run(ctx) ;
+	if (invalid_count != NULL)
+		*invalid_count = INVALID_COUNT ;
+	return ret_val ;
+} ;
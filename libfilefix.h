@@ -0,0 +1,111 @@
+/*
+* libfilefix.h
+*	Library interface of the filefix engine (libfilefix.a, libfilefix.so)
+*
+*	Every run works on its own context, so several data files can be scanned at
+*	the same time from different threads of one process. Calls on one context
+*	must not overlap.
+*
+*	Usage:
+*		filefix_ctx_t *ctx = filefix_new() ;
+*		filefix_set(ctx,"-l","256") ;
+*		filefix_set(ctx,"-y",NULL) ;
+*		filefix_set_callback(ctx,on_event,user) ;
+*		filefix_scan(ctx,"/ppro/data/SOH0001.TXT",&invalid_count) ;
+*		filefix_free(ctx) ;
+*
+*	Options are the command line options of filefix (see filefix -h), except -h.
+*	Settings stay on the context between scans.
+*
+*	Process-wide state, shared by all contexts:
+*	+ filter mode (-d -, filefix_stream()) takes over stdout of the process: the
+*	  first call keeps the original stdout for the repaired stream and points
+*	  stdout at stderr for good. Every context in filter mode writes to that
+*	  same stream, so only one of them should run at a time
+*	+ the watch daemon (--watch) installs SIGINT/SIGTERM handlers while it runs
+*	  and restores the previous ones on return. A signal stops every watching
+*	  context of the process, and only one context should watch at a time
+*/
+#ifndef LIBFILEFIX_H
+#define LIBFILEFIX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct filefix_ctx_s filefix_ctx_t ;
+
+/* Report event types, same as the binary report format (-F binary) */
+#define	FILEFIX_EVENT_RECORD 1		// first invalid character of a record
+#define	FILEFIX_EVENT_CHANGE 2		// character changed (value: offset)
+#define	FILEFIX_EVENT_NULLS 3		// 0x00 characters in record (value: count)
+#define	FILEFIX_EVENT_UPDATED 4		// record written back
+#define	FILEFIX_EVENT_POSITION 5	// position (-p/-i/-w) checked
+#define	FILEFIX_EVENT_INVALID 6		// invalid character at position (value: offset)
+#define	FILEFIX_EVENT_RECORD_DONE 7	// record-level line (value: invalid characters; old_char: deleted)
+#define	FILEFIX_EVENT_BYTE_COUNT 8	// summary: invalid characters with value old_char (position: count)
+#define	FILEFIX_EVENT_RECORD_COUNT 9	// summary: records with value invalid characters (position: count)
+#define	FILEFIX_EVENT_TOTALS 10		// summary: value 0 dirty, 1 deleted, 2 updated, 3 invalid characters, 4 skipped by --online (position: count)
+#define	FILEFIX_EVENT_FILE 11		// batch file done (position: invalid characters; value: milliseconds; old_char: failed)
+#define	FILEFIX_EVENT_SKIPPED 12	// record not written back by --online (value: 1 locked, 2 changed since the scan)
+
+/* Report event, 16 bytes in host byte order */
+typedef struct {
+	uint64_t position ;
+	uint32_t value ;
+	uint8_t type ;
+	uint8_t old_char ;
+	uint8_t new_char ;
+	uint8_t reserved ;
+} filefix_event_t ;
+
+/* Receives the report events of a run in file order, on the thread that called
+filefix_scan()/filefix_run(). With --online the updated and skipped events come
+when a batch is written, with --pipeline from its writer thread */
+typedef void (*filefix_callback_t)(void *user, const filefix_event_t *event) ;
+
+/* New context with the defaults of the command line. Messages are discarded
+until filefix_set_log() is called. NULL if out of memory */
+filefix_ctx_t *filefix_new(void) ;
+
+/* Release a context and everything it holds */
+void filefix_free(filefix_ctx_t *ctx) ;
+
+/* -1 for an unknown option, 0 for an option without a value, 1 for an option
+that takes a value */
+int filefix_option(const char *option) ;
+
+/* Set an option (e.g. "-l" "256", "-u" NULL, "--max-rate" "50"). Non-zero if the
+option is unknown or its value invalid */
+int filefix_set(filefix_ctx_t *ctx, const char *option, const char *value) ;
+
+/* Stream receiving the messages of the context, NULL discards them */
+void filefix_set_log(filefix_ctx_t *ctx, FILE *log) ;
+
+/* Deliver the report as events instead of writing it (overrides -F and -o),
+NULL restores the report stream */
+void filefix_set_callback(filefix_ctx_t *ctx, filefix_callback_t callback, void *user) ;
+
+/* Filter mode (-d -): the context writes the repaired stream to the original
+stdout, which is redirected to stderr for the rest of the process, whatever
+context made the call (see above). Call before anything is printed */
+int filefix_stream(filefix_ctx_t *ctx) ;
+
+/* Run with the options set on the context (data file from -d or -b). Non-zero
+if the options are incomplete or the run failed. With --watch it only returns
+on SIGINT/SIGTERM, which it handles for the whole process meanwhile */
+int filefix_run(filefix_ctx_t *ctx) ;
+
+/* Run over one data file. invalid_count (may be NULL) receives the invalid
+characters processed */
+int filefix_scan(filefix_ctx_t *ctx, const char *data_file, size_t *invalid_count) ;
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif